@@ -0,0 +1,263 @@
+#include "cluster.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace cluster {
+
+uint16_t crc16(const char *data, size_t length) {
+  // CRC-16/XMODEM, polynomial 0x1021, the variant redis cluster uses.
+  uint16_t crc = 0;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= static_cast<uint16_t>(static_cast<unsigned char>(data[i]) << 8);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                           : static_cast<uint16_t>(crc << 1);
+    }
+  }
+  return crc;
+}
+
+uint16_t key_slot(std::string_view key) {
+  size_t open = key.find('{');
+  if (open != std::string_view::npos) {
+    size_t close = key.find('}', open + 1);
+    // An empty tag "{}" hashes the whole key
+    if (close != std::string_view::npos && close != open + 1) {
+      key = key.substr(open + 1, close - open - 1);
+    }
+  }
+  return crc16(key.data(), key.size()) & (SLOT_COUNT - 1);
+}
+
+bool parse_address(const std::string &address, std::string &host, int &port) {
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon == 0 ||
+      colon + 1 == address.size())
+    return false;
+  try {
+    size_t used = 0;
+    port = std::stoi(address.substr(colon + 1), &used);
+    if (used != address.size() - colon - 1 || port <= 0 || port > 65535)
+      return false;
+  } catch (const std::exception &) {
+    return false;
+  }
+  host = address.substr(0, colon);
+  return true;
+}
+
+SlotMap::SlotMap(const std::string &self_address)
+    : m_self_address(self_address), m_nodes{self_address} {}
+
+SlotState SlotMap::state(uint16_t slot) const {
+  std::shared_lock<std::shared_mutex> lock(m_mutex);
+  return m_slots[slot];
+}
+
+std::string SlotMap::address(int node) const {
+  std::shared_lock<std::shared_mutex> lock(m_mutex);
+  if (node < 0 || node >= static_cast<int>(m_nodes.size()))
+    return "";
+  return m_nodes[node];
+}
+
+int SlotMap::node_index(const std::string &address) {
+  for (size_t i = 0; i < m_nodes.size(); i++) {
+    if (m_nodes[i] == address)
+      return static_cast<int>(i);
+  }
+  m_nodes.push_back(address);
+  return static_cast<int>(m_nodes.size() - 1);
+}
+
+void SlotMap::set_owner(uint16_t slot, const std::string &address) {
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  SlotState &state = m_slots[slot];
+  state.owner = node_index(address);
+  // Ownership settled, any migration of this slot is over
+  state.migrating_to = NO_NODE;
+  state.importing_from = NO_NODE;
+}
+
+void SlotMap::set_migrating(uint16_t slot, const std::string &address) {
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  m_slots[slot].migrating_to = node_index(address);
+}
+
+void SlotMap::set_importing(uint16_t slot, const std::string &address) {
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  m_slots[slot].importing_from = node_index(address);
+}
+
+void SlotMap::set_stable(uint16_t slot) {
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  m_slots[slot].migrating_to = NO_NODE;
+  m_slots[slot].importing_from = NO_NODE;
+}
+
+std::vector<std::string> SlotMap::describe() const {
+  std::shared_lock<std::shared_mutex> lock(m_mutex);
+  std::vector<std::string> ranges;
+  int start = 0;
+  for (int slot = 1; slot <= SLOT_COUNT; slot++) {
+    if (slot < SLOT_COUNT && m_slots[slot].owner == m_slots[start].owner)
+      continue;
+    if (m_slots[start].owner != NO_NODE) {
+      ranges.push_back(std::to_string(start) + " " +
+                       std::to_string(slot - 1) + " " +
+                       m_nodes[m_slots[start].owner]);
+    }
+    start = slot;
+  }
+  return ranges;
+}
+
+size_t SlotMap::owned_slot_count() const {
+  std::shared_lock<std::shared_mutex> lock(m_mutex);
+  size_t count = 0;
+  for (const SlotState &state : m_slots) {
+    if (state.owner == 0)
+      count++;
+  }
+  return count;
+}
+
+void SlotIndex::add(const std::string &key) {
+  m_slots[key_slot(key)].insert(key);
+}
+
+void SlotIndex::remove(const std::string &key) {
+  m_slots[key_slot(key)].erase(key);
+}
+
+void SlotIndex::clear() {
+  for (auto &keys : m_slots)
+    keys.clear();
+}
+
+std::vector<std::string> SlotIndex::keys(uint16_t slot,
+                                         size_t max_keys) const {
+  std::vector<std::string> keys;
+  for (const std::string &key : m_slots[slot]) {
+    if (keys.size() >= max_keys)
+      break;
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+NodeClient::~NodeClient() {
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
+bool NodeClient::connect(const std::string &address) {
+  std::string host;
+  int port;
+  if (!parse_address(address, host, port))
+    return false;
+
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &result) != 0)
+    return false;
+
+  m_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (m_fd < 0 || ::connect(m_fd, result->ai_addr, result->ai_addrlen) < 0) {
+    freeaddrinfo(result);
+    if (m_fd >= 0) {
+      close(m_fd);
+      m_fd = -1;
+    }
+    return false;
+  }
+  freeaddrinfo(result);
+  int opt = 1;
+  setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  return true;
+}
+
+bool NodeClient::send_all(const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(m_fd, data.data() + sent, data.size() - sent,
+                     MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+bool NodeClient::read_line(std::string &line) {
+  char buffer[4096];
+  while (true) {
+    size_t newline_pos = m_buffer.find('\n');
+    if (newline_pos != std::string::npos) {
+      line = m_buffer.substr(0, newline_pos);
+      m_buffer.erase(0, newline_pos + 1);
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      return true;
+    }
+    ssize_t n = recv(m_fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    m_buffer.append(buffer, n);
+  }
+}
+
+bool NodeClient::call(const std::string &command, std::string &reply) {
+  return send_all(command + "\r\n") && read_line(reply);
+}
+
+std::string hex_encode(const std::string &data) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  hex.resize(data.size() * 2);
+  for (size_t i = 0; i < data.size(); i++) {
+    unsigned char byte = static_cast<unsigned char>(data[i]);
+    hex[2 * i] = digits[byte >> 4];
+    hex[2 * i + 1] = digits[byte & 0x0F];
+  }
+  return hex;
+}
+
+bool hex_decode(const std::string &hex, std::string &out) {
+  auto nibble = [](char c) -> int {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  };
+  if (hex.size() % 2 != 0)
+    return false;
+  out.resize(hex.size() / 2);
+  for (size_t i = 0; i < out.size(); i++) {
+    int high = nibble(hex[2 * i]);
+    int low = nibble(hex[2 * i + 1]);
+    if (high < 0 || low < 0)
+      return false;
+    out[i] = static_cast<char>((high << 4) | low);
+  }
+  return true;
+}
+
+} // namespace cluster
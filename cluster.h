@@ -0,0 +1,106 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Keyspace partitioning over a fixed number of hash slots, same scheme as
+// redis cluster: slot = CRC16(key) mod 16384, where only the part between
+// the first `{` and the next `}` is hashed if present, so related keys such
+// as `{user:1}:name` and `{user:1}:mail` can be kept on the same node.
+namespace cluster {
+
+const int SLOT_COUNT = 16384;
+const int NO_NODE = -1;
+
+uint16_t crc16(const char *data, size_t length);
+uint16_t key_slot(std::string_view key);
+
+// Parses "host:port"; returns false on malformed input.
+bool parse_address(const std::string &address, std::string &host, int &port);
+
+struct SlotState {
+  int owner = NO_NODE;
+  int migrating_to = NO_NODE;
+  int importing_from = NO_NODE;
+};
+
+// Which node serves which slot, plus in-flight migrations. Nodes are
+// identified by their "host:port" address; node 0 is always this process.
+class SlotMap {
+public:
+  explicit SlotMap(const std::string &self_address);
+
+  SlotState state(uint16_t slot) const;
+  std::string address(int node) const;
+  int self() const { return 0; }
+  const std::string &self_address() const { return m_self_address; }
+
+  void set_owner(uint16_t slot, const std::string &address);
+  void set_migrating(uint16_t slot, const std::string &address);
+  void set_importing(uint16_t slot, const std::string &address);
+  // Clears the migrating/importing state of a slot.
+  void set_stable(uint16_t slot);
+
+  // One line per contiguous range with the same owner:
+  // "<start> <end> <host:port>", unassigned ranges are skipped.
+  std::vector<std::string> describe() const;
+  size_t owned_slot_count() const;
+
+private:
+  int node_index(const std::string &address); // Caller holds m_mutex
+
+  mutable std::shared_mutex m_mutex;
+  std::string m_self_address;
+  std::vector<std::string> m_nodes;
+  std::array<SlotState, SLOT_COUNT> m_slots;
+};
+
+// Keys of each slot, so a migration can pick the next batch without scanning
+// the whole store. Not thread safe, guarded by the data store mutex.
+class SlotIndex {
+public:
+  SlotIndex() : m_slots(SLOT_COUNT) {}
+
+  void add(const std::string &key);
+  void remove(const std::string &key);
+  void clear();
+  size_t count(uint16_t slot) const { return m_slots[slot].size(); }
+  std::vector<std::string> keys(uint16_t slot, size_t max_keys) const;
+
+private:
+  std::vector<std::unordered_set<std::string>> m_slots;
+};
+
+// Minimal blocking client used to talk to other nodes, speaks the same
+// line protocol as command_server.
+class NodeClient {
+public:
+  NodeClient() = default;
+  ~NodeClient();
+  NodeClient(const NodeClient &) = delete;
+  NodeClient &operator=(const NodeClient &) = delete;
+
+  bool connect(const std::string &address);
+  bool send_all(const std::string &data);
+  // Reads one "\r\n" terminated reply line, without the terminator.
+  bool read_line(std::string &line);
+  // Sends `command` and returns the first reply line.
+  bool call(const std::string &command, std::string &reply);
+
+private:
+  int m_fd = -1;
+  std::string m_buffer;
+};
+
+std::string hex_encode(const std::string &data);
+bool hex_decode(const std::string &hex, std::string &out);
+
+} // namespace cluster
+#endif // !CLUSTER_H
@@ -1,15 +1,40 @@
+// Build:
+//   g++ -std=c++17 -pthread command_server.cpp utils.cpp kv_ops.cpp
+//       value_codec.cpp lz_codec.cpp cluster.cpp net_core.cpp instrument.cpp
+//       -o command_server
+//
+// Cluster mode, e.g. two nodes on localhost splitting the keyspace:
+//   ./command_server --port 7001 --cluster
+//   ./command_server --port 7002 --cluster
+//   node 7001: CLUSTER ADDSLOTS 0-8191
+//              CLUSTER SETSLOT 8192-16383 NODE 127.0.0.1:7002
+//   node 7002: CLUSTER ADDSLOTS 8192-16383
+//              CLUSTER SETSLOT 0-8191 NODE 127.0.0.1:7001
+// and later move slots in the background with CLUSTER MIGRATE.
+#include "cluster.h"
+#include "command_table.h"
+#include "instrument.h"
+#include "kv_ops.h"
+#include "lz_codec.h"
+#include "net_core.h"
+#include "thread_pool.h"
 #include "utils.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstdint>
-#include <cstring>
+#include <exception>
+#include <stdexcept>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
-#include <netinet/in.h>
-#include <optional>
 #include <ostream>
 #include <string>
-#include <sys/socket.h>
+#include <string_view>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
@@ -17,18 +42,32 @@
 
 using std::cout;
 using std::endl;
-using utils::send_response;
 
 const int PORT = 6380;
-const int BACKLOG = 5;
-const int BUFFER_SIZE = 1024;
+const int BUFFER_SIZE = 16 * 1024;
+const size_t DEFAULT_MIGRATION_BATCH = 64;
+const size_t MIGRATION_THREADS = 2;
+
+int server_port = PORT;
+net::ListenerOptions listener_options;
+std::string announce_host = "127.0.0.1";
 
 std::string DUMP_FILE_NAME = "miniredis.dump";
-std::unordered_map<std::string, std::string> data_store;
+ValueMap data_store;
 std::mutex data_store_mutex;
+value_codec::ValueCodec codec;
+
+// Only allocated with --cluster; a null slot_map means every key is local.
+std::unique_ptr<cluster::SlotMap> slot_map;
+std::unique_ptr<cluster::SlotIndex> slot_index;
+std::atomic<int> active_migrations{0};
+std::atomic<uint64_t> migrated_keys{0};
+// Runs CLUSTER MIGRATE jobs; a few at most move keys at the same time and
+// the rest wait their turn.
+std::unique_ptr<threading::ThreadPool> background_jobs;
 
 bool save_to_disk() {
-  std::lock_guard<std::mutex> guard(data_store_mutex);
+  INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
   std::ofstream outfile(DUMP_FILE_NAME, std::ios::out | std::ios::trunc);
 
   if (!outfile.is_open()) {
@@ -38,9 +77,14 @@ bool save_to_disk() {
   }
 
   cout << "Saving data to " << DUMP_FILE_NAME << " ...." << endl;
+  std::string value;
   for (const auto &pair : data_store) {
+    if (!codec.decode(*pair.second, value)) {
+      std::cerr << "Skipping corrupted value for key " << pair.first << endl;
+      continue;
+    }
     outfile << pair.first << endl;
-    outfile << pair.second << endl;
+    outfile << value << endl;
   }
   outfile.close();
   cout << "Data saved Successfully." << endl;
@@ -48,7 +92,7 @@ bool save_to_disk() {
 }
 
 bool load_from_disk() {
-  std::lock_guard<std::mutex> guard(data_store_mutex);
+  INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
   std::ifstream infile(DUMP_FILE_NAME, std::ios::in);
 
   if (!infile.is_open()) {
@@ -59,13 +103,24 @@ bool load_from_disk() {
   }
 
   cout << "Loading data from " << DUMP_FILE_NAME << "...." << endl;
+  for (const auto &pair : data_store)
+    codec.on_remove(*pair.second);
   data_store.clear();
+  if (slot_index)
+    slot_index->clear();
 
   std::string key, value;
   int keys_loaded = 0;
 
   while (std::getline(infile, key) && std::getline(infile, value)) {
-    data_store[key] = value;
+    auto &stored = data_store[key];
+    if (stored)
+      codec.on_remove(*stored);
+    stored = std::make_shared<const value_codec::StoredValue>(
+        codec.encode(value));
+    codec.on_insert(*stored);
+    if (slot_index)
+      slot_index->add(key);
     keys_loaded++;
   }
 
@@ -84,172 +139,1034 @@ bool load_from_disk() {
   return true;
 }
 
-void handle_client(int client_fd) {
-  cout << "Thread : " << std::this_thread::get_id() << " Handling Client FD"
-       << client_fd << endl;
+struct ClientLimits {
+  // Output buffer: over `output_hard_limit` the client is dropped at once,
+  // over `output_soft_limit` for `output_soft_seconds` it is dropped too.
+  // reply() flushes synchronously past OUTPUT_FLUSH_THRESHOLD, so these
+  // bound a single reply; a reader that is merely slow is caught by the
+  // write timeout instead.
+  size_t output_hard_limit = 64 * 1024 * 1024;
+  size_t output_soft_limit = 16 * 1024 * 1024;
+  int output_soft_seconds = 60;
+  // A client that doesn't read any of its pending output for this long is
+  // dropped, so a stalled reader can't pin its thread in send forever.
+  int write_timeout_seconds = 10;
+  // Bytes of a command line that hasn't seen its newline yet.
+  size_t query_buffer_limit = 64 * 1024 * 1024;
+  // Abandoned connections would otherwise keep their thread. 0 disables it.
+  int idle_timeout_seconds = 300;
+};
+ClientLimits client_limits;
+
+// Replies are buffered and written once per batch of pipelined commands, or
+// as soon as this much is pending.
+const size_t OUTPUT_FLUSH_THRESHOLD = 64 * 1024;
+const int WRITE_POLL_MS = 250;
+
+struct DisconnectStats {
+  std::atomic<uint64_t> output_hard_limit{0};
+  std::atomic<uint64_t> output_soft_limit{0};
+  std::atomic<uint64_t> write_timeout{0};
+  std::atomic<uint64_t> query_buffer_limit{0};
+  std::atomic<uint64_t> idle_timeout{0};
+  std::atomic<uint64_t> killed{0};
+};
+DisconnectStats disconnect_stats;
+
+int64_t steady_now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Per-connection state. The fields CLIENT LIST reports on are atomics (or
+// guarded by name_mutex), everything else is only touched by the client's
+// own thread.
+struct ClientContext {
+  uint64_t id = 0;
+  std::unique_ptr<net::Connection> conn;
+  int64_t created_ms = steady_now_ms();
+  std::atomic<int64_t> last_interaction_ms{steady_now_ms()};
+  std::atomic<uint64_t> bytes_in{0};
+  std::atomic<uint64_t> bytes_out{0};
+  std::atomic<size_t> query_buffer_size{0};
+  std::atomic<size_t> output_buffer_size{0};
+  std::atomic<size_t> output_memory{0};
+  std::atomic<const char *> last_command{"NULL"};
+  std::atomic<bool> killed{false};
+  mutable std::mutex name_mutex;
+  std::string name;
+
+  std::string output;
+  bool quit = false;
+  // Set by ASKING, lets the next command reach a slot being imported.
+  bool asking = false;
+
+  void reply(const std::string &response) {
+    if (quit)
+      return;
+    if (output.size() + response.size() > client_limits.output_hard_limit) {
+      disconnect("output buffer hard limit reached",
+                 disconnect_stats.output_hard_limit);
+      return;
+    }
+    output += response;
+    if (output.size() >= OUTPUT_FLUSH_THRESHOLD)
+      flush();
+  }
+
+  // Writes out everything buffered, enforcing the soft limit and the write
+  // timeout while the client is slow to read.
+  void flush() {
+    size_t offset = 0;
+    int64_t last_progress_ms = steady_now_ms();
+    int64_t over_soft_since_ms = -1;
+
+    while (offset < output.size()) {
+      size_t pending = output.size() - offset;
+      output_buffer_size.store(pending, std::memory_order_relaxed);
+      output_memory.store(output.capacity(), std::memory_order_relaxed);
+
+      ssize_t n = conn->write_some(
+          std::string_view(output.data() + offset, pending), WRITE_POLL_MS);
+      int64_t now_ms = steady_now_ms();
+      if (n > 0) {
+        offset += n;
+        bytes_out.fetch_add(n, std::memory_order_relaxed);
+        last_progress_ms = now_ms;
+        if (output.size() - offset <= client_limits.output_soft_limit)
+          over_soft_since_ms = -1;
+        continue;
+      }
+      if (errno != ETIMEDOUT || killed) {
+        // A client we can't write to is gone, stop serving it
+        quit = true;
+        break;
+      }
+
+      if (pending > client_limits.output_soft_limit) {
+        if (over_soft_since_ms < 0)
+          over_soft_since_ms = now_ms;
+        else if (now_ms - over_soft_since_ms >
+                 client_limits.output_soft_seconds * 1000LL) {
+          disconnect("output buffer soft limit exceeded for too long",
+                     disconnect_stats.output_soft_limit);
+        }
+      }
+      if (!quit &&
+          now_ms - last_progress_ms > client_limits.write_timeout_seconds *
+                                          1000LL) {
+        disconnect("not reading its replies",
+                   disconnect_stats.write_timeout);
+      }
+    }
+
+    // Don't keep the capacity of one huge reply around for the lifetime of
+    // the connection
+    if (output.capacity() > 4 * OUTPUT_FLUSH_THRESHOLD)
+      std::string().swap(output);
+    else
+      output.clear();
+    output_buffer_size.store(0, std::memory_order_relaxed);
+    output_memory.store(output.capacity(), std::memory_order_relaxed);
+  }
+
+  void disconnect(const char *reason, std::atomic<uint64_t> &counter) {
+    cout << "Closing client " << conn->peer() << ": " << reason << endl;
+    counter.fetch_add(1, std::memory_order_relaxed);
+    quit = true;
+    output.clear();
+  }
+};
+
+std::unique_ptr<net::Acceptor> acceptor;
+std::mutex clients_mutex;
+std::map<uint64_t, std::shared_ptr<ClientContext>> clients;
+std::atomic<uint64_t> next_client_id{1};
+
+using CommandHandler = void (*)(ClientContext &,
+                                const std::vector<std::string> &);
+using command_table::CMD_ADMIN;
+using command_table::CMD_READ;
+using command_table::CMD_WRITE;
+
+void cmd_ping(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_set(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_get(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_getall(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_del(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_save(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_info(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_quit(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_asking(ClientContext &client, const std::vector<std::string> &tokens);
+void cmd_restore(ClientContext &client,
+                 const std::vector<std::string> &tokens);
+void cmd_cluster(ClientContext &client,
+                 const std::vector<std::string> &tokens);
+void cmd_client(ClientContext &client, const std::vector<std::string> &tokens);
+
+// Every command the server understands. Adding a command is one line here,
+// the perfect hash is recomputed at compile time.
+constexpr command_table::CommandTable<CommandHandler, 12> COMMANDS({{
+    {"PING", -1, CMD_READ, 0, cmd_ping},
+    {"SET", 3, CMD_WRITE, 1, cmd_set},
+    {"GET", 2, CMD_READ, 1, cmd_get},
+    {"GETALL", 1, CMD_READ, 0, cmd_getall},
+    {"DEL", 2, CMD_WRITE, 1, cmd_del},
+    {"SAVE", 1, CMD_ADMIN, 0, cmd_save},
+    {"INFO", 1, CMD_ADMIN, 0, cmd_info},
+    {"QUIT", -1, 0, 0, cmd_quit},
+    {"ASKING", 1, 0, 0, cmd_asking},
+    {"RESTORE", 4, CMD_WRITE, 1, cmd_restore},
+    {"CLUSTER", -2, CMD_ADMIN, 0, cmd_cluster},
+    {"CLIENT", -2, CMD_ADMIN, 0, cmd_client},
+}});
+
+struct CommandStats {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> usec{0};
+  std::atomic<uint64_t> rejected_calls{0};
+};
+std::array<CommandStats, COMMANDS.size()> command_stats;
+std::atomic<uint64_t> unknown_commands{0};
+
+void cmd_ping(ClientContext &client, const std::vector<std::string> &tokens) {
+  if (tokens.size() == 1)
+    client.reply("+PONG\r\n");
+  else if (tokens.size() == 2)
+    client.reply("$" + std::to_string(tokens[1].length()) + "\r\n" +
+                 tokens[1] + "\r\n");
+  else
+    client.reply("-ERR wrong number of arguments for 'ping' command\r\n");
+}
+
+void cmd_set(ClientContext &client, const std::vector<std::string> &tokens) {
+  utils::kv_set(tokens[1], tokens[2], data_store, data_store_mutex, codec,
+                slot_index.get());
+  client.reply("+OK\r\n");
+}
+
+void cmd_get(ClientContext &client, const std::vector<std::string> &tokens) {
+  std::string value;
+  switch (utils::kv_get(tokens[1], data_store, data_store_mutex, codec,
+                        value)) {
+  case utils::GetResult::FOUND:
+    client.reply("$" + std::to_string(value.length()) + "\r\n" + value +
+                 "\r\n");
+    break;
+  case utils::GetResult::NOT_FOUND:
+    client.reply("$-1\r\n");
+    break;
+  case utils::GetResult::CORRUPTED:
+    client.reply("-ERR stored value is corrupted\r\n");
+    break;
+  }
+}
+
+void cmd_getall(ClientContext &client,
+                const std::vector<std::string> & /*tokens*/) {
+  // Fetch values one at a time instead of copying the whole store, so the
+  // reply streams out through the output buffer and its limits.
+  std::string value;
+  for (const std::string &key : utils::kv_keys(data_store, data_store_mutex)) {
+    utils::GetResult result =
+        utils::kv_get(key, data_store, data_store_mutex, codec, value);
+    if (result == utils::GetResult::FOUND)
+      client.reply(key + " : " + value + "\r\n");
+    else if (result == utils::GetResult::CORRUPTED)
+      std::cerr << "Skipping corrupted value for key " << key << endl;
+    if (client.quit)
+      break;
+  }
+}
+
+void cmd_del(ClientContext &client, const std::vector<std::string> &tokens) {
+  if (utils::kv_del(tokens[1], data_store, data_store_mutex, codec,
+                    slot_index.get()))
+    client.reply(":1\r\n");
+  else
+    client.reply(":0\r\n");
+}
+
+void cmd_save(ClientContext &client,
+              const std::vector<std::string> & /*tokens*/) {
+  if (save_to_disk())
+    client.reply("+OK\r\n");
+  else
+    client.reply("-ERR could not write dump file\r\n");
+}
+
+void cmd_info(ClientContext &client,
+              const std::vector<std::string> & /*tokens*/) {
+  auto load = [](const std::atomic<uint64_t> &counter) {
+    return std::to_string(counter.load(std::memory_order_relaxed));
+  };
+  std::string info = "# Clients\r\n";
+  info += "connected_clients:" +
+          std::to_string(acceptor->active_connections()) + "\r\n";
+  info += "total_connections_received:" +
+          std::to_string(acceptor->accepted_connections()) + "\r\n";
+  info += "rejected_connections:" +
+          std::to_string(acceptor->rejected_connections()) + "\r\n";
+  info += "client_output_hard_limit_disconnections:" +
+          load(disconnect_stats.output_hard_limit) + "\r\n";
+  info += "client_output_soft_limit_disconnections:" +
+          load(disconnect_stats.output_soft_limit) + "\r\n";
+  info += "client_write_timeout_disconnections:" +
+          load(disconnect_stats.write_timeout) + "\r\n";
+  info += "client_query_buffer_limit_disconnections:" +
+          load(disconnect_stats.query_buffer_limit) + "\r\n";
+  info += "client_idle_timeout_disconnections:" +
+          load(disconnect_stats.idle_timeout) + "\r\n";
+  info += "client_killed:" + load(disconnect_stats.killed) + "\r\n";
+
+  info += "\r\n# Commandstats\r\n";
+  for (const auto &spec : COMMANDS.specs()) {
+    const CommandStats &stats = command_stats[COMMANDS.index_of(&spec)];
+    uint64_t calls = stats.calls.load(std::memory_order_relaxed);
+    uint64_t usec = stats.usec.load(std::memory_order_relaxed);
+    uint64_t rejected = stats.rejected_calls.load(std::memory_order_relaxed);
+    info += "cmdstat_" + std::string(spec.name) +
+            ":calls=" + std::to_string(calls) +
+            ",usec=" + std::to_string(usec) +
+            ",usec_per_call=" + std::to_string(calls ? usec / calls : 0) +
+            ",rejected_calls=" + std::to_string(rejected) + "\r\n";
+  }
+  info += "unknown_commands:" +
+          std::to_string(unknown_commands.load(std::memory_order_relaxed)) +
+          "\r\n";
+  info += "\r\n# Compression\r\n";
+  info += codec.info();
+  info += "\r\n# Cluster\r\n";
+  info += "cluster_enabled:" + std::to_string(slot_map != nullptr) + "\r\n";
+  if (slot_map) {
+    info += "cluster_myself:" + slot_map->self_address() + "\r\n";
+    info += "cluster_slots_owned:" +
+            std::to_string(slot_map->owned_slot_count()) + "\r\n";
+    info += "cluster_active_migrations:" +
+            std::to_string(active_migrations.load()) + "\r\n";
+    info += "cluster_migrated_keys:" + std::to_string(migrated_keys.load()) +
+            "\r\n";
+  }
+  client.reply("$" + std::to_string(info.length()) + "\r\n" + info + "\r\n");
+}
+
+void cmd_quit(ClientContext &client,
+              const std::vector<std::string> & /*tokens*/) {
+  client.reply("+OK\r\n");
+  cout << "Client " << client.conn->peer() << " is Quitting......." << endl;
+  client.quit = true;
+}
+
+void cmd_asking(ClientContext &client,
+                const std::vector<std::string> & /*tokens*/) {
+  client.asking = true;
+  client.reply("+OK\r\n");
+}
+
+// RESTORE <key> <raw_size> <hex bytes>: stores an already encoded value, used
+// by slot migration. raw_size 0 means the bytes are not compressed, "-"
+// stands for an empty value.
+void cmd_restore(ClientContext &client,
+                 const std::vector<std::string> &tokens) {
+  value_codec::StoredValue stored;
+  // stoul alone would take "-1" and wrap it. No value can be larger than
+  // the command line a SET of it would take.
+  unsigned long long raw_size = 0;
+  bool valid_size =
+      tokens[2].find_first_not_of("0123456789") == std::string::npos;
+  try {
+    if (valid_size)
+      raw_size = std::stoull(tokens[2]);
+  } catch (const std::exception &) {
+    valid_size = false;
+  }
+  if (!valid_size) {
+    client.reply("-ERR invalid raw size\r\n");
+    return;
+  }
+  if (tokens[3] != "-" && !cluster::hex_decode(tokens[3], stored.bytes)) {
+    client.reply("-ERR invalid payload\r\n");
+    return;
+  }
+  if (raw_size > client_limits.query_buffer_limit ||
+      raw_size > UINT32_MAX ||
+      raw_size > lz::max_decompressed_size(stored.bytes.size())) {
+    client.reply("-ERR invalid raw size\r\n");
+    return;
+  }
+  stored.raw_size = static_cast<uint32_t>(raw_size);
+  stored.compressed = stored.raw_size > 0;
+  // Decoded once here, so a bad block is refused now rather than failing
+  // every GET later
+  std::string decoded;
+  if (stored.compressed && !codec.decode(stored, decoded)) {
+    client.reply("-ERR invalid payload\r\n");
+    return;
+  }
+
+  auto shared =
+      std::make_shared<const value_codec::StoredValue>(std::move(stored));
+  {
+    INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+    auto [it, inserted] = data_store.try_emplace(tokens[1]);
+    if (!inserted)
+      codec.on_remove(*it->second);
+    else if (slot_index)
+      slot_index->add(tokens[1]);
+    codec.on_insert(*shared);
+    it->second = std::move(shared);
+  }
+  client.reply("+OK\r\n");
+}
+
+// Accepts "N" or "A-B".
+bool parse_slot_range(const std::string &token, int &start, int &end) {
+  try {
+    size_t dash = token.find('-');
+    start = std::stoi(token.substr(0, dash));
+    end = dash == std::string::npos ? start : std::stoi(token.substr(dash + 1));
+  } catch (const std::exception &) {
+    return false;
+  }
+  return start >= 0 && start <= end && end < cluster::SLOT_COUNT;
+}
+
+// Moves every key of slots [start, end] to `target` in batches of
+// `batch_size`, then hands the slots over. Runs as a background job while
+// this node keeps serving: keys not migrated yet are served here, keys
+// already moved are answered with an ASK redirect.
+void migrate_slots(int start, int end, std::string target,
+                   size_t batch_size) {
+  active_migrations++;
+  cluster::NodeClient peer;
+  if (!peer.connect(target)) {
+    std::cerr << "Migration: could not connect to " << target << endl;
+    active_migrations--;
+    return;
+  }
+
+  std::string reply;
+  for (int slot = start; slot <= end; slot++) {
+    if (slot_map->state(slot).owner != slot_map->self())
+      continue;
+    bool empty;
+    {
+      // An empty slot is handed over right away. Marked migrating under the
+      // store lock, a concurrent SET is redirected to the target instead of
+      // slipping in here, and the slot stays ours until the target has
+      // taken it.
+      INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+      empty = slot_index->count(slot) == 0;
+      if (empty)
+        slot_map->set_migrating(slot, target);
+    }
+    if (empty) {
+      if (!peer.call("CLUSTER SETSLOT " + std::to_string(slot) + " NODE " +
+                         target,
+                     reply) ||
+          reply != "+OK") {
+        std::cerr << "Migration: " << target << " refused slot " << slot
+                  << ": " << reply << endl;
+        slot_map->set_stable(slot);
+        break;
+      }
+      slot_map->set_owner(slot, target);
+      continue;
+    }
+
+    if (!peer.call("CLUSTER SETSLOT " + std::to_string(slot) + " IMPORTING " +
+                       slot_map->self_address(),
+                   reply) ||
+        reply != "+OK") {
+      std::cerr << "Migration: " << target << " refused slot " << slot << ": "
+                << reply << endl;
+      break;
+    }
+    slot_map->set_migrating(slot, target);
+
+    bool failed = false;
+    while (!failed) {
+      std::vector<std::pair<std::string,
+                            std::shared_ptr<const value_codec::StoredValue>>>
+          batch;
+      {
+        INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+        for (std::string &key : slot_index->keys(slot, batch_size)) {
+          auto it = data_store.find(key);
+          if (it != data_store.end())
+            batch.emplace_back(std::move(key), it->second);
+        }
+      }
+      if (batch.empty())
+        break;
+
+      // One pipelined round trip per batch
+      std::string pipeline;
+      for (const auto &[key, value] : batch) {
+        pipeline += "ASKING\r\nRESTORE " + key + " " +
+                    std::to_string(value->compressed ? value->raw_size : 0) +
+                    " " +
+                    (value->bytes.empty() ? "-"
+                                          : cluster::hex_encode(value->bytes)) +
+                    "\r\n";
+      }
+      failed = !peer.send_all(pipeline);
+      for (size_t i = 0; i < batch.size() * 2 && !failed; i++) {
+        failed = !peer.read_line(reply) || reply != "+OK";
+      }
+      if (failed)
+        break;
+
+      // Only drop keys nobody wrote to while they were in flight, which
+      // still hold the very value sent; a key that changed is still in the
+      // index and goes out with the next batch.
+      // One deleted meanwhile was restored on the target all the same, and
+      // has to be deleted there before the target owns the slot.
+      std::vector<std::string> deleted;
+      {
+        INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+        for (const auto &[key, value] : batch) {
+          auto it = data_store.find(key);
+          if (it == data_store.end()) {
+            deleted.push_back(key);
+            continue;
+          }
+          if (it->second != value)
+            continue;
+          codec.on_remove(*it->second);
+          slot_index->remove(key);
+          data_store.erase(it);
+          migrated_keys++;
+        }
+      }
+      if (deleted.empty())
+        continue;
+      // A key set again since goes out with a later batch, and its RESTORE
+      // follows this DEL on the same connection
+      pipeline.clear();
+      for (const std::string &key : deleted)
+        pipeline += "ASKING\r\nDEL " + key + "\r\n";
+      failed = !peer.send_all(pipeline);
+      for (size_t i = 0; i < deleted.size() && !failed; i++) {
+        failed = !peer.read_line(reply) || reply != "+OK" ||
+                 !peer.read_line(reply) || reply.empty() || reply[0] != ':';
+      }
+    }
+
+    if (failed ||
+        !peer.call("CLUSTER SETSLOT " + std::to_string(slot) + " NODE " +
+                       target,
+                   reply) ||
+        reply != "+OK") {
+      std::cerr << "Migration: could not hand slot " << slot << " over to "
+                << target << endl;
+      slot_map->set_stable(slot);
+      break;
+    }
+    slot_map->set_owner(slot, target);
+  }
+  cout << "Migration of slots " << start << "-" << end << " to " << target
+       << " finished" << endl;
+  active_migrations--;
+}
+
+void cmd_cluster(ClientContext &client,
+                 const std::vector<std::string> &tokens) {
+  if (!slot_map) {
+    client.reply("-ERR This instance has cluster support disabled\r\n");
+    return;
+  }
+
+  std::string sub = tokens[1];
+  for (char &c : sub)
+    c = toupper(c);
+  int start, end;
+
+  if (sub == "KEYSLOT" && tokens.size() == 3) {
+    client.reply(":" + std::to_string(cluster::key_slot(tokens[2])) + "\r\n");
+  } else if (sub == "SLOTS" && tokens.size() == 2) {
+    std::string body;
+    for (const std::string &range : slot_map->describe())
+      body += range + "\r\n";
+    client.reply("$" + std::to_string(body.length()) + "\r\n" + body + "\r\n");
+  } else if (sub == "ADDSLOTS" && tokens.size() >= 3) {
+    for (size_t i = 2; i < tokens.size(); i++) {
+      if (!parse_slot_range(tokens[i], start, end)) {
+        client.reply("-ERR Invalid slot " + tokens[i] + "\r\n");
+        return;
+      }
+    }
+    for (size_t i = 2; i < tokens.size(); i++) {
+      parse_slot_range(tokens[i], start, end);
+      for (int slot = start; slot <= end; slot++)
+        slot_map->set_owner(slot, slot_map->self_address());
+    }
+    client.reply("+OK\r\n");
+  } else if (sub == "SETSLOT" && tokens.size() >= 4) {
+    std::string mode = tokens[3];
+    for (char &c : mode)
+      c = toupper(c);
+    if (!parse_slot_range(tokens[2], start, end)) {
+      client.reply("-ERR Invalid slot " + tokens[2] + "\r\n");
+      return;
+    }
+    std::string host;
+    int port;
+    bool has_node = tokens.size() == 5 &&
+                    cluster::parse_address(tokens[4], host, port);
+    for (int slot = start; slot <= end; slot++) {
+      if (mode == "NODE" && has_node)
+        slot_map->set_owner(slot, tokens[4]);
+      else if (mode == "MIGRATING" && has_node)
+        slot_map->set_migrating(slot, tokens[4]);
+      else if (mode == "IMPORTING" && has_node)
+        slot_map->set_importing(slot, tokens[4]);
+      else if (mode == "STABLE" && tokens.size() == 4)
+        slot_map->set_stable(slot);
+      else {
+        client.reply("-ERR Invalid CLUSTER SETSLOT action or "
+                     "node address\r\n");
+        return;
+      }
+    }
+    client.reply("+OK\r\n");
+  } else if (sub == "COUNTKEYSINSLOT" && tokens.size() == 3 &&
+             parse_slot_range(tokens[2], start, end) && start == end) {
+    INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+    client.reply(":" + std::to_string(slot_index->count(start)) + "\r\n");
+  } else if (sub == "GETKEYSINSLOT" && tokens.size() == 4 &&
+             parse_slot_range(tokens[2], start, end) && start == end) {
+    size_t count;
+    try {
+      count = std::stoul(tokens[3]);
+    } catch (const std::exception &) {
+      client.reply("-ERR Invalid number of keys\r\n");
+      return;
+    }
+    std::vector<std::string> keys;
+    {
+      INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+      keys = slot_index->keys(start, count);
+    }
+    std::string body;
+    for (const std::string &key : keys)
+      body += key + "\r\n";
+    client.reply("$" + std::to_string(body.length()) + "\r\n" + body + "\r\n");
+  } else if (sub == "MIGRATE" && (tokens.size() == 4 || tokens.size() == 5) &&
+             parse_slot_range(tokens[2], start, end)) {
+    std::string host;
+    int port;
+    size_t batch_size = DEFAULT_MIGRATION_BATCH;
+    try {
+      if (tokens.size() == 5)
+        batch_size = std::max<size_t>(1, std::stoul(tokens[4]));
+    } catch (const std::exception &) {
+      client.reply("-ERR Invalid batch size\r\n");
+      return;
+    }
+    if (!cluster::parse_address(tokens[3], host, port) ||
+        tokens[3] == slot_map->self_address()) {
+      client.reply("-ERR Invalid target node\r\n");
+      return;
+    }
+    background_jobs->post([start, end, target = tokens[3], batch_size] {
+      migrate_slots(start, end, target, batch_size);
+    });
+    client.reply("+OK\r\n");
+  } else {
+    client.reply("-ERR Unknown CLUSTER subcommand or wrong number "
+                 "of arguments\r\n");
+  }
+}
+
+std::string describe_client(const ClientContext &client, int64_t now_ms) {
+  std::string name;
+  {
+    std::lock_guard<std::mutex> guard(client.name_mutex);
+    name = client.name;
+  }
+  auto relaxed = std::memory_order_relaxed;
+  return "id=" + std::to_string(client.id) + " addr=" + client.conn->peer() +
+         " fd=" + std::to_string(client.conn->fd()) + " name=" + name +
+         " age=" + std::to_string((now_ms - client.created_ms) / 1000) +
+         " idle=" +
+         std::to_string((now_ms - client.last_interaction_ms.load(relaxed)) /
+                        1000) +
+         " qbuf=" + std::to_string(client.query_buffer_size.load(relaxed)) +
+         " obl=" + std::to_string(client.output_buffer_size.load(relaxed)) +
+         " omem=" + std::to_string(client.output_memory.load(relaxed)) +
+         " tot-in=" + std::to_string(client.bytes_in.load(relaxed)) +
+         " tot-out=" + std::to_string(client.bytes_out.load(relaxed)) +
+         " cmd=" + client.last_command.load(relaxed);
+}
+
+// CLIENT LIST | KILL <addr> | KILL ID <id> | SETNAME <name> | GETNAME | ID
+void cmd_client(ClientContext &client,
+                const std::vector<std::string> &tokens) {
+  std::string sub = tokens[1];
+  for (char &c : sub)
+    c = toupper(c);
+
+  if (sub == "LIST" && tokens.size() == 2) {
+    int64_t now_ms = steady_now_ms();
+    std::string body;
+    {
+      std::lock_guard<std::mutex> guard(clients_mutex);
+      for (const auto &[id, other] : clients)
+        body += describe_client(*other, now_ms) + "\r\n";
+    }
+    // Outside the lock: a long reply may flush, and block on a slow reader
+    client.reply("$" + std::to_string(body.length()) + "\r\n" + body +
+                 "\r\n");
+  } else if (sub == "KILL" && (tokens.size() == 3 || tokens.size() == 4)) {
+    uint64_t id = 0;
+    if (tokens.size() == 4) {
+      std::string filter = tokens[2];
+      for (char &c : filter)
+        c = toupper(c);
+      try {
+        if (filter != "ID")
+          throw std::invalid_argument(filter);
+        id = std::stoull(tokens[3]);
+      } catch (const std::exception &) {
+        client.reply("-ERR syntax error, use CLIENT KILL <addr> or "
+                     "CLIENT KILL ID <id>\r\n");
+        return;
+      }
+    }
+
+    std::shared_ptr<ClientContext> victim;
+    {
+      std::lock_guard<std::mutex> guard(clients_mutex);
+      for (const auto &[other_id, other] : clients) {
+        if (tokens.size() == 4 ? other_id == id
+                               : other->conn->peer() == tokens[2]) {
+          victim = other;
+          break;
+        }
+      }
+    }
+    if (!victim) {
+      client.reply("-ERR No such client\r\n");
+      return;
+    }
+    // The victim's thread wakes up from read/poll and cleans up itself
+    victim->killed = true;
+    victim->conn->shutdown();
+    disconnect_stats.killed.fetch_add(1, std::memory_order_relaxed);
+    client.reply("+OK\r\n");
+  } else if (sub == "SETNAME" && tokens.size() == 3) {
+    {
+      std::lock_guard<std::mutex> guard(client.name_mutex);
+      client.name = tokens[2];
+    }
+    client.reply("+OK\r\n");
+  } else if (sub == "GETNAME" && tokens.size() == 2) {
+    std::string name;
+    {
+      // CLIENT LIST takes it too, under clients_mutex
+      std::lock_guard<std::mutex> guard(client.name_mutex);
+      name = client.name;
+    }
+    if (name.empty())
+      client.reply("$-1\r\n");
+    else
+      client.reply("$" + std::to_string(name.length()) + "\r\n" + name +
+                   "\r\n");
+  } else if (sub == "ID" && tokens.size() == 2) {
+    client.reply(":" + std::to_string(client.id) + "\r\n");
+  } else {
+    client.reply("-ERR Unknown CLIENT subcommand or wrong number of "
+                 "arguments\r\n");
+  }
+}
+
+// Returns true if `key` is served by this node, otherwise sends the client a
+// redirect: MOVED when the slot lives elsewhere, ASK when it is being
+// migrated and the key has already left.
+bool route_key(ClientContext &client, const std::string &key, bool asking) {
+  uint16_t slot = cluster::key_slot(key);
+  cluster::SlotState state = slot_map->state(slot);
+
+  if (state.owner == slot_map->self()) {
+    if (state.migrating_to == cluster::NO_NODE)
+      return true;
+    {
+      INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+      if (data_store.count(key))
+        return true;
+    }
+    client.reply("-ASK " + std::to_string(slot) + " " +
+                     slot_map->address(state.migrating_to) +
+                     "\r\n");
+    return false;
+  }
+
+  if (asking && state.importing_from != cluster::NO_NODE)
+    return true;
+  if (state.owner == cluster::NO_NODE) {
+    client.reply("-CLUSTERDOWN Hash slot not served\r\n");
+    return false;
+  }
+  client.reply("-MOVED " + std::to_string(slot) + " " +
+                   slot_map->address(state.owner) + "\r\n");
+  return false;
+}
+
+void dispatch_command(ClientContext &client,
+                      const std::vector<std::string> &tokens) {
+  INSTRUMENT_SCOPE("command");
+  const auto *spec = COMMANDS.find(tokens[0]);
+  if (spec == nullptr) {
+    unknown_commands.fetch_add(1, std::memory_order_relaxed);
+    client.reply("-ERR unknown command '" + tokens[0] + "'\r\n");
+    return;
+  }
+
+  CommandStats &stats = command_stats[COMMANDS.index_of(spec)];
+  client.last_command.store(spec->name.data(), std::memory_order_relaxed);
+  if (!COMMANDS.arity_ok(*spec, tokens.size())) {
+    stats.rejected_calls.fetch_add(1, std::memory_order_relaxed);
+    client.reply("-ERR wrong number of arguments for '" +
+                     std::string(spec->name) + "' command\r\n");
+    return;
+  }
+
+  bool asking = client.asking;
+  client.asking = false;
+  if (slot_map && spec->first_key > 0 &&
+      !route_key(client, tokens[spec->first_key], asking))
+    return;
+
+  auto start = std::chrono::steady_clock::now();
+  spec->handler(client, tokens);
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  stats.calls.fetch_add(1, std::memory_order_relaxed);
+  stats.usec.fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+void handle_client(std::shared_ptr<ClientContext> client) {
+  net::Connection *conn = client->conn.get();
+  cout << "Thread : " << std::this_thread::get_id() << " Handling Client "
+       << conn->peer() << endl;
+  INSTRUMENT_THREAD_NAME("client");
+  {
+    std::lock_guard<std::mutex> guard(clients_mutex);
+    clients[client->id] = client;
+    INSTRUMENT_GAUGE("clients", static_cast<int64_t>(clients.size()));
+  }
+
   char buffer[BUFFER_SIZE];
   std::string accumulated_string;
+  int read_timeout_ms = client_limits.idle_timeout_seconds > 0
+                            ? client_limits.idle_timeout_seconds * 1000
+                            : -1;
 
-  while (true) {
-    memset(buffer, 0, BUFFER_SIZE);
-
-    ssize_t bytes_recieved = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
+  while (!client->quit) {
+    ssize_t bytes_recieved = conn->read(buffer, BUFFER_SIZE, read_timeout_ms);
 
     if (bytes_recieved <= 0) {
-      if (bytes_recieved == 0) {
-        cout << "Thread : " << std::this_thread::get_id()
-             << " Client FD : " << client_fd << "Disconnected" << endl;
+      if (client->killed) {
+        cout << "Client " << conn->peer() << " killed" << endl;
+      } else if (bytes_recieved == 0) {
+        cout << "Thread : " << std::this_thread::get_id() << " Client "
+             << conn->peer() << " Disconnected" << endl;
+      } else if (errno == ETIMEDOUT) {
+        client->disconnect("idle timeout", disconnect_stats.idle_timeout);
+      } else if (errno != ECONNRESET && errno != EPIPE) {
+        perror(("recv failed for client " + conn->peer()).c_str());
       } else {
-        if (errno != ECONNRESET && errno != EPIPE) {
-          perror(("recv failed for client" +
-                  std::to_string(reinterpret_cast<uintptr_t>(pthread_self())) +
-                  ": recv failed")
-                     .c_str());
-        } else {
-          cout << "Thread " << std::this_thread::get_id()
-               << ": Client FD : " << client_fd
-               << "Connection reset or epipe problem" << endl;
-        }
+        cout << "Thread " << std::this_thread::get_id() << ": Client "
+             << conn->peer() << " Connection reset or epipe problem" << endl;
       }
-      close(client_fd);
-      return;
+      break;
     }
 
     // Some data recieved
+    client->bytes_in.fetch_add(bytes_recieved, std::memory_order_relaxed);
+    client->last_interaction_ms.store(steady_now_ms(),
+                                      std::memory_order_relaxed);
+    accumulated_string.append(buffer, bytes_recieved);
 
-    buffer[bytes_recieved] = '\0';
-    accumulated_string += buffer;
-    cout << accumulated_string;
-
+    // Consume every complete line, then drop them from the buffer at once
+    size_t line_start = 0;
     size_t newline_pos;
-    while ((newline_pos = accumulated_string.find('\n')) != std::string::npos) {
-      std::string command_line = accumulated_string.substr(0, newline_pos);
-      accumulated_string.erase(0, newline_pos + 1);
+    while (!client->quit && (newline_pos = accumulated_string.find(
+                                 '\n', line_start)) != std::string::npos) {
+      std::string command_line =
+          accumulated_string.substr(line_start, newline_pos - line_start);
+      line_start = newline_pos + 1;
 
       if (!command_line.empty() && command_line.back() == '\r') {
         command_line.pop_back();
       }
 
-      cout << "Client FD : " << client_fd << "Sent : " << command_line << endl;
+      cout << "Client " << conn->peer() << " Sent : " << command_line << endl;
 
       if (command_line.empty())
         continue;
 
-      std::vector<std::string> tokens = utils::tokenize(command_line);
+      std::vector<std::string> tokens;
+      {
+        INSTRUMENT_SCOPE("tokenize");
+        tokens = utils::tokenize(command_line);
+      }
       if (tokens.empty()) {
-        send_response(client_fd, "-ERR Empty command\r\n");
+        client->reply("-ERR Empty command\r\n");
         continue;
       }
 
-      std::string command = tokens[0];
-
-      for (char &c : command)
-        c = toupper(c);
+      dispatch_command(*client, tokens);
+    }
+    accumulated_string.erase(0, line_start);
+    client->query_buffer_size.store(accumulated_string.size(),
+                                    std::memory_order_relaxed);
 
-      if (command == "PING") {
-        if (tokens.size() == 1)
-          send_response(client_fd, "+PONG\r\n");
-        else if (tokens.size() == 2)
-          send_response(client_fd, "$" + std::to_string(tokens[1].length()) +
-                                       "\r\n" + tokens[1] + "\r\n");
-        else
-          send_response(client_fd,
-                        "-ERR wrong number of arguments for PING command");
-      } else if (command == "SET" && tokens.size() == 3) {
-        utils::kv_set(tokens[1], tokens[2], data_store, data_store_mutex);
-        send_response(client_fd, "+OK\r\n");
-      } else if (command == "GETALL" && tokens.size() == 1) {
-        auto all_data = utils::kv_getall(data_store, data_store_mutex);
-        if (all_data) {
-          for (const auto &[key, value] : *all_data) {
-            send_response(client_fd, key + " : " + value + "\r\n");
-          }
-        } else {
-          send_response(client_fd, "$-1\r\n");
-        }
-      } else if (command == "GET" && tokens.size() == 2) {
-        std::optional<std::string> value =
-            utils::kv_get(tokens[1], data_store, data_store_mutex);
-        if (value)
-          send_response(client_fd, "$" + std::to_string(value->length()) +
-                                       "\r\n" + *value + "\r\n");
-        else
-          send_response(client_fd, "$-1\r\n");
-      } else if (command == "DEL" && tokens.size() == 2) {
-        if (utils::kv_del(tokens[1], data_store, data_store_mutex))
-          send_response(client_fd, ":1\r\n");
-        else
-          send_response(client_fd, ":0\r\n");
-      } else if (command == "SAVE") {
-        if (save_to_disk()) {
-          send_response(client_fd, "+OK\r\n");
-        }
-      } else if (command == "QUIT") {
-        send_response(client_fd, "+OK\r\n");
-        cout << "Client FD : " << client_fd << "is Quitting......." << endl;
-        close(client_fd);
-        return;
-      } else {
-        send_response(client_fd,
-                      "-ERR Wrong command or wrong number of arguments\r\n");
-      }
+    if (accumulated_string.size() > client_limits.query_buffer_limit) {
+      client->disconnect("query buffer limit reached",
+                         disconnect_stats.query_buffer_limit);
     }
+    if (!client->killed)
+      client->flush(); // Also sends the +OK of a QUIT
   }
+
+  std::lock_guard<std::mutex> guard(clients_mutex);
+  clients.erase(client->id);
+  INSTRUMENT_GAUGE("clients", static_cast<int64_t>(clients.size()));
 }
 
-int main() {
-  int server_fd, client_fd;
-  struct sockaddr_in server_addr, client_addr;
-  socklen_t client_addr_len = sizeof(client_addr);
+void print_usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]" << endl;
+  std::cerr << "  --port <port>               listen port (default " << PORT
+            << ")" << endl;
+  std::cerr << "  --backlog <n>               listen backlog (default "
+            << SOMAXCONN << ")" << endl;
+  std::cerr << "  --maxclients <n>            refuse clients above this count "
+               "(default unlimited)"
+            << endl;
+  std::cerr << "  --reuseport                 share the port with other "
+               "processes (SO_REUSEPORT)"
+            << endl;
+  std::cerr << "  --timeout <seconds>         close clients idle this long "
+               "(default 300, 0 never)"
+            << endl;
+  std::cerr << "  --client-output-limit <hard> <soft> <seconds>" << endl;
+  std::cerr << "                              output buffer limits in bytes "
+               "(default 64MB 16MB 60)"
+            << endl;
+  std::cerr << "  --write-timeout <seconds>   close clients not reading "
+               "replies (default 10)"
+            << endl;
+  std::cerr << "  --client-query-limit <bytes> max unterminated command line "
+               "(default 64MB)"
+            << endl;
+  std::cerr << "  --cluster                   enable hash slot partitioning"
+            << endl;
+  std::cerr << "  --announce-host <host>      address other nodes use for "
+               "this one (default 127.0.0.1)"
+            << endl;
+  std::cerr << "  --no-compression            store every value as-is" << endl;
+  std::cerr << "  --compress-threshold <bytes> compress values at least this "
+               "large (default 4096)"
+            << endl;
+  std::cerr << "  --compress-min-ratio <ratio> keep compressed form only above "
+               "this ratio (default 1.3)"
+            << endl;
+}
 
-  server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server_fd == -1) {
-    perror("Socket creation Failed");
-    exit(EXIT_FAILURE);
+bool parse_args(int argc, char *argv[]) {
+  value_codec::Config config;
+  bool cluster_enabled = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    try {
+      if (arg == "--port" && i + 1 < argc) {
+        listener_options.port = std::stoi(argv[++i]);
+      } else if (arg == "--backlog" && i + 1 < argc) {
+        listener_options.backlog = std::stoi(argv[++i]);
+      } else if (arg == "--maxclients" && i + 1 < argc) {
+        listener_options.max_connections = std::stoul(argv[++i]);
+      } else if (arg == "--reuseport") {
+        listener_options.reuse_port = true;
+      } else if (arg == "--timeout" && i + 1 < argc) {
+        client_limits.idle_timeout_seconds = std::stoi(argv[++i]);
+      } else if (arg == "--client-output-limit" && i + 3 < argc) {
+        client_limits.output_hard_limit = std::stoul(argv[++i]);
+        client_limits.output_soft_limit = std::stoul(argv[++i]);
+        client_limits.output_soft_seconds = std::stoi(argv[++i]);
+      } else if (arg == "--write-timeout" && i + 1 < argc) {
+        client_limits.write_timeout_seconds = std::stoi(argv[++i]);
+      } else if (arg == "--client-query-limit" && i + 1 < argc) {
+        client_limits.query_buffer_limit = std::stoul(argv[++i]);
+      } else if (arg == "--cluster") {
+        cluster_enabled = true;
+      } else if (arg == "--announce-host" && i + 1 < argc) {
+        announce_host = argv[++i];
+      } else if (arg == "--no-compression") {
+        config.enabled = false;
+      } else if (arg == "--compress-threshold" && i + 1 < argc) {
+        config.threshold = std::stoul(argv[++i]);
+      } else if (arg == "--compress-min-ratio" && i + 1 < argc) {
+        config.min_ratio = std::stod(argv[++i]);
+      } else {
+        return false;
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Invalid value for " << arg << endl;
+      return false;
+    }
   }
-  cout << "Socket created Successfully..." << endl;
+  codec.set_config(config);
+  server_port = listener_options.port;
 
-  int opt = 1;
-  if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-    perror("setsockopt failed");
+  if (server_port != PORT) // Several nodes can share a working directory
+    DUMP_FILE_NAME = "miniredis-" + std::to_string(server_port) + ".dump";
+  if (cluster_enabled) {
+    slot_map = std::make_unique<cluster::SlotMap>(
+        announce_host + ":" + std::to_string(server_port));
+    slot_index = std::make_unique<cluster::SlotIndex>();
+    threading::PoolOptions pool_options;
+    pool_options.threads = MIGRATION_THREADS;
+    pool_options.pin_threads = false;
+    background_jobs = std::make_unique<threading::ThreadPool>(pool_options);
   }
+  return true;
+}
 
-  server_addr.sin_addr.s_addr = INADDR_ANY;
-  server_addr.sin_port = htons(PORT);
-  server_addr.sin_family = AF_INET;
-
-  memset(server_addr.sin_zero, '\0', sizeof(server_addr.sin_zero));
-
-  if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(sockaddr)) < 0) {
-    perror("Bind Failed");
-    close(server_fd);
-    exit(EXIT_FAILURE);
+int main(int argc, char *argv[]) {
+  INSTRUMENT_INSTALL(argv[0], true);
+  if (!parse_args(argc, argv)) {
+    print_usage(argv[0]);
+    return 1;
   }
-  cout << "Socket Bound to Port " << PORT << endl;
 
-  if (listen(server_fd, BACKLOG) < 0) {
-    perror("Listening Failed!");
-    close(server_fd);
+  acceptor = std::make_unique<net::Acceptor>(listener_options);
+  if (!acceptor->open()) {
     exit(EXIT_FAILURE);
   }
+  cout << "Socket Bound to Port " << server_port << endl;
+
   if (!load_from_disk()) {
     // Error handling
   }
-  cout << "Listening on PORT " << PORT << "....." << endl;
+  cout << "Listening on PORT " << server_port << "....." << endl;
 
   while (true) {
-    client_fd =
-        accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-    if (client_fd < 0) {
-      perror("Client acception failed.");
-      continue;
+    std::unique_ptr<net::Connection> conn = acceptor->accept();
+    if (!conn) {
+      break;
     }
 
-    cout << "Connection accepted from client FD " << client_fd << endl;
+    cout << "Connection accepted from client " << conn->peer() << " FD "
+         << conn->fd() << endl;
 
-    std::thread client_thread(handle_client, client_fd);
+    auto client = std::make_shared<ClientContext>();
+    client->id = next_client_id++;
+    client->conn = std::move(conn);
+    std::thread client_thread(handle_client, std::move(client));
     client_thread.detach();
   }
-  close(server_fd);
   return 0;
 }
@@ -0,0 +1,124 @@
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+namespace command_table {
+
+enum Flags : uint32_t {
+  CMD_READ = 1u << 0,
+  CMD_WRITE = 1u << 1,
+  CMD_ADMIN = 1u << 2,
+};
+
+// `arity` follows the redis convention and counts the command name itself:
+// N means exactly N tokens, -N means at least N tokens. `first_key` is the
+// token position of the key the command operates on, 0 if it takes none.
+template <typename Handler> struct CommandSpec {
+  std::string_view name;
+  int arity;
+  uint32_t flags;
+  int first_key;
+  Handler handler;
+};
+
+constexpr char ascii_lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// FNV-1a over the lowercased name, so "get", "GET" and "GeT" all hash to the
+// same slot without having to copy and uppercase the token first.
+constexpr uint32_t hash_name(std::string_view name, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ seed;
+  for (char c : name) {
+    hash ^= static_cast<uint8_t>(ascii_lower(c));
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+constexpr bool equals_ignore_case(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (ascii_lower(a[i]) != ascii_lower(b[i]))
+      return false;
+  }
+  return true;
+}
+
+constexpr size_t next_power_of_two(size_t n) {
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+// A perfect hash table built at compile time: the constructor searches for a
+// seed under which every command name lands in its own slot, so a lookup is
+// one hash, one mask and one case-insensitive compare.
+template <typename Handler, size_t N> class CommandTable {
+public:
+  static constexpr size_t kSlots = next_power_of_two(N * 2);
+  static constexpr uint8_t kEmpty = 0xFF;
+  static_assert(N < kEmpty, "Too many commands for an 8 bit slot index");
+
+  constexpr explicit CommandTable(
+      const std::array<CommandSpec<Handler>, N> &specs)
+      : m_specs(specs), m_slots{}, m_seed(0) {
+    for (uint32_t seed = 0; seed < 100000; seed++) {
+      if (try_seed(seed)) {
+        m_seed = seed;
+        return;
+      }
+    }
+    throw std::logic_error("No perfect hash seed found for command table");
+  }
+
+  const CommandSpec<Handler> *find(std::string_view name) const {
+    uint8_t index = m_slots[hash_name(name, m_seed) & (kSlots - 1)];
+    if (index == kEmpty || !equals_ignore_case(m_specs[index].name, name))
+      return nullptr;
+    return &m_specs[index];
+  }
+
+  // Position of `spec` in the declaration order, used to index stats arrays.
+  size_t index_of(const CommandSpec<Handler> *spec) const {
+    return static_cast<size_t>(spec - m_specs.data());
+  }
+
+  static constexpr bool arity_ok(const CommandSpec<Handler> &spec,
+                                 size_t argc) {
+    return spec.arity >= 0 ? argc == static_cast<size_t>(spec.arity)
+                           : argc >= static_cast<size_t>(-spec.arity);
+  }
+
+  constexpr const std::array<CommandSpec<Handler>, N> &specs() const {
+    return m_specs;
+  }
+  constexpr size_t size() const { return N; }
+
+private:
+  constexpr bool try_seed(uint32_t seed) {
+    for (size_t i = 0; i < kSlots; i++)
+      m_slots[i] = kEmpty;
+    for (size_t i = 0; i < N; i++) {
+      size_t slot = hash_name(m_specs[i].name, seed) & (kSlots - 1);
+      if (m_slots[slot] != kEmpty)
+        return false;
+      m_slots[slot] = static_cast<uint8_t>(i);
+    }
+    return true;
+  }
+
+  std::array<CommandSpec<Handler>, N> m_specs;
+  std::array<uint8_t, kSlots> m_slots;
+  uint32_t m_seed;
+};
+
+} // namespace command_table
+#endif // !COMMAND_TABLE_H
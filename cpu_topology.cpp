@@ -0,0 +1,311 @@
+#include "cpu_topology.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+
+namespace topology {
+
+namespace {
+
+// The whole of a small sysfs file, empty if it can't be read
+std::string read_file(const std::string &path) {
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+int read_int(const std::string &path, int fallback) {
+  std::string text = read_file(path);
+  if (text.empty())
+    return fallback;
+  return std::atoi(text.c_str());
+}
+
+// "32K", "1024K" or "16M"
+uint64_t parse_size(const std::string &text) {
+  char *end = nullptr;
+  uint64_t size = std::strtoull(text.c_str(), &end, 10);
+  if (*end == 'K')
+    size *= 1024;
+  else if (*end == 'M')
+    size *= 1024 * 1024;
+  else if (*end == 'G')
+    size *= 1024 * 1024 * 1024;
+  return size;
+}
+
+// The numbers of the "<prefix>N" entries of a directory, sorted
+std::vector<int> numbered_entries(const std::string &path,
+                                  const std::string &prefix) {
+  std::vector<int> numbers;
+  DIR *dir = opendir(path.c_str());
+  if (dir == nullptr)
+    return numbers;
+  while (dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > prefix.size() &&
+        name.compare(0, prefix.size(), prefix) == 0 &&
+        std::all_of(name.begin() + prefix.size(), name.end(),
+                    [](char c) { return c >= '0' && c <= '9'; }))
+      numbers.push_back(std::atoi(name.c_str() + prefix.size()));
+  }
+  closedir(dir);
+  std::sort(numbers.begin(), numbers.end());
+  return numbers;
+}
+
+} // namespace
+
+std::vector<int> parse_cpu_list(std::string_view text) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find(',', pos);
+    if (end == std::string_view::npos)
+      end = text.size();
+    std::string range(text.substr(pos, end - pos));
+    pos = end + 1;
+    char *rest = nullptr;
+    long first = std::strtol(range.c_str(), &rest, 10);
+    if (rest == range.c_str())
+      continue; // Empty, or the trailing newline
+    long last = *rest == '-' ? std::strtol(rest + 1, nullptr, 10) : first;
+    for (long cpu = first; cpu <= last; cpu++)
+      cpus.push_back(static_cast<int>(cpu));
+  }
+  return cpus;
+}
+
+std::string format_cpu_list(const std::vector<int> &cpus) {
+  std::string text;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+      j++;
+    if (!text.empty())
+      text += ',';
+    text += std::to_string(cpus[i]);
+    if (j > i)
+      text += '-' + std::to_string(cpus[j]);
+    i = j + 1;
+  }
+  return text;
+}
+
+bool Topology::load(const std::string &sysfs) {
+  m_cpus.clear();
+  m_cores.clear();
+  m_caches.clear();
+  m_nodes.clear();
+
+  const std::string cpu_root = sysfs + "/cpu/";
+  std::vector<int> online = parse_cpu_list(read_file(cpu_root + "online"));
+  if (online.empty()) {
+    std::cerr << "Error: No CPU topology in " << cpu_root << std::endl;
+    return false;
+  }
+
+  // CPU to node; without NUMA everything is node 0
+  std::map<int, int> node_of;
+  for (int id : numbered_entries(sysfs + "/node", "node")) {
+    std::string node_dir = sysfs + "/node/node" + std::to_string(id);
+    Node node;
+    node.id = id;
+    node.cpus = parse_cpu_list(read_file(node_dir + "/cpulist"));
+    // "Node 0 MemTotal:       16318412 kB"
+    std::istringstream meminfo(read_file(node_dir + "/meminfo"));
+    std::string line;
+    while (std::getline(meminfo, line)) {
+      size_t label = line.find("MemTotal:");
+      if (label != std::string::npos) {
+        node.memory_kb = std::strtoull(line.c_str() + label + 9, nullptr, 10);
+        break;
+      }
+    }
+    for (int cpu : node.cpus)
+      node_of[cpu] = id;
+    m_nodes.push_back(std::move(node));
+  }
+
+  // A core is identified by its first SMT sibling, which holds even where
+  // core ids repeat across dies
+  std::map<int, int> core_of_first_sibling;
+  for (int id : online) {
+    std::string dir = cpu_root + "cpu" + std::to_string(id);
+    std::vector<int> siblings =
+        parse_cpu_list(read_file(dir + "/topology/thread_siblings_list"));
+    int first = siblings.empty() ? id : siblings.front();
+    auto [found, inserted] = core_of_first_sibling.try_emplace(
+        first, static_cast<int>(m_cores.size()));
+    if (inserted) {
+      Core core;
+      core.package = read_int(dir + "/topology/physical_package_id", 0);
+      core.core_id = read_int(dir + "/topology/core_id", id);
+      auto node = node_of.find(id);
+      core.node = node == node_of.end() ? 0 : node->second;
+      m_cores.push_back(core);
+    }
+    Core &core = m_cores[found->second];
+    core.threads.push_back(id);
+    m_cpus.push_back(Cpu{id, found->second});
+
+    for (int index : numbered_entries(dir + "/cache", "index")) {
+      std::string cache_dir = dir + "/cache/index" + std::to_string(index);
+      Cache cache;
+      cache.level = read_int(cache_dir + "/level", 0);
+      std::string type = read_file(cache_dir + "/type");
+      cache.type = type.empty() ? 'U' : type[0];
+      cache.size_bytes = parse_size(read_file(cache_dir + "/size"));
+      cache.cpus = parse_cpu_list(read_file(cache_dir + "/shared_cpu_list"));
+      if (cache.cpus.empty())
+        cache.cpus.push_back(id);
+      auto same = std::find_if(
+          m_caches.begin(), m_caches.end(), [&](const Cache &other) {
+            return other.level == cache.level && other.type == cache.type &&
+                   other.cpus == cache.cpus;
+          });
+      int cache_index = static_cast<int>(same - m_caches.begin());
+      if (same == m_caches.end())
+        m_caches.push_back(std::move(cache));
+      const Cache &shared = m_caches[cache_index];
+      if (shared.type == 'I')
+        continue;
+      if (shared.level == 2)
+        core.l2 = cache_index;
+      else if (shared.level == 3)
+        core.l3 = cache_index;
+    }
+  }
+
+  if (m_nodes.empty()) {
+    Node node;
+    node.cpus = online;
+    m_nodes.push_back(std::move(node));
+  }
+  return true;
+}
+
+size_t Topology::package_count() const {
+  std::vector<int> packages;
+  for (const Core &core : m_cores)
+    packages.push_back(core.package);
+  std::sort(packages.begin(), packages.end());
+  return static_cast<size_t>(
+      std::unique(packages.begin(), packages.end()) - packages.begin());
+}
+
+const Cpu *Topology::find_cpu(int id) const {
+  auto found = std::lower_bound(
+      m_cpus.begin(), m_cpus.end(), id,
+      [](const Cpu &cpu, int value) { return cpu.id < value; });
+  return found != m_cpus.end() && found->id == id ? &*found : nullptr;
+}
+
+std::vector<int> Topology::pinning_plan(size_t workers,
+                                        const PlanOptions &options) const {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  bool restricted = options.respect_affinity &&
+                    sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+  auto is_allowed = [&](int cpu) {
+    return !restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+  };
+
+  // Per node, its cores' allowed threads: a core's i-th thread is its
+  // "tier i", and tier 0 of every core comes before any tier 1
+  struct NodePlan {
+    int node;
+    std::vector<std::vector<int>> tiers;
+  };
+  std::vector<NodePlan> nodes;
+  for (const Node &node : m_nodes) {
+    if (options.node >= 0 && node.id != options.node)
+      continue;
+    // Round-robin over the L3 domains, so neighbouring workers don't all
+    // compete for one cache while another sits idle
+    std::map<int, std::vector<const Core *>> by_l3;
+    for (const Core &core : m_cores) {
+      if (core.node == node.id)
+        by_l3[core.l3].push_back(&core);
+    }
+    size_t deepest = 0;
+    for (const auto &[l3, cores] : by_l3)
+      deepest = std::max(deepest, cores.size());
+    std::vector<const Core *> order;
+    for (size_t i = 0; i < deepest; i++) {
+      for (const auto &[l3, cores] : by_l3) {
+        if (i < cores.size())
+          order.push_back(cores[i]);
+      }
+    }
+
+    NodePlan plan{node.id, {}};
+    for (const Core *core : order) {
+      size_t tier = 0;
+      for (int cpu : core->threads) {
+        if (!is_allowed(cpu))
+          continue;
+        if (tier == plan.tiers.size())
+          plan.tiers.emplace_back();
+        plan.tiers[tier++].push_back(cpu);
+      }
+    }
+    if (!plan.tiers.empty())
+      nodes.push_back(std::move(plan));
+  }
+  // The node with the most cores first, so small pools stay on one node
+  std::stable_sort(nodes.begin(), nodes.end(),
+                   [](const NodePlan &a, const NodePlan &b) {
+                     return a.tiers[0].size() > b.tiers[0].size();
+                   });
+
+  std::vector<int> sequence;
+  if (options.smt_before_other_nodes) {
+    for (const NodePlan &node : nodes) {
+      for (const std::vector<int> &tier : node.tiers)
+        sequence.insert(sequence.end(), tier.begin(), tier.end());
+    }
+  } else {
+    for (size_t tier = 0;; tier++) {
+      size_t added = 0;
+      for (const NodePlan &node : nodes) {
+        if (tier < node.tiers.size()) {
+          sequence.insert(sequence.end(), node.tiers[tier].begin(),
+                          node.tiers[tier].end());
+          added++;
+        }
+      }
+      if (added == 0)
+        break;
+    }
+  }
+
+  std::vector<int> plan;
+  if (sequence.empty())
+    return plan;
+  for (size_t i = 0; i < workers; i++)
+    plan.push_back(sequence[i % sequence.size()]);
+  return plan;
+}
+
+bool pin_current_thread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (error != 0) {
+    errno = error;
+    return false;
+  }
+  return true;
+}
+
+} // namespace topology
@@ -0,0 +1,95 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The machine's CPU layout as sysfs describes it: packages (sockets),
+// physical cores and their SMT threads, the caches and which CPUs share
+// them, and NUMA nodes. From it comes a pinning plan that tells the thread
+// pools and server loops which CPU each worker should run on.
+namespace topology {
+
+struct Cache {
+  int level = 0;
+  char type = 'U'; // 'D'ata, 'I'nstruction or 'U'nified
+  uint64_t size_bytes = 0;
+  std::vector<int> cpus; // The CPUs sharing it
+};
+
+// A physical core; its threads are SMT siblings that share its execution
+// units.
+struct Core {
+  int package = 0;
+  int core_id = 0; // As sysfs numbers it, only unique within a package
+  int node = 0;
+  int l2 = -1; // Index into Topology::caches(), -1 if there is none
+  int l3 = -1;
+  std::vector<int> threads;
+};
+
+struct Cpu {
+  int id = 0;
+  int core = 0; // Index into Topology::cores()
+};
+
+struct Node {
+  int id = 0;
+  std::vector<int> cpus;
+  uint64_t memory_kb = 0;
+};
+
+struct PlanOptions {
+  // Keep every worker on this NUMA node; with -1 workers start on the node
+  // with the most cores and spill over to the next ones.
+  int node = -1;
+  // Use a node's SMT siblings before moving on to another node. Memory
+  // bound work usually wants this, compute bound work doesn't.
+  bool smt_before_other_nodes = false;
+  // Only plan with the CPUs this process is allowed to run on.
+  bool respect_affinity = true;
+};
+
+class Topology {
+public:
+  // Reads the layout of the online CPUs from `sysfs`, which is normally
+  // /sys/devices/system. Returns false with a message on stderr if there
+  // is no CPU topology there.
+  bool load(const std::string &sysfs = "/sys/devices/system");
+
+  // Online CPUs, ordered by id.
+  const std::vector<Cpu> &cpus() const { return m_cpus; }
+  const std::vector<Core> &cores() const { return m_cores; }
+  // Every distinct cache once.
+  const std::vector<Cache> &caches() const { return m_caches; }
+  // A machine without NUMA is reported as one node.
+  const std::vector<Node> &nodes() const { return m_nodes; }
+  size_t package_count() const;
+  const Cpu *find_cpu(int id) const;
+
+  // The CPU for each of `workers` workers. Workers get a physical core of
+  // their own first, spread over the L3 domains of a node and then over
+  // nodes, before any two share a core; with more workers than CPUs the
+  // plan wraps around. Empty if no CPU is allowed.
+  std::vector<int> pinning_plan(size_t workers,
+                                const PlanOptions &options = {}) const;
+
+private:
+  std::vector<Cpu> m_cpus;
+  std::vector<Core> m_cores;
+  std::vector<Cache> m_caches;
+  std::vector<Node> m_nodes;
+};
+
+// The "0-3,8,10-11" lists sysfs uses for CPU sets.
+std::vector<int> parse_cpu_list(std::string_view text);
+std::string format_cpu_list(const std::vector<int> &cpus);
+
+// Pins the calling thread to one CPU. Returns false with errno set.
+bool pin_current_thread(int cpu);
+
+} // namespace topology
+#endif // !CPU_TOPOLOGY_H
@@ -1,50 +1,234 @@
-#include <chrono>
-#include <fstream>
+// Build:
+//   g++ -std=c++17 -O2 -pthread cpu_utilization.cpp pressure.cpp
+//       proc_sampler.cpp proc_table.cpp series_store.cpp term_render.cpp
+//       instrument.cpp -o cpu_utilization
+//
+// Usage: cpu_utilization [--per-cpu] [--top <n>] [--history <file>]
+//                        [--pressure <stall_ms>] [interval_ms]
+//   --per-cpu               also show every core, to spot a single
+//                           saturated one
+//   --top <n>               also show the n processes using the most CPU
+//   --history <file>        record every sample, see monitor_history
+//   --pressure <stall_ms>   sleep until tasks wait for a CPU for stall_ms
+//                           within 2 s, then sample every interval until
+//                           10 s pass without such a stall
+#include "instrument.h"
+#include "pressure.h"
+#include "proc_sampler.h"
+#include "proc_table.h"
+#include "series_store.h"
+#include "term_render.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <ostream>
+#include <poll.h>
 #include <sstream>
 #include <string>
-#include <thread>
+#include <vector>
 
-struct CpuInfo {
-  unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+namespace {
 
-  unsigned long long Total() const {
-    return user + nice + system + idle + iowait + irq + softirq + steal;
-  }
-  unsigned long long Idle() const { return idle + iowait; }
-};
-
-CpuInfo ReadCpuInfo() {
-  std::ifstream file("/proc/stat");
-  std::string line;
-  CpuInfo info;
+// Only hosts with thousands of processes use it, for the rest it sleeps
+const size_t SCAN_THREADS = 4;
 
-  if (std::getline(file, line) && line.find("cpu ") == 0) {
-    std::istringstream ss(line);
-    std::string string_label;
+void print_usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--per-cpu] [--top <n>] [--history <file>]"
+               " [--pressure <stall_ms>] [interval_ms]"
+            << std::endl;
+}
 
-    ss >> string_label;
-    ss >> info.user >> info.nice >> info.system >> info.idle >> info.iowait >>
-        info.irq >> info.softirq >> info.steal;
+void PrintProcesses(std::ostream &out,
+                    std::vector<procfs::ProcessUsage> &processes,
+                    size_t count) {
+  count = std::min(count, processes.size());
+  std::partial_sort(
+      processes.begin(), processes.begin() + count, processes.end(),
+      [](const procfs::ProcessUsage &a, const procfs::ProcessUsage &b) {
+        return a.cpu_percent > b.cpu_percent;
+      });
+  out << "\n    PID S   CPU%     RSS kB  THR COMMAND\n";
+  for (size_t i = 0; i < count; i++) {
+    const procfs::ProcessUsage &p = processes[i];
+    out << std::setw(7) << p.pid << ' ' << p.state << ' ' << std::setw(6)
+        << p.cpu_percent << ' ' << std::setw(10) << p.rss_kb << ' '
+        << std::setw(4) << p.threads << ' ' << p.comm << '\n';
   }
-  return info;
 }
 
-int main() {
-  while (true) {
+void DrawLines(term::Screen &screen, const std::string &text) {
+  screen.clear();
+  screen.print_lines(0, 0, text);
+  screen.present();
+}
 
-    CpuInfo info1 = ReadCpuInfo();
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-    CpuInfo info2 = ReadCpuInfo();
+} // namespace
 
-    unsigned long long total_diff = info2.Total() - info1.Total();
-    unsigned long long idle_diff = info2.Idle() - info1.Idle();
+int main(int argc, char *argv[]) {
+  INSTRUMENT_INSTALL(argv[0], false);
+  int interval_ms = 1000;
+  bool per_cpu = false;
+  size_t top = 0;
+  std::string history_path;
+  int stall_ms = 0;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--per-cpu") == 0) {
+      per_cpu = true;
+    } else if (strcmp(argv[arg], "--top") == 0 && arg + 1 < argc) {
+      top = static_cast<size_t>(std::max(1, std::atoi(argv[++arg])));
+    } else if (strcmp(argv[arg], "--history") == 0 && arg + 1 < argc) {
+      history_path = argv[++arg];
+    } else if (strcmp(argv[arg], "--pressure") == 0 && arg + 1 < argc) {
+      stall_ms = std::max(1, std::atoi(argv[++arg]));
+    } else if (argv[arg][0] != '-') {
+      interval_ms = std::max(1, std::atoi(argv[arg]));
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // /proc/stat stays open and the samples are reused, so a short interval
+  // costs little more than the syscalls
+  procfs::Sampler sampler;
+  procfs::StatSample previous, current;
+  if (!sampler.read_stat(previous)) {
+    perror("Error: Could not read /proc/stat");
+    return 1;
+  }
+  history::Store store;
+  if (!history_path.empty() && !store.open(history_path, {"cpu.busy"})) {
+    return 1;
+  }
+  std::unique_ptr<threading::ThreadPool> pool;
+  std::unique_ptr<procfs::ProcessTable> processes;
+  std::vector<procfs::ProcessUsage> usage;
+  if (top > 0) {
+    threading::PoolOptions pool_options;
+    pool_options.threads = SCAN_THREADS;
+    pool_options.pin_threads = false;
+    pool = std::make_unique<threading::ThreadPool>(pool_options);
+    processes = std::make_unique<procfs::ProcessTable>(pool.get());
+    processes->sample(usage);
+  }
+  // With a pressure trigger, the loop sleeps in poll() until the kernel
+  // reports stalls, instead of waking up every interval
+  procfs::PressureWatch watch;
+  if (stall_ms > 0 &&
+      !watch.open(procfs::Resource::CPU, static_cast<uint64_t>(stall_ms))) {
+    perror("Error: Could not arm a trigger in /proc/pressure/cpu");
+    return 1;
+  }
+  pollfd event = {watch.fd(), POLLPRI, 0};
+  procfs::PressureStats pressure;
+  const std::string idle_text = "Idle until tasks wait for a CPU for " +
+                                std::to_string(stall_ms) + " ms in 2 s";
+
+  // Several lines per sample are drawn through the screen model
+  std::unique_ptr<term::Screen> screen;
+  if (per_cpu || top > 0) {
+    screen = std::make_unique<term::Screen>();
+  }
+  std::ostringstream frame;
+  frame << std::fixed << std::setprecision(1);
+  if (stall_ms > 0 && !screen) {
+    std::cout << '\r' << idle_text << std::flush;
+  }
+  while (!screen || !screen->quit_requested()) {
+    int timeout = stall_ms > 0 ? watch.timeout(interval_ms) : interval_ms;
+    if (!screen) {
+      // Without a trigger the fd is -1, which poll() skips: a plain sleep
+      event.revents = 0;
+      poll(&event, 1, timeout);
+    } else if (screen->wait(timeout, event) == 'q') {
+      break;
+    }
+    if (stall_ms > 0) {
+      bool was_sampling = watch.is_sampling();
+      bool failed = false;
+      bool sample = watch.should_sample(event.revents, failed);
+      if (failed) {
+        screen.reset();
+        perror("Error: The CPU pressure trigger stopped working");
+        return 1;
+      }
+      if (sample && !was_sampling) {
+        // The last sample is from before the quiet stretch; measure from now
+        if (!sampler.read_stat(previous) ||
+            (processes && !processes->sample(usage))) {
+          screen.reset();
+          perror("Error: Could not read /proc");
+          return 1;
+        }
+        continue;
+      }
+      if (!sample) {
+        if (screen) {
+          DrawLines(*screen, frame.str() + '\n' + idle_text);
+        } else {
+          std::cout << '\n' << idle_text << std::flush;
+        }
+        continue;
+      }
+      if (!watch.read(pressure)) {
+        screen.reset();
+        perror("Error: Could not read /proc/pressure/cpu");
+        return 1;
+      }
+    }
+    if (!sampler.read_stat(current)) {
+      screen.reset();
+      perror("Error: Could not read /proc/stat");
+      return 1;
+    }
 
-    double cpu_utilization = 100.0 * (total_diff - idle_diff) / total_diff;
+    double cpu_utilization =
+        procfs::busy_percent(previous.total, current.total);
+    if (!history_path.empty()) {
+      store.append(0, history::now_ms(), cpu_utilization);
+    }
+    if (!per_cpu && top == 0) {
+      std::cout << "\rCPU cpu_utilization is : " << cpu_utilization << "%";
+      if (stall_ms > 0) {
+        std::cout << ", pressure " << pressure.some.avg10 << "%   ";
+      }
+      std::cout << std::flush;
+      std::swap(previous, current);
+      continue;
+    }
 
-    std::cout << "\rCPU cpu_utilization is : " << cpu_utilization << "%"
-              << std::flush;
+    frame.str("");
+    frame << "CPU cpu_utilization is : " << cpu_utilization << "%\n";
+    if (stall_ms > 0) {
+      frame << "CPU pressure: " << pressure.some.avg10
+            << "% of the last 10 s with tasks waiting\n";
+    }
+    if (per_cpu) {
+      size_t cpus = std::min(previous.cpus.size(), current.cpus.size());
+      for (size_t cpu = 0; cpu < cpus; cpu++) {
+        double busy =
+            procfs::busy_percent(previous.cpus[cpu], current.cpus[cpu]);
+        frame << "  cpu" << std::left << std::setw(4) << cpu << std::right
+              << std::setw(6) << busy << "%"
+              << (busy >= 95 ? "  saturated" : "") << '\n';
+      }
+    }
+    if (top > 0) {
+      if (!processes->sample(usage)) {
+        screen.reset();
+        perror("Error: Could not read /proc");
+        return 1;
+      }
+      PrintProcesses(frame, usage, top);
+    }
+    DrawLines(*screen, frame.str());
+    std::swap(previous, current);
   }
   return 0;
 }
@@ -0,0 +1,120 @@
+#include "dir_walker.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace walk {
+
+namespace {
+
+const size_t DIRENT_BUFFER_SIZE = 64 * 1024;
+const size_t BINARY_PROBE_SIZE = 8 * 1024;
+
+// Layout the kernel uses for getdents64, glibc doesn't export it.
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+EntryType type_from_mode(mode_t mode) {
+  if (S_ISREG(mode))
+    return EntryType::FILE;
+  if (S_ISDIR(mode))
+    return EntryType::DIRECTORY;
+  return EntryType::OTHER;
+}
+
+bool matches_any(std::string_view name,
+                 const std::vector<std::string> &globs) {
+  std::string name_str(name);
+  for (const std::string &glob : globs) {
+    if (fnmatch(glob.c_str(), name_str.c_str(), 0) == 0)
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+bool list_directory(const std::string &dir_path,
+                    const EntryCallback &on_entry) {
+  int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0)
+    return false;
+
+  // Aligned for the dirent structs the kernel writes into it
+  alignas(linux_dirent64) char buffer[DIRENT_BUFFER_SIZE];
+  std::string prefix = dir_path;
+  if (prefix.empty() || prefix.back() != '/')
+    prefix += '/';
+
+  while (true) {
+    long bytes = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer));
+    if (bytes < 0 && errno == EINTR)
+      continue;
+    if (bytes < 0) {
+      int saved_errno = errno;
+      close(dir_fd);
+      errno = saved_errno;
+      return false;
+    }
+    if (bytes == 0)
+      break;
+
+    for (long offset = 0; offset < bytes;) {
+      auto *entry = reinterpret_cast<linux_dirent64 *>(buffer + offset);
+      offset += entry->d_reclen;
+
+      const char *name = entry->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+
+      EntryType type;
+      if (entry->d_type == DT_REG) {
+        type = EntryType::FILE;
+      } else if (entry->d_type == DT_DIR) {
+        type = EntryType::DIRECTORY;
+      } else if (entry->d_type == DT_UNKNOWN) {
+        // Some filesystems don't fill d_type
+        struct stat st;
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+          continue;
+        type = type_from_mode(st.st_mode);
+      } else {
+        type = EntryType::OTHER;
+      }
+      on_entry(prefix + name, type);
+    }
+  }
+  close(dir_fd);
+  return true;
+}
+
+bool is_excluded(std::string_view name, const WalkOptions &options) {
+  return matches_any(name, options.exclude_globs);
+}
+
+bool is_included_file(std::string_view name, const WalkOptions &options) {
+  if (is_excluded(name, options))
+    return false;
+  return options.include_globs.empty() ||
+         matches_any(name, options.include_globs);
+}
+
+bool looks_binary(const char *data, size_t size) {
+  return std::memchr(data, '\0',
+                     size < BINARY_PROBE_SIZE ? size : BINARY_PROBE_SIZE) !=
+         nullptr;
+}
+
+} // namespace walk
@@ -0,0 +1,44 @@
+#ifndef DIR_WALKER_H
+#define DIR_WALKER_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Directory listing on top of getdents64 for the parallel tree walk in
+// file_searcher: one syscall returns a whole batch of entries together with
+// their type, so the walk rarely needs a stat per entry.
+namespace walk {
+
+enum class EntryType { FILE, DIRECTORY, OTHER };
+
+struct WalkOptions {
+  // Matched with fnmatch against the file name. An empty include list lets
+  // every file through; excludes apply to files and directories alike.
+  std::vector<std::string> include_globs;
+  std::vector<std::string> exclude_globs;
+  // -1 means unlimited, 0 only searches the files given on the command line
+  // and the direct children of the given directories.
+  int max_depth = -1;
+};
+
+using EntryCallback =
+    std::function<void(const std::string &path, EntryType type)>;
+
+// Calls on_entry for every entry of `dir_path` other than "." and "..".
+// Symlinks are reported as OTHER and not followed, which also keeps the walk
+// safe from link cycles. Returns false with errno set if the directory can't
+// be read.
+bool list_directory(const std::string &dir_path,
+                    const EntryCallback &on_entry);
+
+bool is_excluded(std::string_view name, const WalkOptions &options);
+bool is_included_file(std::string_view name, const WalkOptions &options);
+
+// Same heuristic as grep: a NUL byte in the first few KB means binary.
+bool looks_binary(const char *data, size_t size);
+
+} // namespace walk
+#endif // !DIR_WALKER_H
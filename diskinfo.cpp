@@ -1,31 +1,261 @@
+// Build:
+//   g++ -std=c++17 -O2 diskinfo.cpp pressure.cpp proc_sampler.cpp
+//       term_render.cpp instrument.cpp -o diskinfo
+//
+// Usage: diskinfo [--watch] [--pressure <stall_ms>] [interval_ms]
+//                 (default 1000)
+//   Prints the space used on every mounted filesystem and, measured over
+//   one interval, the I/O load of every block device.
+//   --watch                 keep sampling and redraw in place, until q or
+//                           Ctrl-C
+//   --pressure <stall_ms>   watch, but sleep until tasks stall on I/O for
+//                           stall_ms within 2 s, then sample every interval
+//                           until 10 s pass without such a stall
+#include "instrument.h"
+#include "pressure.h"
+#include "proc_sampler.h"
+#include "term_render.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <ostream>
+#include <poll.h>
+#include <sstream>
+#include <string>
 #include <sys/statvfs.h>
+#include <thread>
+#include <vector>
 
-void PrintDiskUsage(const char *path) {
-  struct statvfs stat;
+namespace {
 
-  if (statvfs(path, &stat) != 0) {
-    perror("statvfs failed");
-    return;
-  }
+// A device this busy can't take more work without requests queueing up
+const double SATURATED_PERCENT = 90;
 
-  unsigned long block_size = stat.f_frsize;
-  unsigned long total_blocks = stat.f_blocks;
-  unsigned long free_blocks = stat.f_bfree;
-  unsigned long available_blocks = stat.f_bavail;
+const double GIB = 1024.0 * 1024.0 * 1024.0;
+const double MIB = 1024.0 * 1024.0;
 
-  unsigned long total_size = total_blocks * block_size;
-  unsigned long free_size = free_blocks * block_size;
-  unsigned long available_size = available_blocks * block_size;
+const procfs::DiskStats *
+FindDevice(const std::vector<procfs::DiskStats> &devices, uint32_t major,
+           uint32_t minor) {
+  for (const procfs::DiskStats &device : devices) {
+    if (device.major == major && device.minor == minor) {
+      return &device;
+    }
+  }
+  return nullptr;
+}
 
-  std::cout << "Filesystem stats for: " << path << "\n";
-  std::cout << "block_size : " << block_size << "\n";
-  std::cout << "  Total Size     : " << total_size / (1024 * 1024 * 1024)
-            << " GB\n";
-  std::cout << "  Free Size      : " << free_size / (1024 * 1024 * 1024)
-            << " GB\n";
-  std::cout << "  Available Size : " << available_size / (1024 * 1024 * 1024)
-            << " GB\n";
+void PrintDiskUsage(std::ostream &out,
+                    const std::vector<procfs::Mount> &mounts,
+                    const std::vector<procfs::DiskStats> &devices) {
+  out << "MOUNT                   DEVICE       TYPE       SIZE GB  USED GB"
+         "  AVAIL GB  USE%\n";
+  for (const procfs::Mount &mount : mounts) {
+    struct statvfs stat;
+    if (statvfs(mount.mount_point.c_str(), &stat) != 0 ||
+        stat.f_blocks == 0) {
+      continue; // Gone since, or not reporting space
+    }
+    double block_size = static_cast<double>(stat.f_frsize);
+    double total = stat.f_blocks * block_size;
+    double used = (stat.f_blocks - stat.f_bfree) * block_size;
+    double available = stat.f_bavail * block_size;
+    // Share of what non-root users can have, as df computes it
+    double use_percent =
+        used + available > 0 ? 100 * used / (used + available) : 0;
+    const procfs::DiskStats *device =
+        FindDevice(devices, mount.major, mount.minor);
+    if (mount.mount_point.size() > 23) {
+      out << mount.mount_point << '\n' << std::string(23, ' ');
+    } else {
+      out << std::left << std::setw(23) << mount.mount_point;
+    }
+    out << std::left << ' ' << std::setw(12)
+        << (device ? device->name : mount.source.c_str()) << ' '
+        << std::setw(8) << mount.fs_type << std::right << std::setw(10)
+        << total / GIB << std::setw(9) << used / GIB << std::setw(10)
+        << available / GIB << std::setw(6) << use_percent << '\n';
+  }
 }
 
-int main() { PrintDiskUsage("/"); }
+void PrintDiskLoad(std::ostream &out,
+                   const std::vector<procfs::DiskStats> &before,
+                   const std::vector<procfs::DiskStats> &after,
+                   double elapsed_ms) {
+  out << "\nDEVICE         r/s      w/s   rMB/s   wMB/s  await ms  queue"
+         "  UTIL%\n";
+  for (const procfs::DiskStats &device : after) {
+    const procfs::DiskStats *previous =
+        FindDevice(before, device.major, device.minor);
+    // Devices that never did any I/O, like unused loop devices, are noise
+    if (previous == nullptr || device.reads + device.writes == 0) {
+      continue;
+    }
+    procfs::DiskRates rates =
+        procfs::disk_rates(*previous, device, elapsed_ms);
+    out << std::left << std::setw(10) << device.name << std::right
+        << std::setw(9) << rates.reads_per_s << std::setw(9)
+        << rates.writes_per_s << std::setw(8) << rates.read_bytes_per_s / MIB
+        << std::setw(8) << rates.write_bytes_per_s / MIB << std::setw(10)
+        << rates.await_ms << std::setw(7) << rates.queue_depth
+        << std::setw(7) << rates.utilization
+        << (rates.utilization >= SATURATED_PERCENT ? "  saturated" : "")
+        << '\n';
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  INSTRUMENT_INSTALL(argv[0], false);
+  int interval_ms = 1000;
+  bool watch = false;
+  int stall_ms = 0;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--watch") == 0) {
+      watch = true;
+    } else if (strcmp(argv[arg], "--pressure") == 0 && arg + 1 < argc) {
+      stall_ms = std::max(1, std::atoi(argv[++arg]));
+      watch = true;
+    } else if (argv[arg][0] != '-') {
+      interval_ms = std::max(1, std::atoi(argv[arg]));
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--watch] [--pressure <stall_ms>] [interval_ms]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<procfs::Mount> mounts;
+  if (!procfs::read_mounts(mounts)) {
+    perror("Error: Could not read /proc/self/mountinfo");
+    return 1;
+  }
+  // /proc/diskstats stays open; the two device lists are swapped between
+  // samples, so sampling reuses their memory
+  procfs::Sampler sampler;
+  std::vector<procfs::DiskStats> previous, current;
+  if (!sampler.read_diskstats(previous)) {
+    perror("Error: Could not read /proc/diskstats");
+    return 1;
+  }
+  auto last_sample = std::chrono::steady_clock::now();
+
+  std::ostringstream frame;
+  frame << std::fixed << std::setprecision(1);
+  auto sample = [&]() {
+    if (!sampler.read_diskstats(current)) {
+      return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double elapsed_ms =
+        std::chrono::duration<double, std::milli>(now - last_sample).count();
+    last_sample = now;
+    frame.str("");
+    PrintDiskUsage(frame, mounts, current);
+    PrintDiskLoad(frame, previous, current, elapsed_ms);
+    std::swap(previous, current);
+    return true;
+  };
+
+  if (!watch) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    if (!sample()) {
+      perror("Error: Could not read /proc/diskstats");
+      return 1;
+    }
+    std::cout << frame.str();
+    return 0;
+  }
+
+  // With a pressure trigger, the loop sleeps in poll() until the kernel
+  // reports stalls, instead of waking up every interval
+  procfs::PressureWatch pressure_watch;
+  if (stall_ms > 0 && !pressure_watch.open(procfs::Resource::IO,
+                                           static_cast<uint64_t>(stall_ms))) {
+    perror("Error: Could not arm a trigger in /proc/pressure/io");
+    return 1;
+  }
+  pollfd event = {pressure_watch.fd(), POLLPRI, 0};
+  procfs::PressureStats pressure;
+  if (stall_ms > 0) {
+    // The trigger may stay quiet for long, so there is a first frame and a
+    // first reading to show meanwhile
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    if (!sample()) {
+      perror("Error: Could not read /proc/diskstats");
+      return 1;
+    }
+    if (!pressure_watch.read(pressure)) {
+      perror("Error: Could not read /proc/pressure/io");
+      return 1;
+    }
+  }
+  std::ostringstream status;
+  status << std::fixed << std::setprecision(2);
+
+  const char *error = nullptr;
+  {
+    term::Screen screen;
+    bool first = stall_ms > 0; // The sample above is shown straight away
+    while (!screen.quit_requested()) {
+      int timeout =
+          stall_ms > 0 ? pressure_watch.timeout(interval_ms) : interval_ms;
+      if (screen.wait(first ? 0 : timeout, event) == 'q') {
+        break;
+      }
+      first = false;
+      status.str("");
+      if (stall_ms > 0) {
+        bool was_sampling = pressure_watch.is_sampling();
+        bool failed = false;
+        bool due = pressure_watch.should_sample(event.revents, failed);
+        if (failed) {
+          error = "Error: The I/O pressure trigger stopped working";
+          break;
+        }
+        if (due && !was_sampling) {
+          // The counters are from before the quiet stretch; measure from
+          // now
+          if (!sampler.read_diskstats(previous)) {
+            error = "Error: Could not read /proc/diskstats";
+            break;
+          }
+          last_sample = std::chrono::steady_clock::now();
+          continue;
+        }
+        if (due && !pressure_watch.read(pressure)) {
+          error = "Error: Could not read /proc/pressure/io";
+          break;
+        }
+        status << "\nI/O pressure: some " << pressure.some.avg10 << "%, full "
+               << pressure.full.avg10 << "% over 10 s";
+        if (!due) {
+          status << "\nIdle until tasks stall on I/O for " << stall_ms
+                 << " ms in 2 s";
+          screen.clear();
+          screen.print_lines(0, 0, frame.str() + status.str());
+          screen.present();
+          continue;
+        }
+      }
+      if (!sample()) {
+        error = "Error: Could not read /proc/diskstats";
+        break;
+      }
+      screen.clear();
+      screen.print_lines(0, 0, frame.str() + status.str());
+      screen.present();
+    }
+  }
+  if (error != nullptr) {
+    perror(error);
+    return 1;
+  }
+  return 0;
+}
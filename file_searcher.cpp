@@ -1,11 +1,37 @@
+// Build:
+//   g++ -std=c++17 -O2 -pthread file_searcher.cpp scan_engine.cpp
+//       dir_walker.cpp matcher.cpp regex_engine.cpp trigram_index.cpp
+//       ordered_output.cpp io_prefetch.cpp cpu_topology.cpp instrument.cpp
+//       -o file_searcher
+//
+// Repeated searches over the same tree can go through a trigram index:
+//   file_searcher --build-index src.idx src/     (again to refresh it)
+//   file_searcher --index src.idx -e foo -e bar
+#include "cpu_topology.h"
+#include "dir_walker.h"
+#include "instrument.h"
+#include "io_prefetch.h"
+#include "matcher.h"
+#include "ordered_output.h"
+#include "scan_engine.h"
+#include "thread_pool.h"
+#include "trigram_index.h"
 #include <algorithm>
+#include <atomic>
+#include <climits>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
 #include <thread>
+#include <unistd.h>
 #include <vector>
 
 using std::cerr;
@@ -13,138 +39,626 @@ using std::cout;
 using std::endl;
 using std::string;
 
-struct SearchResult {
-  int line_number;
-  string line_content;
-  string file_path;
+enum class ReportMode { LINES, FILES_WITH_MATCHES, COUNT };
+
+struct SearchOptions {
+  walk::WalkOptions walk;
+  bool search_binary = false;
+  // Files bigger than two chunks are split so every core can work on them
+  size_t chunk_size = 16 * 1024 * 1024;
+  ReportMode mode = ReportMode::LINES;
+  // Stop reading a file after this many matching lines, 0 for no limit
+  size_t max_count = 0;
 };
 
-std::mutex g_all_results_mutex;
-std::vector<SearchResult> g_all_results;
+// A file's output is collected locally and handed over in blocks this big
+const size_t OUTPUT_BATCH_SIZE = 64 * 1024;
+// How much output a file that isn't up for printing yet may hold back
+// before its worker waits for its turn
+const size_t MAX_BUFFERED_OUTPUT = 4 * 1024 * 1024;
+
+// Files being read ahead of the scanners at once
+const size_t DEFAULT_IO_DEPTH = 4;
+
+std::atomic<size_t> g_matched_lines{0};
+
+using OutputNode = output::OrderedOutput::Node;
+
+// Formats the output for one file according to the report mode.
+class FileReport {
+public:
+  FileReport(output::OrderedOutput &out, OutputNode *node, const string &path,
+             const SearchOptions &options)
+      : m_out(out), m_node(node), m_path(path), m_options(options) {
+    // -l is answered by the first match
+    m_limit = options.mode == ReportMode::FILES_WITH_MATCHES
+                  ? 1
+                  : options.max_count;
+  }
+
+  // Returns false once the file needs no more matches.
+  bool add(size_t line_number, std::string_view line) {
+    m_count++;
+    if (m_options.mode == ReportMode::LINES) {
+      m_batch += '[';
+      m_batch += m_path;
+      m_batch += ':';
+      m_batch += std::to_string(line_number);
+      m_batch += "] ";
+      m_batch += line;
+      m_batch += '\n';
+      if (m_batch.size() >= OUTPUT_BATCH_SIZE) {
+        m_out.write(m_node, m_batch);
+        m_batch.clear();
+      }
+    }
+    return m_limit == 0 || m_count < m_limit;
+  }
 
-void Print(const std::vector<SearchResult> &result) {
-  for (const SearchResult &res : result) {
-    cout << "[" << res.file_path << ":" << res.line_number << "] "
-         << res.line_content << endl;
+  void finish() {
+    if (m_options.mode == ReportMode::FILES_WITH_MATCHES && m_count > 0) {
+      m_batch += m_path + '\n';
+    } else if (m_options.mode == ReportMode::COUNT) {
+      m_batch += m_path + ':' + std::to_string(m_count) + '\n';
+    }
+    if (!m_batch.empty()) {
+      m_out.write(m_node, m_batch);
+    }
+    m_out.finish(m_node);
+    g_matched_lines += m_count;
   }
+
+  size_t limit() const { return m_limit; }
+
+private:
+  output::OrderedOutput &m_out;
+  OutputNode *m_node;
+  const string &m_path;
+  const SearchOptions &m_options;
+  size_t m_limit;
+  size_t m_count = 0;
+  string m_batch;
+};
+
+// Runs the matcher over `region`, passing matching lines to on_match until
+// it returns false. Returns the number of newlines scanned.
+template <typename Callback>
+size_t search_region(match::Matcher &matcher, std::string_view region,
+                     Callback &&on_match) {
+  return scan::scan_lines(
+      region,
+      [&](const char *begin, const char *end) {
+        return matcher.find(begin, end);
+      },
+      on_match);
 }
 
-void seach_in_files(const string &keyword, const string &file_path) {
-  std::ifstream file(file_path);
-  if (!file.is_open()) {
-    cerr << "Error: Could not open file " << file_path << endl;
+// A mapped file whose chunks are searched by different workers. Each chunk
+// collects its matches with chunk-relative line numbers and counts its own
+// newlines; whoever finishes the last chunk turns those counts into a prefix
+// sum, rebases the line numbers and reports the matches in file order.
+struct ChunkedFile {
+  struct LineMatch {
+    size_t line_number;
+    std::string_view line; // Points into the mapping
+  };
+
+  string path;
+  OutputNode *node = nullptr;
+  scan::MappedFile file;
+  std::vector<size_t> chunk_newlines;
+  std::vector<std::vector<LineMatch>> chunk_matches;
+  std::atomic<size_t> chunks_remaining{0};
+};
+
+void search_chunk(match::Matcher &matcher, output::OrderedOutput &out,
+                  ChunkedFile &job, size_t chunk,
+                  const SearchOptions &options) {
+  INSTRUMENT_SCOPE("search.chunk");
+  size_t begin = chunk * options.chunk_size;
+  size_t end = std::min(begin + options.chunk_size, job.file.size());
+  std::string_view region =
+      scan::line_aligned_chunk(job.file.view(), begin, end);
+  INSTRUMENT_COUNT("search.bytes", static_cast<int64_t>(region.size()));
+
+  // A chunk that hits the per-file limit on its own can stop early; its
+  // newline count is then short, but no later chunk gets reported anyway
+  FileReport report(out, job.node, job.path, options);
+  std::vector<ChunkedFile::LineMatch> &matches = job.chunk_matches[chunk];
+  job.chunk_newlines[chunk] = search_region(
+      matcher, region, [&](size_t line_number, std::string_view line) {
+        matches.push_back({line_number, line});
+        return report.limit() == 0 || matches.size() < report.limit();
+      });
+
+  // acq_rel so the last chunk sees every other chunk's results
+  if (job.chunks_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
     return;
+
+  out.begin(job.node);
+  size_t lines_before = 0;
+  bool wanted = true;
+  for (size_t i = 0; i < job.chunk_matches.size() && wanted; i++) {
+    for (const ChunkedFile::LineMatch &match : job.chunk_matches[i]) {
+      wanted = report.add(lines_before + match.line_number, match.line);
+      if (!wanted)
+        break;
+    }
+    lines_before += job.chunk_newlines[i];
   }
+  report.finish();
+}
 
-  cout << "Checking " << std::this_thread::get_id() << endl;
-  std::vector<SearchResult> local_thread_results;
-  string line;
-  int line_number = 0;
+enum class TaskKind { DIRECTORY, FILE, CHUNK };
 
-  while (std::getline(file, line)) {
-    line_number++;
-    if (line.find(keyword) != string::npos) {
-      cout << "found one : " << file_path << " " << line_number << " " << line
-           << endl;
-      local_thread_results.push_back({line_number, line, file_path});
+struct SearchTask {
+  TaskKind kind;
+  string path;
+  int depth;
+  OutputNode *node;
+  std::shared_ptr<ChunkedFile> file = nullptr; // Only set for CHUNK
+  size_t chunk = 0;
+  // Set on FILE tasks that went through the I/O stage
+  std::shared_ptr<io::PrefetchedFile> prefetched = nullptr;
+};
+
+// Runs the walk and the search as tasks on a work-stealing pool. Entries a
+// worker discovers go onto its own deque and are taken back LIFO, so a
+// directory's children are handled while still warm in the dentry cache;
+// idle workers steal the oldest, usually biggest, subtrees. With a
+// prefetcher, files take a detour through the I/O stage before they are
+// queued for scanning.
+class Searcher {
+public:
+  Searcher(threading::ThreadPool &pool, io::Prefetcher *prefetcher,
+           const match::Matcher &matcher, const SearchOptions &options,
+           output::OrderedOutput &out)
+      : m_pool(pool), m_prefetcher(prefetcher), m_options(options),
+        m_out(out) {
+    // Matchers keep scratch state, so every worker gets its own
+    for (size_t i = 0; i < pool.size(); i++) {
+      m_matchers.emplace_back(matcher.clone());
     }
   }
 
-  if (!local_thread_results.empty()) {
-    cout << "Local thread is not empty" << endl;
-    std::lock_guard<std::mutex> guard(g_all_results_mutex);
-    g_all_results.insert(g_all_results.end(), local_thread_results.begin(),
-                         local_thread_results.end());
+  void enqueue(SearchTask task) {
+    m_active++;
+    if (needs_prefetch(task)) {
+      prefetch(std::move(task));
+      return;
+    }
+    m_pool.post([this, task = std::move(task)] {
+      run(task);
+      task_done();
+    });
   }
-}
 
-class ThreadPool {
-public:
-  ThreadPool(const size_t &num_threads, const string &keyword) : m_stop(false) {
-    auto worker = [this, keyword]() {
-      while (true) {
-        string file_path;
-        {
-          std::unique_lock<std::mutex> lock(this->m_queue_mutex);
-
-          // wait until Shutdown signal or work present in the queue
-          this->m_condition.wait(lock, [this] {
-            return this->m_stop || !this->m_tasks_queue.empty();
-          });
-
-          // Shutdown check
-          if (this->m_stop && this->m_tasks_queue.empty()) {
-            return;
+  // Queues a batch with a single wakeup for the pool
+  void enqueue_all(std::vector<SearchTask> &&tasks) {
+    std::vector<std::function<void()>> jobs;
+    jobs.reserve(tasks.size());
+    for (SearchTask &task : tasks) {
+      m_active++;
+      if (needs_prefetch(task)) {
+        prefetch(std::move(task));
+        continue;
+      }
+      jobs.emplace_back([this, task = std::move(task)] {
+        run(task);
+        task_done();
+      });
+    }
+    m_pool.post_bulk(jobs.begin(), jobs.end());
+  }
+
+  // Blocks until every task, including the ones still in the I/O stage, is
+  // done. The pool alone can't tell, it may run dry while files are read.
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_idle_mutex);
+    m_idle.wait(lock, [this] { return m_active == 0; });
+  }
+
+private:
+  bool needs_prefetch(const SearchTask &task) const {
+    return m_prefetcher != nullptr && task.kind == TaskKind::FILE &&
+           task.prefetched == nullptr;
+  }
+
+  // Takes over the count of `task`, which is handed on to the scan task
+  void prefetch(SearchTask task) {
+    string path = task.path;
+    m_prefetcher->load(path, [this, task](io::PrefetchedFile &&file) mutable {
+      task.prefetched = std::make_shared<io::PrefetchedFile>(std::move(file));
+      enqueue(std::move(task));
+      task_done();
+    });
+  }
+
+  void task_done() {
+    if (m_active.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(m_idle_mutex);
+      m_idle.notify_all();
+    }
+  }
+
+  match::Matcher &matcher() { return *m_matchers[m_pool.current_worker()]; }
+
+  void run(const SearchTask &task) {
+    if (task.kind == TaskKind::CHUNK) {
+      search_chunk(matcher(), m_out, *task.file, task.chunk, m_options);
+      return;
+    }
+    if (task.kind == TaskKind::FILE) {
+      seach_in_file(task);
+      return;
+    }
+
+    INSTRUMENT_SCOPE("walk.directory");
+    m_out.begin(task.node);
+    const walk::WalkOptions &walk_options = m_options.walk;
+    int child_depth = task.depth + 1;
+    bool descend =
+        walk_options.max_depth < 0 || child_depth <= walk_options.max_depth;
+    std::vector<std::pair<string, bool>> entries;
+    bool ok = walk::list_directory(
+        task.path, [&](const string &path, walk::EntryType type) {
+          std::string_view name(path);
+          name.remove_prefix(path.rfind('/') + 1);
+          if (type == walk::EntryType::DIRECTORY) {
+            if (descend && !walk::is_excluded(name, walk_options))
+              entries.emplace_back(path, true);
+          } else if (type == walk::EntryType::FILE) {
+            if (walk::is_included_file(name, walk_options))
+              entries.emplace_back(path, false);
           }
+        });
+    if (!ok) {
+      perror(("Error: Could not read directory " + task.path).c_str());
+    }
 
-          file_path = this->m_tasks_queue.front();
-          this->m_tasks_queue.pop();
-        } // Lock is released here
-        seach_in_files(keyword, file_path);
-      }
-    };
-    // creating worker Objects and adding to the m_workers;
-    for (size_t i = 0; i < num_threads; i++) {
-      m_workers.emplace_back(worker);
+    // Sorted so the output order doesn't depend on the filesystem
+    std::sort(entries.begin(), entries.end());
+    std::vector<bool> is_directory;
+    for (const auto &entry : entries) {
+      is_directory.push_back(entry.second);
+    }
+    std::vector<OutputNode *> nodes =
+        m_out.set_children(task.node, is_directory);
+    std::vector<SearchTask> children;
+    children.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+      TaskKind kind = entries[i].second ? TaskKind::DIRECTORY : TaskKind::FILE;
+      children.push_back(
+          {kind, std::move(entries[i].first), child_depth, nodes[i]});
     }
+    enqueue_all(std::move(children));
   }
 
-  ~ThreadPool() {
-    {
-      std::unique_lock<std::mutex> lock(m_queue_mutex);
-      m_stop = true;
+  void seach_in_file(const SearchTask &task) {
+    if (task.prefetched && task.prefetched->loaded() &&
+        task.prefetched->view().size() <= 2 * m_options.chunk_size) {
+      search_whole_file(task, task.prefetched->view());
+      return;
     }
-    m_condition.notify_all();
 
-    for (std::thread &worker : m_workers) {
-      worker.join();
+    auto job = std::make_shared<ChunkedFile>();
+    job->path = task.path;
+    job->node = task.node;
+    if (!job->file.open(task.path)) {
+      cerr << "Error: Could not open file " << task.path << endl;
+      m_out.finish(task.node);
+      return;
+    }
+    std::string_view data = job->file.view();
+    size_t chunk_size = m_options.chunk_size;
+    if (data.size() <= 2 * chunk_size) {
+      search_whole_file(task, data);
+      return;
+    }
+    if (!m_options.search_binary &&
+        walk::looks_binary(data.data(), data.size())) {
+      m_out.finish(task.node);
+      return;
+    }
+
+    // Split so the tail of a search is bounded by chunk size rather than by
+    // the largest file; idle workers steal the chunks like any other task
+    size_t chunks = (data.size() + chunk_size - 1) / chunk_size;
+    job->chunk_newlines.resize(chunks);
+    job->chunk_matches.resize(chunks);
+    job->chunks_remaining = chunks;
+    for (size_t i = 0; i < chunks; i++) {
+      enqueue({TaskKind::CHUNK, task.path, task.depth, task.node, job, i});
     }
   }
 
-  void enqueue(const string &file_path) {
-    {
-      std::unique_lock<std::mutex> lock(m_queue_mutex); // Locking
-      m_tasks_queue.push(file_path);
-    } // Lock released
-    m_condition.notify_one();
+  void search_whole_file(const SearchTask &task, std::string_view data) {
+    if (!m_options.search_binary &&
+        walk::looks_binary(data.data(), data.size())) {
+      m_out.finish(task.node);
+      return;
+    }
+    INSTRUMENT_SCOPE("search.file");
+    INSTRUMENT_COUNT("search.bytes", static_cast<int64_t>(data.size()));
+    m_out.begin(task.node);
+    FileReport report(m_out, task.node, task.path, m_options);
+    search_region(matcher(), data,
+                  [&](size_t line_number, std::string_view line) {
+                    return report.add(line_number, line);
+                  });
+    report.finish();
   }
 
-private:
-  std::queue<string> m_tasks_queue;
-  std::vector<std::thread> m_workers;
+  threading::ThreadPool &m_pool;
+  io::Prefetcher *m_prefetcher;
+  const SearchOptions m_options;
+  output::OrderedOutput &m_out;
+  std::vector<std::unique_ptr<match::Matcher>> m_matchers;
 
-  // Synchronization primitives
-  std::mutex m_queue_mutex;
-  std::condition_variable m_condition;
-  bool m_stop;
+  std::atomic<size_t> m_active{0}; // Queued, running or being read
+  std::mutex m_idle_mutex;
+  std::condition_variable m_idle;
 };
 
+void print_usage(const char *program) {
+  cerr << "Usage: " << program
+       << " [options] <keyword> <path1> [<path2> ...]\n"
+       << "       " << program << " [options] -e <pattern> ... <path1> ...\n"
+       << "       " << program << " --build-index <index> <path1> ...\n"
+       << "Directories are searched recursively.\n"
+       << "  -e <pattern>       search for this pattern, may be repeated\n"
+       << "  -f <file>          read patterns from a file, one per line\n"
+       << "  -E, --regex        patterns are regular expressions\n"
+       << "  -i, --ignore-case  case-insensitive matching\n"
+       << "  --include <glob>   only search files whose name matches\n"
+       << "  --exclude <glob>   skip files and directories that match\n"
+       << "  --max-depth <n>    how many directory levels to descend\n"
+       << "  --binary           also search files that look binary\n"
+       << "  --chunk-size <kb>  split bigger files into chunks of this size\n"
+       << "  -m <n>             stop reading a file after n matching lines\n"
+       << "  -l                 only print the names of files with matches\n"
+       << "  -c                 only print a count of matching lines per file\n"
+       << "  --build-index <f>  index the paths into <f> and exit\n"
+       << "  --index <f>        only search indexed files that can match,\n"
+       << "                     optionally limited to the given paths\n"
+       << "  --threads <n>      number of worker threads\n"
+       << "  --pin              pin each worker thread to a CPU of its own,\n"
+       << "                     a physical core each as far as they go\n"
+       << "  --io-depth <n>     files read ahead of the search at once, 0 to\n"
+       << "                     read them in the search threads" << endl;
+}
+
+bool read_patterns(const char *path, std::vector<string> &patterns) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+  string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (!line.empty())
+      patterns.push_back(line);
+  }
+  return true;
+}
+
+// The indexed files under `roots` (all of them if none are given) whose
+// trigrams allow a match, in path order. The index reflects the tree as of
+// its last build; files changed since then are searched as they are now but
+// new matches in files that weren't candidates are missed until it is
+// rebuilt.
+bool indexed_candidates(const string &index_path,
+                        const match::Matcher &matcher,
+                        const std::vector<string> &roots,
+                        const SearchOptions &options,
+                        std::vector<string> &paths) {
+  trigram::Index index;
+  if (!index.open(index_path)) {
+    cerr << "Error: " << index_path << " is not a readable index" << endl;
+    return false;
+  }
+
+  std::vector<string> prefixes;
+  for (const string &root : roots) {
+    char resolved[PATH_MAX];
+    if (realpath(root.c_str(), resolved) == nullptr) {
+      perror(("Error: Could not open " + root).c_str());
+      continue;
+    }
+    prefixes.push_back(resolved);
+  }
+  if (!roots.empty() && prefixes.empty()) {
+    return true;
+  }
+
+  for (uint32_t id : index.candidates(matcher.required_literals())) {
+    if ((index.file(id).flags & trigram::FILE_BINARY) &&
+        !options.search_binary) {
+      continue;
+    }
+    std::string_view path = index.path(id);
+    std::string_view name = path.substr(path.rfind('/') + 1);
+    if (!walk::is_included_file(name, options.walk)) {
+      continue;
+    }
+    bool under_root = prefixes.empty();
+    for (const string &prefix : prefixes) {
+      under_root |= path.compare(0, prefix.size(), prefix) == 0 &&
+                    (path.size() == prefix.size() || prefix.back() == '/' ||
+                     path[prefix.size()] == '/');
+    }
+    if (under_root) {
+      paths.emplace_back(path);
+    }
+  }
+  return true;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 3) {
-    cerr << "Usage: " << argv[0] << " <keyword> <file1> [<file2> ...]" << endl;
+  INSTRUMENT_INSTALL(argv[0], true);
+  SearchOptions options;
+  match::MatchOptions match_options;
+  string build_index_path;
+  string index_path;
+  size_t num_threads = std::max(2u, std::thread::hardware_concurrency());
+  size_t io_depth = DEFAULT_IO_DEPTH;
+  bool pin_threads = false;
+
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++) {
+    string option = argv[arg];
+    if (option == "--") {
+      arg++;
+      break;
+    }
+    if (option == "--binary") {
+      options.search_binary = true;
+      continue;
+    }
+    if (option == "-E" || option == "--regex") {
+      match_options.regex = true;
+      continue;
+    }
+    if (option == "-i" || option == "--ignore-case") {
+      match_options.ignore_case = true;
+      continue;
+    }
+    if (option == "-l" || option == "--files-with-matches") {
+      options.mode = ReportMode::FILES_WITH_MATCHES;
+      continue;
+    }
+    if (option == "-c" || option == "--count") {
+      options.mode = ReportMode::COUNT;
+      continue;
+    }
+    if (option == "--pin") {
+      pin_threads = true;
+      continue;
+    }
+    if (arg + 1 >= argc) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    const char *value = argv[++arg];
+    if (option == "-e" || option == "--pattern") {
+      match_options.patterns.push_back(value);
+    } else if (option == "-f" || option == "--patterns-file") {
+      if (!read_patterns(value, match_options.patterns)) {
+        perror(("Error: Could not open " + string(value)).c_str());
+        return 1;
+      }
+    } else if (option == "-m" || option == "--max-count") {
+      options.max_count = std::max(1L, std::atol(value));
+    } else if (option == "--build-index") {
+      build_index_path = value;
+    } else if (option == "--index") {
+      index_path = value;
+    } else if (option == "--include") {
+      options.walk.include_globs.push_back(value);
+    } else if (option == "--exclude") {
+      options.walk.exclude_globs.push_back(value);
+    } else if (option == "--max-depth") {
+      options.walk.max_depth = std::atoi(value);
+    } else if (option == "--chunk-size") {
+      options.chunk_size = std::max(1L, std::atol(value)) * 1024;
+    } else if (option == "--threads") {
+      num_threads = std::max(1, std::atoi(value));
+    } else if (option == "--io-depth") {
+      io_depth = static_cast<size_t>(std::max(0, std::atoi(value)));
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!build_index_path.empty()) {
+    if (arg >= argc) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    trigram::BuildStats stats;
+    std::vector<string> roots(argv + arg, argv + argc);
+    if (!trigram::build_index(build_index_path, roots, options.walk,
+                              num_threads, stats)) {
+      return 1;
+    }
+    cout << "Indexed " << stats.files << " files (" << stats.reused
+         << " unchanged, " << stats.binary << " binary), " << stats.trigrams
+         << " distinct trigrams." << endl;
+    return 0;
+  }
+
+  if (match_options.patterns.empty() && arg < argc) {
+    match_options.patterns.push_back(argv[arg++]);
+  }
+  if (match_options.patterns.empty() ||
+      (arg >= argc && index_path.empty())) {
+    print_usage(argv[0]);
     return 1;
   }
-  string keyword = argv[1];
 
-  const size_t num_threads = std::max(2u, std::thread::hardware_concurrency());
-  cout << "Using a thread pool with " << num_threads << " threads." << endl;
+  std::unique_ptr<match::Matcher> matcher;
+  try {
+    matcher = match::make_matcher(match_options);
+  } catch (const std::invalid_argument &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
 
+  // The top level of the output follows the order of the command line (or
+  // of the index), everything below it is sorted by path
+  std::vector<string> paths;
+  std::vector<bool> is_directory;
+  if (!index_path.empty()) {
+    std::vector<string> roots(argv + arg, argv + argc);
+    if (!indexed_candidates(index_path, *matcher, roots, options, paths)) {
+      return 1;
+    }
+    is_directory.assign(paths.size(), false);
+  } else {
+    for (; arg < argc; arg++) {
+      struct stat st;
+      if (stat(argv[arg], &st) != 0) {
+        perror(("Error: Could not open " + string(argv[arg])).c_str());
+        continue;
+      }
+      paths.push_back(argv[arg]);
+      is_directory.push_back(S_ISDIR(st.st_mode));
+    }
+  }
+
+  output::BufferedWriter writer(STDOUT_FILENO);
   {
-    ThreadPool pool(num_threads, keyword);
+    output::OrderedOutput out(writer, MAX_BUFFERED_OUTPUT);
+    std::unique_ptr<io::Prefetcher> prefetcher;
+    if (io_depth > 0) {
+      prefetcher = std::make_unique<io::Prefetcher>(io_depth);
+    }
+    threading::PoolOptions pool_options;
+    pool_options.threads = num_threads;
+    topology::Topology machine;
+    if (pin_threads && machine.load()) {
+      pool_options.cpus = machine.pinning_plan(num_threads);
+    }
+    threading::ThreadPool pool(pool_options);
+    Searcher searcher(pool, prefetcher.get(), *matcher, options, out);
 
-    for (int i = 2; i < argc; i++) {
-      pool.enqueue(argv[i]);
+    std::vector<OutputNode *> nodes =
+        out.set_children(out.root(), is_directory);
+    for (size_t i = 0; i < paths.size(); i++) {
+      TaskKind kind = is_directory[i] ? TaskKind::DIRECTORY : TaskKind::FILE;
+      searcher.enqueue({kind, paths[i], 0, nodes[i]});
     }
-    cout << "All tasks enqueued. Waiting for workers to finish..." << endl;
+    searcher.wait();
   }
+  writer.flush();
 
-  cout << "\n--- Search Results ---" << endl;
-  if (g_all_results.empty()) {
-    cout << "Keyword '" << keyword << "' not found." << endl;
-  } else {
-    for (const SearchResult &result : g_all_results) {
-      cout << "[" << result.file_path << ":" << result.line_number << "] "
-           << result.line_content << endl;
+  if (g_matched_lines == 0 && options.mode == ReportMode::LINES) {
+    if (match_options.patterns.size() == 1) {
+      cout << "Keyword '" << match_options.patterns[0] << "' not found."
+           << endl;
+    } else {
+      cout << "None of the " << match_options.patterns.size()
+           << " patterns found." << endl;
     }
   }
   return 0;
@@ -0,0 +1,428 @@
+// Build:
+//   g++ -std=c++17 -O2 file_searcher_bench.cpp -o file_searcher_bench
+//
+// Generates synthetic corpora (once, they are reused while the seed and scale
+// stay the same) and times a file_searcher binary over them in several modes
+// and thread counts. Results go to stdout as JSON, progress to stderr:
+//   file_searcher_bench --searcher ./file_searcher --threads 1,2,4 > run.json
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <ftw.h>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+
+namespace {
+
+// The word every query looks for; corpora differ in how often it shows up.
+const char *NEEDLE = "needle";
+
+struct CorpusSpec {
+  const char *name;
+  size_t files;
+  size_t file_bytes;
+  size_t min_line;
+  size_t max_line;
+  double needle_per_line; // Chance of a line containing NEEDLE
+};
+
+// Sizes are for --scale 1. Scaling keeps the total size proportional and
+// changes the number of files where there are many, their size otherwise.
+const CorpusSpec CORPORA[] = {
+    {"many_small_files", 20000, 4 * 1024, 10, 120, 0.001},
+    {"few_huge_files", 4, 64 * 1024 * 1024, 10, 120, 0.0001},
+    {"long_lines", 16, 8 * 1024 * 1024, 16 * 1024, 256 * 1024, 0.001},
+    {"high_density", 64, 1024 * 1024, 10, 120, 0.5},
+};
+
+struct Corpus {
+  const CorpusSpec *spec;
+  string path;
+  size_t files = 0;
+  uint64_t bytes = 0;
+};
+
+struct Mode {
+  const char *name;
+  std::vector<string> args; // Everything but --threads and the path
+};
+
+const std::vector<Mode> &modes() {
+  static const std::vector<Mode> all = {
+      {"literal", {NEEDLE}},
+      {"ignore_case", {"-i", "NEEDLE"}},
+      {"multi_pattern", {"-e", NEEDLE, "-e", "quux", "-e", "frobnicate"}},
+      {"regex", {"-E", "ne+dl[a-z]|fro+b"}},
+      {"files_with_matches", {"-l", NEEDLE}},
+      {"count", {"-c", NEEDLE}},
+  };
+  return all;
+}
+
+// Pseudo-words over a small alphabet so the byte mix looks like text and
+// partial matches of NEEDLE ("ne", "nee", ...) are common.
+class TextGenerator {
+public:
+  explicit TextGenerator(uint32_t seed) : m_rng(seed) {
+    const char *letters = "abcdeilnorstu";
+    std::uniform_int_distribution<int> length(1, 10);
+    std::uniform_int_distribution<size_t> letter(0, 12);
+    for (int i = 0; i < 4096; i++) {
+      string word;
+      for (int n = length(m_rng); n > 0; n--)
+        word += letters[letter(m_rng)];
+      if (word != NEEDLE)
+        m_words.push_back(word);
+    }
+  }
+
+  // Appends lines until `out` holds `bytes` bytes.
+  void fill(string &out, size_t bytes, const CorpusSpec &spec) {
+    std::uniform_int_distribution<size_t> line_length(spec.min_line,
+                                                      spec.max_line);
+    std::uniform_int_distribution<size_t> word(0, m_words.size() - 1);
+    std::bernoulli_distribution has_needle(spec.needle_per_line);
+    while (out.size() < bytes) {
+      size_t line_end = std::min(bytes, out.size() + line_length(m_rng));
+      size_t needle_at = has_needle(m_rng)
+                             ? out.size() + (line_end - out.size()) / 2
+                             : string::npos;
+      while (out.size() + 1 < line_end) {
+        if (out.size() >= needle_at) {
+          out += NEEDLE;
+          needle_at = string::npos;
+        } else {
+          out += m_words[word(m_rng)];
+        }
+        out += ' ';
+      }
+      out.resize(line_end - 1);
+      out += '\n';
+    }
+  }
+
+private:
+  std::mt19937 m_rng;
+  std::vector<string> m_words;
+};
+
+bool make_directory(const string &path) {
+  if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST)
+    return true;
+  perror(("Error: Could not create " + path).c_str());
+  return false;
+}
+
+bool write_file(const string &path, const string &data) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(data.data(), static_cast<std::streamsize>(data.size()));
+  if (!file) {
+    perror(("Error: Could not write " + path).c_str());
+    return false;
+  }
+  return true;
+}
+
+int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+  if (remove(path) == 0)
+    return 0;
+  perror((string("Error: Could not remove ") + path).c_str());
+  return -1;
+}
+
+// Deletes a corpus left by another seed or scale, whose files would
+// otherwise be searched along with the new ones
+bool remove_tree(const string &path) {
+  struct stat info;
+  if (lstat(path.c_str(), &info) < 0 && errno == ENOENT)
+    return true;
+  return nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+string json_string(const string &text) {
+  std::ostringstream out;
+  out << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(c);
+    else
+      out << c;
+  }
+  out << '"';
+  return out.str();
+}
+
+// Writes the corpus under `root` unless a manifest from the same seed and
+// scale is already there. Files are spread over 100 directories so walking
+// the tree is part of what gets measured.
+bool prepare_corpus(const string &root, const CorpusSpec &spec, uint32_t seed,
+                    double scale, Corpus &corpus) {
+  corpus.spec = &spec;
+  corpus.path = root + "/" + spec.name;
+  corpus.files = std::max<size_t>(1, static_cast<size_t>(spec.files * scale));
+  const size_t file_bytes = static_cast<size_t>(
+      spec.file_bytes * scale * spec.files / corpus.files);
+
+  std::ostringstream expected;
+  expected << "seed " << seed << " scale " << scale << "\n";
+  string manifest_path = corpus.path + "/MANIFEST";
+  std::ifstream manifest(manifest_path);
+  string line;
+  if (std::getline(manifest, line) && line + "\n" == expected.str() &&
+      manifest >> corpus.bytes) {
+    return true;
+  }
+
+  cerr << "Generating " << corpus.path << "..." << endl;
+  if (!remove_tree(corpus.path) || !make_directory(corpus.path))
+    return false;
+  TextGenerator generator(seed ^ static_cast<uint32_t>(spec.files));
+  string data;
+  corpus.bytes = 0;
+  for (size_t i = 0; i < corpus.files; i++) {
+    string dir = corpus.path + "/d" + std::to_string(i % 100);
+    if (i < 100 && !make_directory(dir))
+      return false;
+    data.clear();
+    generator.fill(data, file_bytes, spec);
+    if (!write_file(dir + "/f" + std::to_string(i) + ".txt", data))
+      return false;
+    corpus.bytes += data.size();
+  }
+  // The manifest lives next to the data, so leave it out of the search
+  std::ostringstream contents;
+  contents << expected.str() << corpus.bytes << "\n";
+  return write_file(manifest_path, contents.str());
+}
+
+struct RunResult {
+  double seconds = 0;
+  long peak_rss_kb = 0;
+  bool ok = false;
+};
+
+// Runs the searcher once with its output discarded; wall time and the
+// child's own peak RSS come from wait4.
+RunResult run_searcher(const string &searcher,
+                       const std::vector<string> &args) {
+  RunResult result;
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(searcher.c_str()));
+  for (const string &arg : args)
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("Error: fork");
+    return result;
+  }
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    execv(argv[0], argv.data());
+    perror(("Error: Could not run " + searcher).c_str());
+    _exit(127);
+  }
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("Error: wait4");
+    return result;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  result.seconds = std::chrono::duration<double>(elapsed).count();
+  result.peak_rss_kb = usage.ru_maxrss;
+  result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  return result;
+}
+
+std::vector<int> parse_thread_counts(const string &list) {
+  std::vector<int> counts;
+  std::istringstream stream(list);
+  string item;
+  while (std::getline(stream, item, ',')) {
+    int count = std::atoi(item.c_str());
+    if (count > 0)
+      counts.push_back(count);
+  }
+  std::sort(counts.begin(), counts.end());
+  counts.erase(std::unique(counts.begin(), counts.end()), counts.end());
+  return counts;
+}
+
+std::vector<int> default_thread_counts() {
+  int max = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> counts;
+  for (int n = 1; n < max; n *= 2)
+    counts.push_back(n);
+  counts.push_back(max);
+  return counts;
+}
+
+void print_usage(const char *program) {
+  cerr << "Usage: " << program << " [options]\n"
+       << "  --searcher <path>   file_searcher binary (./file_searcher)\n"
+       << "  --corpus-dir <dir>  where corpora are generated (/tmp/fs_bench)\n"
+       << "  --scale <x>         corpus size multiplier (1)\n"
+       << "  --seed <n>          corpus generator seed (1)\n"
+       << "  --threads <list>    thread counts, e.g. 1,2,4 (powers of two up\n"
+       << "                      to the number of CPUs)\n"
+       << "  --repeat <n>        runs per measurement, the fastest counts (3)\n"
+       << "  --corpus <name>     only this corpus, may be repeated\n"
+       << "  --mode <name>       only this mode, may be repeated" << endl;
+}
+
+bool selected(const std::vector<string> &filter, const string &name) {
+  return filter.empty() ||
+         std::find(filter.begin(), filter.end(), name) != filter.end();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  string searcher = "./file_searcher";
+  string corpus_dir = "/tmp/fs_bench";
+  double scale = 1;
+  uint32_t seed = 1;
+  int repeat = 3;
+  std::vector<int> thread_counts = default_thread_counts();
+  std::vector<string> corpus_filter;
+  std::vector<string> mode_filter;
+
+  for (int arg = 1; arg < argc; arg++) {
+    string option = argv[arg];
+    if (arg + 1 >= argc) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    const char *value = argv[++arg];
+    if (option == "--searcher") {
+      searcher = value;
+    } else if (option == "--corpus-dir") {
+      corpus_dir = value;
+    } else if (option == "--scale") {
+      scale = std::atof(value);
+    } else if (option == "--seed") {
+      seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    } else if (option == "--threads") {
+      thread_counts = parse_thread_counts(value);
+    } else if (option == "--repeat") {
+      repeat = std::max(1, std::atoi(value));
+    } else if (option == "--corpus") {
+      corpus_filter.push_back(value);
+    } else if (option == "--mode") {
+      mode_filter.push_back(value);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (scale <= 0 || thread_counts.empty()) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (access(searcher.c_str(), X_OK) != 0) {
+    perror(("Error: Could not run " + searcher).c_str());
+    return 1;
+  }
+
+  std::vector<Corpus> corpora;
+  if (!make_directory(corpus_dir))
+    return 1;
+  for (const CorpusSpec &spec : CORPORA) {
+    if (!selected(corpus_filter, spec.name))
+      continue;
+    Corpus corpus;
+    if (!prepare_corpus(corpus_dir, spec, seed, scale, corpus))
+      return 1;
+    corpora.push_back(corpus);
+  }
+
+  cout << "{\n  \"searcher\": " << json_string(searcher) << ",\n"
+       << "  \"seed\": " << seed << ",\n  \"scale\": " << scale << ",\n"
+       << "  \"repeat\": " << repeat << ",\n"
+       << "  \"cpus\": " << std::thread::hardware_concurrency() << ",\n"
+       << "  \"results\": [";
+  bool first_result = true;
+  bool all_ok = true;
+  for (const Corpus &corpus : corpora) {
+    for (const Mode &mode : modes()) {
+      if (!selected(mode_filter, mode.name))
+        continue;
+      double single_thread_seconds = 0;
+      for (int threads : thread_counts) {
+        std::vector<string> args = {"--threads", std::to_string(threads),
+                                    "--exclude", "MANIFEST"};
+        args.insert(args.end(), mode.args.begin(), mode.args.end());
+        args.push_back(corpus.path);
+
+        // Fastest of the runs, the first of which also warms the page cache
+        RunResult best;
+        for (int i = 0; i < repeat; i++) {
+          RunResult run = run_searcher(searcher, args);
+          if (!run.ok) {
+            best = run;
+            break;
+          }
+          if (!best.ok || run.seconds < best.seconds)
+            best.seconds = run.seconds;
+          best.peak_rss_kb = std::max(best.peak_rss_kb, run.peak_rss_kb);
+          best.ok = true;
+        }
+        all_ok &= best.ok;
+        // Without a single thread run, assume the smallest count scaled
+        // perfectly
+        if (threads == thread_counts.front())
+          single_thread_seconds = best.seconds * threads;
+        double speedup = best.seconds > 0
+                             ? single_thread_seconds / best.seconds
+                             : 0;
+
+        cerr << corpus.spec->name << " " << mode.name << " threads=" << threads
+             << ": " << best.seconds << "s" << (best.ok ? "" : " FAILED")
+             << endl;
+        cout << (first_result ? "\n" : ",\n") << "    {\"corpus\": \""
+             << corpus.spec->name << "\", \"mode\": \"" << mode.name
+             << "\", \"threads\": " << threads
+             << ", \"ok\": " << (best.ok ? "true" : "false")
+             << ", \"files\": " << corpus.files
+             << ", \"bytes\": " << corpus.bytes
+             << ", \"seconds\": " << best.seconds
+             << ", \"mb_per_s\": "
+             << (best.seconds > 0 ? corpus.bytes / 1e6 / best.seconds : 0)
+             << ", \"files_per_s\": "
+             << (best.seconds > 0 ? corpus.files / best.seconds : 0)
+             << ", \"peak_rss_kb\": " << best.peak_rss_kb
+             << ", \"speedup\": " << speedup
+             << ", \"efficiency\": " << speedup / threads << "}";
+        first_result = false;
+      }
+    }
+  }
+  cout << "\n  ]\n}" << endl;
+  return all_ok ? 0 : 1;
+}
@@ -0,0 +1,352 @@
+#include "instrument.h"
+
+#ifdef INSTRUMENT
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <pthread.h>
+#include <string>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace instrument {
+
+namespace {
+
+// About 32 MiB a thread
+const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+struct Event {
+  const char *name;
+  int64_t start_ns;
+  int64_t value; // The duration of a scope, the value of a gauge
+  char phase;    // As in the trace format: 'X' a scope, 'C' a gauge
+};
+
+struct ScopeStats {
+  uint64_t count = 0;
+  int64_t total_ns = 0;
+  int64_t max_ns = 0;
+};
+
+struct GaugeStats {
+  int64_t last = 0;
+  int64_t min = INT64_MAX;
+  int64_t max = INT64_MIN;
+  int64_t at_ns = 0; // When `last` was set
+};
+
+// Written by its own thread; the mutex is only ever contended by a dump
+struct ThreadBuffer {
+  std::mutex mutex;
+  long tid = 0;
+  std::string name;
+  std::vector<Event> events;
+  uint64_t dropped = 0;
+  std::unordered_map<const char *, ScopeStats> scopes;
+  std::unordered_map<const char *, int64_t> counters;
+  std::unordered_map<const char *, GaugeStats> gauges;
+};
+
+// Buffers outlive their threads, so what a finished worker recorded is
+// still there at exit
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> threads;
+  std::string program = "program";
+  std::string trace_path;
+  std::string summary_path;
+  int64_t epoch_ns = now_ns();
+  std::mutex dump_mutex;
+};
+
+// Never destroyed: threads still running during exit may record
+Registry &registry() {
+  static Registry *instance = new Registry;
+  return *instance;
+}
+
+thread_local ThreadBuffer *t_buffer = nullptr;
+
+ThreadBuffer &buffer() {
+  if (t_buffer != nullptr)
+    return *t_buffer;
+  auto created = std::make_unique<ThreadBuffer>();
+  created->tid = syscall(SYS_gettid);
+  created->name = "thread " + std::to_string(created->tid);
+  t_buffer = created.get();
+  Registry &r = registry();
+  std::lock_guard<std::mutex> guard(r.mutex);
+  r.threads.push_back(std::move(created));
+  return *t_buffer;
+}
+
+struct Snapshot {
+  long tid;
+  std::string name;
+  std::vector<Event> events;
+  uint64_t dropped;
+  std::unordered_map<const char *, ScopeStats> scopes;
+  std::unordered_map<const char *, int64_t> counters;
+  std::unordered_map<const char *, GaugeStats> gauges;
+};
+
+void write_json_string(std::ostream &out, const std::string &text) {
+  out << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(c) << std::dec << std::setfill(' ');
+    else
+      out << c;
+  }
+  out << '"';
+}
+
+void write_trace(std::ostream &out, const std::vector<Snapshot> &threads,
+                 const std::string &program, int64_t epoch_ns) {
+  long pid = getpid();
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+      << ",\"tid\":0,\"args\":{\"name\":";
+  write_json_string(out, program);
+  out << "}}";
+  for (const Snapshot &thread : threads) {
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"tid\":" << thread.tid << ",\"args\":{\"name\":";
+    write_json_string(out, thread.name);
+    out << "}}";
+    for (const Event &event : thread.events) {
+      out << ",\n{\"name\":";
+      write_json_string(out, event.name);
+      out << ",\"ph\":\"" << event.phase
+          << "\",\"ts\":" << (event.start_ns - epoch_ns) / 1000.0
+          << ",\"pid\":" << pid << ",\"tid\":" << thread.tid;
+      if (event.phase == 'X')
+        out << ",\"dur\":" << event.value / 1000.0 << '}';
+      else
+        out << ",\"args\":{\"value\":" << event.value << "}}";
+    }
+  }
+  out << "\n]}\n";
+}
+
+void write_summary(std::ostream &out, const std::vector<Snapshot> &threads,
+                   const std::string &program) {
+  // Merged over the threads by name
+  std::map<std::string, ScopeStats> scopes;
+  std::map<std::string, int64_t> counters;
+  std::map<std::string, GaugeStats> gauges;
+  uint64_t dropped = 0;
+  for (const Snapshot &thread : threads) {
+    dropped += thread.dropped;
+    for (const auto &[name, stats] : thread.scopes) {
+      ScopeStats &merged = scopes[name];
+      merged.count += stats.count;
+      merged.total_ns += stats.total_ns;
+      merged.max_ns = std::max(merged.max_ns, stats.max_ns);
+    }
+    for (const auto &[name, total] : thread.counters)
+      counters[name] += total;
+    for (const auto &[name, stats] : thread.gauges) {
+      GaugeStats &merged = gauges[name];
+      if (stats.at_ns >= merged.at_ns) {
+        merged.last = stats.last;
+        merged.at_ns = stats.at_ns;
+      }
+      merged.min = std::min(merged.min, stats.min);
+      merged.max = std::max(merged.max, stats.max);
+    }
+  }
+
+  out << "Instrumentation of " << program << ": " << threads.size()
+      << " threads";
+  if (dropped > 0)
+    out << ", " << dropped << " scopes left out of the trace";
+  out << '\n' << std::fixed << std::setprecision(3);
+  if (!scopes.empty()) {
+    std::vector<std::pair<std::string, ScopeStats>> by_total(scopes.begin(),
+                                                             scopes.end());
+    std::sort(by_total.begin(), by_total.end(),
+              [](const auto &a, const auto &b) {
+                return a.second.total_ns > b.second.total_ns;
+              });
+    out << std::left << std::setw(28) << "SCOPE" << std::right
+        << std::setw(10) << "COUNT" << std::setw(14) << "TOTAL ms"
+        << std::setw(12) << "MEAN us" << std::setw(12) << "MAX us" << '\n';
+    for (const auto &[name, stats] : by_total) {
+      out << std::left << std::setw(28) << name << std::right
+          << std::setw(10) << stats.count << std::setw(14)
+          << stats.total_ns / 1e6 << std::setw(12)
+          << stats.total_ns / 1e3 / static_cast<double>(stats.count)
+          << std::setw(12) << stats.max_ns / 1e3 << '\n';
+    }
+  }
+  if (!counters.empty()) {
+    out << std::left << std::setw(28) << "COUNTER" << std::right
+        << std::setw(20) << "TOTAL" << '\n';
+    for (const auto &[name, total] : counters)
+      out << std::left << std::setw(28) << name << std::right
+          << std::setw(20) << total << '\n';
+  }
+  if (!gauges.empty()) {
+    out << std::left << std::setw(28) << "GAUGE" << std::right
+        << std::setw(12) << "LAST" << std::setw(12) << "MIN"
+        << std::setw(12) << "MAX" << '\n';
+    for (const auto &[name, stats] : gauges)
+      out << std::left << std::setw(28) << name << std::right
+          << std::setw(12) << stats.last << std::setw(12) << stats.min
+          << std::setw(12) << stats.max << '\n';
+  }
+}
+
+void watch_signals(sigset_t watched) {
+  for (;;) {
+    int signal_number = 0;
+    if (sigwait(&watched, &signal_number) != 0)
+      continue;
+    dump();
+    if (signal_number == SIGUSR1)
+      continue;
+    // Die of the signal after all, as the program would have
+    signal(signal_number, SIG_DFL);
+    sigset_t unblock;
+    sigemptyset(&unblock);
+    sigaddset(&unblock, signal_number);
+    pthread_sigmask(SIG_UNBLOCK, &unblock, nullptr);
+    raise(signal_number);
+    _exit(128 + signal_number);
+  }
+}
+
+} // namespace
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void install(const char *program, bool catch_termination) {
+  Registry &r = registry();
+  const char *slash = strrchr(program, '/');
+  r.program = slash != nullptr ? slash + 1 : program;
+  const char *trace = getenv("INSTRUMENT_TRACE");
+  r.trace_path = trace != nullptr ? trace
+                                  : "/tmp/" + r.program + "." +
+                                        std::to_string(getpid()) +
+                                        ".trace.json";
+  const char *summary = getenv("INSTRUMENT_SUMMARY");
+  r.summary_path = summary != nullptr ? summary : "";
+  set_thread_name("main");
+
+  sigset_t watched;
+  sigemptyset(&watched);
+  sigaddset(&watched, SIGUSR1);
+  if (catch_termination) {
+    sigaddset(&watched, SIGINT);
+    sigaddset(&watched, SIGTERM);
+  }
+  pthread_sigmask(SIG_BLOCK, &watched, nullptr);
+  // The watcher blocks everything else, so it never takes a signal the
+  // program means to handle itself, e.g. through a signalfd
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+  std::thread(watch_signals, watched).detach();
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+  std::atexit([] { dump(); });
+}
+
+void dump() {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> dump_guard(r.dump_mutex);
+  std::vector<Snapshot> threads;
+  {
+    std::lock_guard<std::mutex> guard(r.mutex);
+    for (const std::unique_ptr<ThreadBuffer> &thread : r.threads) {
+      std::lock_guard<std::mutex> thread_guard(thread->mutex);
+      threads.push_back(Snapshot{thread->tid, thread->name, thread->events,
+                                 thread->dropped, thread->scopes,
+                                 thread->counters, thread->gauges});
+    }
+  }
+
+  if (!r.trace_path.empty()) {
+    std::ofstream trace(r.trace_path, std::ios::trunc);
+    write_trace(trace, threads, r.program, r.epoch_ns);
+    if (!trace)
+      std::cerr << "instrument: Could not write " << r.trace_path
+                << std::endl;
+  }
+  if (r.summary_path.empty()) {
+    write_summary(std::cerr, threads, r.program);
+    return;
+  }
+  std::ofstream summary(r.summary_path, std::ios::trunc);
+  write_summary(summary, threads, r.program);
+  if (!summary)
+    std::cerr << "instrument: Could not write " << r.summary_path
+              << std::endl;
+}
+
+void set_thread_name(const char *name) {
+  ThreadBuffer &b = buffer();
+  std::lock_guard<std::mutex> guard(b.mutex);
+  b.name = name;
+}
+
+void count(const char *name, int64_t amount) {
+  ThreadBuffer &b = buffer();
+  std::lock_guard<std::mutex> guard(b.mutex);
+  b.counters[name] += amount;
+}
+
+void gauge(const char *name, int64_t value) {
+  int64_t now = now_ns();
+  ThreadBuffer &b = buffer();
+  std::lock_guard<std::mutex> guard(b.mutex);
+  GaugeStats &stats = b.gauges[name];
+  stats.last = value;
+  stats.at_ns = now;
+  stats.min = std::min(stats.min, value);
+  stats.max = std::max(stats.max, value);
+  if (b.events.size() < MAX_EVENTS_PER_THREAD)
+    b.events.push_back(Event{name, now, value, 'C'});
+}
+
+void record_scope(const char *name, int64_t start_ns, int64_t end_ns) {
+  int64_t duration = end_ns - start_ns;
+  ThreadBuffer &b = buffer();
+  std::lock_guard<std::mutex> guard(b.mutex);
+  ScopeStats &stats = b.scopes[name];
+  stats.count++;
+  stats.total_ns += duration;
+  stats.max_ns = std::max(stats.max_ns, duration);
+  if (b.events.size() < MAX_EVENTS_PER_THREAD)
+    b.events.push_back(Event{name, start_ns, duration, 'X'});
+  else
+    b.dropped++;
+}
+
+} // namespace instrument
+
+#endif // INSTRUMENT
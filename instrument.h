@@ -0,0 +1,106 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+
+// Timing and counting for the tools, without an external profiler. Built
+// with -DINSTRUMENT (and -pthread), the macros below record into a buffer
+// per thread:
+//
+//   INSTRUMENT_SCOPE("scan.file");          time until the end of the scope
+//   INSTRUMENT_COUNT("scan.bytes", size);   add to a counter
+//   INSTRUMENT_GAUGE("clients", count);     the current value of something
+//   INSTRUMENT_LOCK(guard, mutex, "lock.store");
+//                                           a std::unique_lock named guard,
+//                                           timing the wait for it
+//
+// and once main has called INSTRUMENT_INSTALL(program, catch_termination),
+// what was recorded is dumped on exit and whenever the process gets
+// SIGUSR1: a Chrome trace (chrome://tracing, ui.perfetto.dev) at
+// $INSTRUMENT_TRACE, by default /tmp/<program>.<pid>.trace.json, and a
+// summary table on stderr or at $INSTRUMENT_SUMMARY. Point the latter at a
+// file for a monitor that is drawing the screen, or a daemon.
+//
+// Without -DINSTRUMENT the macros expand to nothing, their arguments aren't
+// evaluated, INSTRUMENT_LOCK is a plain std::unique_lock and instrument.cpp
+// compiles to an empty object, so it can stay on every build line.
+//
+// Names must be string literals, or otherwise live as long as the process.
+// Scopes become trace events, up to a limit per thread; the summary counts
+// every one regardless.
+#ifdef INSTRUMENT
+
+namespace instrument {
+
+// Reads the environment and starts a thread that dumps on SIGUSR1. Call it
+// at the top of main, before other threads start, since it blocks SIGUSR1
+// for them. With `catch_termination`, SIGINT and SIGTERM dump too and then
+// end the program the way they would have; leave it off where the program
+// handles those itself.
+void install(const char *program, bool catch_termination);
+// Writes the trace and the summary now. The recording goes on.
+void dump();
+// How the calling thread is shown in the trace.
+void set_thread_name(const char *name);
+
+void count(const char *name, int64_t amount);
+void gauge(const char *name, int64_t value);
+
+int64_t now_ns();
+void record_scope(const char *name, int64_t start_ns, int64_t end_ns);
+
+class ScopedTimer {
+public:
+  explicit ScopedTimer(const char *name) : m_name(name), m_start(now_ns()) {}
+  ~ScopedTimer() { record_scope(m_name, m_start, now_ns()); }
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  const char *m_name;
+  int64_t m_start;
+};
+
+// Locks `mutex`, recording the wait as a scope only if it was contended.
+template <typename Mutex, typename Lock>
+void timed_lock(Lock &lock, Mutex &mutex, const char *name) {
+  lock = Lock(mutex, std::try_to_lock);
+  if (lock.owns_lock())
+    return;
+  int64_t start = now_ns();
+  lock.lock();
+  record_scope(name, start, now_ns());
+}
+
+} // namespace instrument
+
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+#define INSTRUMENT_INSTALL(program, catch_termination)                        \
+  ::instrument::install(program, catch_termination)
+#define INSTRUMENT_DUMP() ::instrument::dump()
+#define INSTRUMENT_THREAD_NAME(name) ::instrument::set_thread_name(name)
+#define INSTRUMENT_SCOPE(name)                                                 \
+  ::instrument::ScopedTimer INSTRUMENT_CONCAT(instrument_scope_,             \
+                                              __LINE__)(name)
+#define INSTRUMENT_COUNT(name, amount) ::instrument::count(name, amount)
+#define INSTRUMENT_GAUGE(name, value) ::instrument::gauge(name, value)
+#define INSTRUMENT_LOCK(guard, mutex, name)                                    \
+  std::unique_lock<std::remove_reference_t<decltype(mutex)>> guard;          \
+  ::instrument::timed_lock(guard, mutex, name)
+
+#else
+
+#define INSTRUMENT_INSTALL(program, catch_termination) ((void)0)
+#define INSTRUMENT_DUMP() ((void)0)
+#define INSTRUMENT_THREAD_NAME(name) ((void)0)
+#define INSTRUMENT_SCOPE(name) ((void)0)
+#define INSTRUMENT_COUNT(name, amount) ((void)0)
+#define INSTRUMENT_GAUGE(name, value) ((void)0)
+#define INSTRUMENT_LOCK(guard, mutex, name)                                    \
+  std::unique_lock<std::remove_reference_t<decltype(mutex)>> guard(mutex)
+
+#endif // INSTRUMENT
+#endif // !INSTRUMENT_H
@@ -0,0 +1,144 @@
+#include "io_prefetch.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <new>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace io {
+
+namespace {
+
+const size_t PAGE_SIZE = 4096;
+// How much of a file too big for a buffer is read ahead. Mapped files are
+// advised MADV_SEQUENTIAL, so the kernel keeps going from there once the
+// scanner gets to it.
+const off_t LARGE_FILE_READAHEAD = 8 * 1024 * 1024;
+
+threading::PoolOptions reader_pool(size_t depth) {
+  threading::PoolOptions options;
+  options.threads = depth;
+  options.pin_threads = false;
+  return options;
+}
+
+} // namespace
+
+BufferPool::BufferPool(size_t count, size_t buffer_size)
+    : m_buffer_size(buffer_size) {
+  for (size_t i = 0; i < count; i++) {
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, PAGE_SIZE, buffer_size) != 0)
+      throw std::bad_alloc();
+    m_buffers.push_back(static_cast<char *>(buffer));
+  }
+  m_free = m_buffers;
+}
+
+BufferPool::~BufferPool() {
+  for (char *buffer : m_buffers)
+    free(buffer);
+}
+
+char *BufferPool::acquire() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_released.wait(lock, [this] { return !m_free.empty(); });
+  char *buffer = m_free.back();
+  m_free.pop_back();
+  return buffer;
+}
+
+void BufferPool::release(char *buffer) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.push_back(buffer);
+  }
+  m_released.notify_one();
+}
+
+PrefetchedFile::~PrefetchedFile() {
+  if (m_buffer != nullptr)
+    m_pool->release(m_buffer);
+}
+
+PrefetchedFile::PrefetchedFile(PrefetchedFile &&other) noexcept
+    : m_pool(other.m_pool), m_buffer(other.m_buffer), m_size(other.m_size),
+      m_loaded(other.m_loaded) {
+  other.m_buffer = nullptr;
+  other.m_loaded = false;
+}
+
+PrefetchedFile &PrefetchedFile::operator=(PrefetchedFile &&other) noexcept {
+  if (this != &other) {
+    if (m_buffer != nullptr)
+      m_pool->release(m_buffer);
+    m_pool = other.m_pool;
+    m_buffer = other.m_buffer;
+    m_size = other.m_size;
+    m_loaded = other.m_loaded;
+    other.m_buffer = nullptr;
+    other.m_loaded = false;
+  }
+  return *this;
+}
+
+Prefetcher::Prefetcher(size_t depth, size_t buffer_size)
+    : m_buffers(2 * depth, buffer_size),
+      m_threads(reader_pool(depth)) {}
+
+void Prefetcher::load(const std::string &path, ReadyCallback on_ready) {
+  // Posted from outside the pool, so the shared queue keeps them in order
+  m_threads.post([this, path, on_ready = std::move(on_ready)] {
+    on_ready(read(path));
+  });
+}
+
+PrefetchedFile Prefetcher::read(const std::string &path) {
+  PrefetchedFile file;
+  file.m_pool = &m_buffers;
+  file.m_buffer = m_buffers.acquire();
+
+  // Errors are left for the consumer, which opens the file again and
+  // reports them like it always has
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return file;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return file;
+  }
+
+  const size_t capacity = m_buffers.buffer_size();
+  if (static_cast<size_t>(st.st_size) >= capacity) {
+    posix_fadvise(fd, 0, std::min(st.st_size, LARGE_FILE_READAHEAD),
+                  POSIX_FADV_WILLNEED);
+    close(fd);
+    return file;
+  }
+
+  // Smaller than the buffer, so a full buffer means it grew and is better
+  // handled by the consumer's own read
+  size_t used = 0;
+  while (used < capacity) {
+    ssize_t n = pread(fd, file.m_buffer + used, capacity - used,
+                      static_cast<off_t>(used));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      close(fd);
+      return file;
+    }
+    if (n == 0)
+      break;
+    used += static_cast<size_t>(n);
+  }
+  close(fd);
+  file.m_size = used;
+  file.m_loaded = used < capacity;
+  return file;
+}
+
+} // namespace io
@@ -0,0 +1,85 @@
+#ifndef IO_PREFETCH_H
+#define IO_PREFETCH_H
+
+#include "thread_pool.h"
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The I/O stage in front of file_searcher's scanners. A few dedicated threads
+// read upcoming files while the workers scan the ones already read, so on a
+// cold page cache the disk is kept busy instead of every worker stalling on
+// its own page faults one file at a time.
+namespace io {
+
+// A fixed set of equally sized, page aligned buffers. Running out is what
+// keeps the readers from getting too far ahead of the scanners.
+class BufferPool {
+public:
+  BufferPool(size_t count, size_t buffer_size);
+  ~BufferPool();
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  // Blocks until a buffer is free.
+  char *acquire();
+  void release(char *buffer);
+  size_t buffer_size() const { return m_buffer_size; }
+
+private:
+  const size_t m_buffer_size;
+  std::vector<char *> m_buffers;
+  std::mutex m_mutex;
+  std::condition_variable m_released;
+  std::vector<char *> m_free;
+};
+
+// A file on its way through the pipeline. Small regular files arrive read in
+// full; for anything else readahead has been started and the consumer opens
+// the file itself. Either way it holds one buffer of the pool until it is
+// destroyed.
+class PrefetchedFile {
+public:
+  PrefetchedFile() = default;
+  ~PrefetchedFile();
+  PrefetchedFile(PrefetchedFile &&other) noexcept;
+  PrefetchedFile &operator=(PrefetchedFile &&other) noexcept;
+
+  bool loaded() const { return m_loaded; }
+  std::string_view view() const { return std::string_view(m_buffer, m_size); }
+
+private:
+  friend class Prefetcher;
+
+  BufferPool *m_pool = nullptr;
+  char *m_buffer = nullptr;
+  size_t m_size = 0;
+  bool m_loaded = false;
+};
+
+class Prefetcher {
+public:
+  using ReadyCallback = std::function<void(PrefetchedFile &&file)>;
+
+  // `depth` files are read at the same time; as many again may wait, read,
+  // for a scanner. Files up to `buffer_size` bytes are read into memory.
+  explicit Prefetcher(size_t depth, size_t buffer_size = 256 * 1024);
+
+  // Queues `path` and calls on_ready from an I/O thread once it is read or
+  // its readahead is under way. Requests are served in the order they come.
+  void load(const std::string &path, ReadyCallback on_ready);
+
+private:
+  PrefetchedFile read(const std::string &path);
+
+  // Declared first so the threads are gone before the buffers are
+  BufferPool m_buffers;
+  threading::ThreadPool m_threads;
+};
+
+} // namespace io
+#endif // !IO_PREFETCH_H
@@ -0,0 +1,71 @@
+#include "kv_ops.h"
+#include "instrument.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using std::string;
+
+namespace utils {
+
+void kv_set(const string &key, const std::string &value, ValueMap &data_store,
+            std::mutex &data_store_mutex, value_codec::ValueCodec &codec,
+            cluster::SlotIndex *slot_index) {
+  auto stored =
+      std::make_shared<const value_codec::StoredValue>(codec.encode(value));
+  INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+  auto [it, inserted] = data_store.try_emplace(key);
+  if (!inserted)
+    codec.on_remove(*it->second);
+  else if (slot_index)
+    slot_index->add(key);
+  codec.on_insert(*stored);
+  it->second = std::move(stored);
+}
+
+bool kv_del(const string &key, ValueMap &data_store,
+            std::mutex &data_store_mutex, value_codec::ValueCodec &codec,
+            cluster::SlotIndex *slot_index) {
+  INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+  auto it = data_store.find(key);
+  if (it == data_store.end())
+    return false;
+  codec.on_remove(*it->second);
+  if (slot_index)
+    slot_index->remove(key);
+  data_store.erase(it);
+  return true;
+}
+
+std::vector<std::string> kv_keys(ValueMap &data_store,
+                                 std::mutex &data_store_mutex) {
+  INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+  std::vector<std::string> keys;
+  keys.reserve(data_store.size());
+  for (const auto &pair : data_store) {
+    keys.push_back(pair.first);
+  }
+  return keys;
+}
+
+GetResult kv_get(const std::string &key, ValueMap &data_store,
+                 std::mutex &data_store_mutex, value_codec::ValueCodec &codec,
+                 std::string &value) {
+  std::shared_ptr<const value_codec::StoredValue> stored;
+  {
+    INSTRUMENT_LOCK(guard, data_store_mutex, "lock.data_store");
+    auto it = data_store.find(key);
+    if (it == data_store.end()) {
+      return GetResult::NOT_FOUND;
+    }
+    stored = it->second;
+  }
+
+  if (!codec.decode(*stored, value)) {
+    return GetResult::CORRUPTED;
+  }
+  return GetResult::FOUND;
+}
+
+} // namespace utils
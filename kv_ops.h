@@ -0,0 +1,40 @@
+#ifndef KV_OPS_H
+#define KV_OPS_H
+
+#include "cluster.h"
+#include "value_codec.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Stored values are immutable and shared: a write puts a new one in place,
+// and a reader only copies the pointer under the store lock.
+using ValueMap =
+    std::unordered_map<std::string,
+                       std::shared_ptr<const value_codec::StoredValue>>;
+
+// Values go through `codec`, which compresses large ones before the lock is
+// taken and decompresses them lazily, after it is released, on reads.
+// `slot_index`, when given, is kept in sync under the same lock.
+namespace utils {
+enum class GetResult { FOUND, NOT_FOUND, CORRUPTED };
+
+void kv_set(const std::string &key, const std::string &value,
+            ValueMap &data_store, std::mutex &data_store_mutex,
+            value_codec::ValueCodec &codec,
+            cluster::SlotIndex *slot_index = nullptr);
+bool kv_del(const std::string &key, ValueMap &data_store,
+            std::mutex &data_store_mutex, value_codec::ValueCodec &codec,
+            cluster::SlotIndex *slot_index = nullptr);
+
+// `value` is only set when the result is FOUND.
+GetResult kv_get(const std::string &key, ValueMap &data_store,
+                 std::mutex &data_store_mutex, value_codec::ValueCodec &codec,
+                 std::string &value);
+
+std::vector<std::string> kv_keys(ValueMap &data_store,
+                                 std::mutex &data_store_mutex);
+} // namespace utils
+#endif // !KV_OPS_H
@@ -0,0 +1,176 @@
+#include "lz_codec.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace lz {
+
+namespace {
+
+const int HASH_BITS = 12;
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+// The block format requires the last match to start this far from the end
+// and the final bytes to always be literals.
+const size_t MATCH_FIND_LIMIT = 12;
+const size_t LAST_LITERALS = 5;
+
+uint32_t read32(const unsigned char *p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t hash4(const unsigned char *p) {
+  return (read32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void write_length(std::string &out, size_t length) {
+  while (length >= 255) {
+    out.push_back(static_cast<char>(255));
+    length -= 255;
+  }
+  out.push_back(static_cast<char>(length));
+}
+
+void emit_sequence(std::string &out, const unsigned char *literals,
+                   size_t literal_len, size_t offset, size_t match_len) {
+  size_t match_code = match_len - MIN_MATCH;
+  unsigned char token =
+      static_cast<unsigned char>((literal_len < 15 ? literal_len : 15) << 4);
+  if (match_len > 0)
+    token |= static_cast<unsigned char>(match_code < 15 ? match_code : 15);
+  out.push_back(static_cast<char>(token));
+
+  if (literal_len >= 15)
+    write_length(out, literal_len - 15);
+  out.append(reinterpret_cast<const char *>(literals), literal_len);
+
+  if (match_len == 0) // Final literal-only sequence
+    return;
+  out.push_back(static_cast<char>(offset & 0xFF));
+  out.push_back(static_cast<char>(offset >> 8));
+  if (match_code >= 15)
+    write_length(out, match_code - 15);
+}
+
+bool read_length(const unsigned char *&ip, const unsigned char *end,
+                 size_t &length) {
+  unsigned char byte;
+  do {
+    if (ip >= end)
+      return false;
+    byte = *ip++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+} // namespace
+
+size_t max_compressed_size(size_t input_size) {
+  return input_size + input_size / 255 + 16;
+}
+
+std::string compress(std::string_view input) {
+  const auto *src = reinterpret_cast<const unsigned char *>(input.data());
+  const size_t size = input.size();
+  std::string out;
+  out.reserve(max_compressed_size(size));
+
+  if (size < MATCH_FIND_LIMIT + 1) {
+    emit_sequence(out, src, size, 0, 0);
+    return out;
+  }
+
+  // Positions are stored +1 so that zero means "empty slot".
+  std::vector<uint32_t> table(1u << HASH_BITS, 0);
+  const size_t match_limit = size - MATCH_FIND_LIMIT;
+  const size_t extend_limit = size - LAST_LITERALS;
+  size_t anchor = 0;
+  size_t ip = 0;
+
+  while (ip < match_limit) {
+    uint32_t hash = hash4(src + ip);
+    size_t candidate = table[hash];
+    table[hash] = static_cast<uint32_t>(ip + 1);
+
+    if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET ||
+        read32(src + candidate - 1) != read32(src + ip)) {
+      // Step faster the longer we go without a match, so incompressible
+      // data costs little more than a copy.
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+
+    size_t ref = candidate - 1;
+    size_t match_len = MIN_MATCH;
+    while (ip + match_len < extend_limit &&
+           src[ref + match_len] == src[ip + match_len])
+      match_len++;
+
+    emit_sequence(out, src + anchor, ip - anchor, ip - ref, match_len);
+    ip += match_len;
+    anchor = ip;
+    if (ip < match_limit)
+      table[hash4(src + ip - 2)] = static_cast<uint32_t>(ip - 2 + 1);
+  }
+
+  emit_sequence(out, src + anchor, size - anchor, 0, 0);
+  return out;
+}
+
+size_t max_decompressed_size(size_t input_size) { return input_size * 255; }
+
+bool decompress(std::string_view input, size_t raw_size, std::string &out) {
+  if (raw_size > max_decompressed_size(input.size()))
+    return false;
+  const auto *ip = reinterpret_cast<const unsigned char *>(input.data());
+  const unsigned char *end = ip + input.size();
+  out.resize(raw_size);
+  auto *dst = reinterpret_cast<unsigned char *>(out.data());
+  size_t op = 0;
+
+  while (ip < end) {
+    unsigned char token = *ip++;
+
+    size_t literal_len = token >> 4;
+    if (literal_len == 15 && !read_length(ip, end, literal_len))
+      return false;
+    if (literal_len > static_cast<size_t>(end - ip) ||
+        literal_len > raw_size - op)
+      return false;
+    std::memcpy(dst + op, ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+
+    if (ip == end) // Last sequence carries literals only
+      break;
+
+    if (end - ip < 2)
+      return false;
+    size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > op)
+      return false;
+
+    size_t match_len = token & 0x0F;
+    if (match_len == 15 && !read_length(ip, end, match_len))
+      return false;
+    match_len += MIN_MATCH;
+    if (match_len > raw_size - op)
+      return false;
+
+    const unsigned char *match = dst + op - offset;
+    if (offset >= match_len) {
+      std::memcpy(dst + op, match, match_len);
+    } else { // Overlapping copy repeats the last `offset` bytes
+      for (size_t i = 0; i < match_len; i++)
+        dst[op + i] = match[i];
+    }
+    op += match_len;
+  }
+  return op == raw_size;
+}
+
+} // namespace lz
@@ -0,0 +1,29 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A small LZ77 codec using the LZ4 block layout: each sequence is a token
+// byte (literal length / match length nibbles), the literals, a 2 byte
+// little-endian back-reference offset and optional length extension bytes.
+// It trades ratio for speed, which is what we want on the request path.
+namespace lz {
+
+// Worst case output size for an incompressible input of `input_size` bytes.
+size_t max_compressed_size(size_t input_size);
+
+// Most a block of `input_size` bytes can decompress to: a length extension
+// byte adds at most 255 bytes to a match, and nothing else expands further.
+size_t max_decompressed_size(size_t input_size);
+
+std::string compress(std::string_view input);
+
+// `raw_size` is the exact decompressed length, stored next to the block by
+// the caller. Returns false on a corrupted or truncated block, and on a
+// `raw_size` the block can't reach, before allocating anything.
+bool decompress(std::string_view input, size_t raw_size, std::string &out);
+
+} // namespace lz
+#endif // !LZ_CODEC_H
@@ -0,0 +1,137 @@
+#include "matcher.h"
+#include "regex_engine.h"
+#include "scan_engine.h"
+#include <cctype>
+#include <queue>
+#include <string_view>
+
+namespace match {
+
+namespace {
+
+uint8_t fold(uint8_t byte, bool ignore_case) {
+  return ignore_case ? static_cast<uint8_t>(std::tolower(byte)) : byte;
+}
+
+} // namespace
+
+const char *LiteralMatcher::find(const char *begin, const char *end) {
+  return scan::find_literal(begin, end, m_literal);
+}
+
+std::unique_ptr<Matcher> LiteralMatcher::clone() const {
+  return std::make_unique<LiteralMatcher>(m_literal);
+}
+
+AhoCorasickMatcher::AhoCorasickMatcher(
+    const std::vector<std::string> &literals, bool ignore_case) {
+  auto automaton = std::make_shared<Automaton>();
+  Automaton &a = *automaton;
+  a.literals = literals;
+
+  // Byte classes first, so the table width is known before building
+  a.byte_class.fill(0);
+  for (const std::string &literal : literals) {
+    for (char c : literal) {
+      uint8_t byte = fold(static_cast<uint8_t>(c), ignore_case);
+      if (a.byte_class[byte] != 0)
+        continue;
+      a.byte_class[byte] = static_cast<uint16_t>(a.num_classes++);
+      if (ignore_case)
+        a.byte_class[std::toupper(byte)] = a.byte_class[byte];
+    }
+  }
+  const size_t width = a.num_classes;
+  const uint32_t MISSING = UINT32_MAX;
+
+  // Trie
+  a.transitions.assign(width, MISSING);
+  a.accepting.assign(1, 0);
+  for (const std::string &literal : literals) {
+    uint32_t state = 0;
+    for (char c : literal) {
+      uint16_t cls = a.byte_class[static_cast<uint8_t>(c)];
+      uint32_t &next = a.transitions[state * width + cls];
+      if (next == MISSING) {
+        next = static_cast<uint32_t>(a.accepting.size());
+        a.accepting.push_back(0);
+        a.transitions.resize(a.transitions.size() + width, MISSING);
+      }
+      state = a.transitions[state * width + cls];
+    }
+    a.accepting[state] = 1;
+  }
+
+  // Breadth first over the trie to fill in failure transitions, turning it
+  // into a DFA: a missing edge goes wherever the failure state would go.
+  std::vector<uint32_t> fail(a.accepting.size(), 0);
+  std::queue<uint32_t> pending;
+  for (size_t cls = 0; cls < width; cls++) {
+    uint32_t &next = a.transitions[cls];
+    if (next == MISSING) {
+      next = 0;
+    } else {
+      pending.push(next);
+    }
+  }
+  while (!pending.empty()) {
+    uint32_t state = pending.front();
+    pending.pop();
+    for (size_t cls = 0; cls < width; cls++) {
+      uint32_t via_fail = a.transitions[fail[state] * width + cls];
+      uint32_t &next = a.transitions[state * width + cls];
+      if (next == MISSING) {
+        next = via_fail;
+        continue;
+      }
+      fail[next] = via_fail;
+      a.accepting[next] |= a.accepting[via_fail];
+      pending.push(next);
+    }
+  }
+
+  m_automaton = std::move(automaton);
+}
+
+const char *AhoCorasickMatcher::find(const char *begin, const char *end) {
+  const Automaton &a = *m_automaton;
+  if (a.accepting[0])
+    return begin; // An empty pattern matches everywhere
+  const size_t width = a.num_classes;
+  uint32_t state = 0;
+  for (const char *p = begin; p < end; p++) {
+    uint16_t cls = a.byte_class[static_cast<uint8_t>(*p)];
+    state = a.transitions[state * width + cls];
+    if (a.accepting[state])
+      return p;
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Matcher> AhoCorasickMatcher::clone() const {
+  // The automaton is read-only, clones share it
+  return std::unique_ptr<Matcher>(new AhoCorasickMatcher(m_automaton));
+}
+
+std::unique_ptr<Matcher> make_matcher(const MatchOptions &options) {
+  if (options.regex) {
+    if (options.patterns.size() == 1)
+      return std::make_unique<regex::RegexMatcher>(options.patterns[0],
+                                                   options.ignore_case);
+    // One DFA for all of them rather than one pass per pattern
+    std::string combined;
+    for (const std::string &pattern : options.patterns) {
+      if (!combined.empty())
+        combined += '|';
+      combined += "(?:" + pattern + ")";
+    }
+    return std::make_unique<regex::RegexMatcher>(combined,
+                                                 options.ignore_case);
+  }
+  if (options.patterns.size() == 1 && !options.ignore_case)
+    return std::make_unique<LiteralMatcher>(options.patterns[0]);
+  return std::make_unique<AhoCorasickMatcher>(options.patterns,
+                                              options.ignore_case);
+}
+
+} // namespace match
@@ -0,0 +1,91 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Pattern matchers for file_searcher. Whatever the mode, a search is a single
+// pass over the bytes: many literals share one Aho-Corasick automaton and a
+// regex (or several, joined as alternatives) runs as one lazily built DFA.
+namespace match {
+
+class Matcher {
+public:
+  virtual ~Matcher() = default;
+
+  // A position inside the first line of [begin, end) that matches, or
+  // nullptr. `begin` has to be the start of a line. The position may be the
+  // line's terminating '\n' (or `end`) when the match is only known there,
+  // e.g. for a pattern ending in '$'.
+  virtual const char *find(const char *begin, const char *end) = 0;
+
+  // Matchers may keep scratch state between calls (the regex DFA cache), so
+  // each worker thread searches with its own clone.
+  virtual std::unique_ptr<Matcher> clone() const = 0;
+
+  // Every matching line contains at least one of these, compared ignoring
+  // ASCII case. Empty when the matcher can't tell.
+  virtual std::vector<std::string> required_literals() const = 0;
+};
+
+// A single case-sensitive literal, searched with scan::find_literal.
+class LiteralMatcher : public Matcher {
+public:
+  explicit LiteralMatcher(std::string literal)
+      : m_literal(std::move(literal)) {}
+
+  const char *find(const char *begin, const char *end) override;
+  std::unique_ptr<Matcher> clone() const override;
+  std::vector<std::string> required_literals() const override {
+    return {m_literal};
+  }
+
+private:
+  std::string m_literal;
+};
+
+// Any number of literals in one pass. The trie is flattened into a full
+// transition table over byte classes (bytes that never occur in a pattern
+// all share class 0), so the inner loop is one lookup per byte no matter how
+// many patterns there are.
+class AhoCorasickMatcher : public Matcher {
+public:
+  AhoCorasickMatcher(const std::vector<std::string> &literals,
+                     bool ignore_case);
+
+  const char *find(const char *begin, const char *end) override;
+  std::unique_ptr<Matcher> clone() const override;
+  std::vector<std::string> required_literals() const override {
+    return m_automaton->literals;
+  }
+
+private:
+  struct Automaton {
+    std::vector<std::string> literals;
+    std::array<uint16_t, 256> byte_class;
+    size_t num_classes = 1;
+    std::vector<uint32_t> transitions; // state * num_classes + class
+    std::vector<uint8_t> accepting;
+  };
+
+  explicit AhoCorasickMatcher(std::shared_ptr<const Automaton> automaton)
+      : m_automaton(std::move(automaton)) {}
+
+  std::shared_ptr<const Automaton> m_automaton;
+};
+
+struct MatchOptions {
+  std::vector<std::string> patterns;
+  bool regex = false;
+  bool ignore_case = false;
+};
+
+// Picks the cheapest matcher for the options. Throws std::invalid_argument
+// if a regex doesn't parse.
+std::unique_ptr<Matcher> make_matcher(const MatchOptions &options);
+
+} // namespace match
+#endif // !MATCHER_H
@@ -1,70 +1,147 @@
-#include <chrono>
-#include <fstream>
+// Build:
+//   g++ -std=c++17 -O2 memory_info.cpp pressure.cpp proc_sampler.cpp
+//       series_store.cpp term_render.cpp instrument.cpp -o memory_info
+//
+// Usage: memory_info [--history <file>] [--pressure <stall_ms>] [interval_ms]
+//                    (default 300)
+//   --history <file>        record every sample, see monitor_history
+//   --pressure <stall_ms>   sleep until tasks stall on memory for stall_ms
+//                           within 2 s, then sample every interval until
+//                           10 s pass without such a stall
+#include "instrument.h"
+#include "pressure.h"
+#include "proc_sampler.h"
+#include "series_store.h"
+#include "term_render.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <poll.h>
 #include <sstream>
 #include <string>
-#include <thread>
+#include <utility>
 
-struct MemoryStats {
-  unsigned long total_memory, freed_memory, available_memory, cached_memory,
-      buffered_memory, total_swap, freed_swap, cached_swap;
-};
+int main(int argc, char *argv[]) {
+  INSTRUMENT_INSTALL(argv[0], false);
+  int interval_ms = 300;
+  std::string history_path;
+  int stall_ms = 0;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--history") == 0 && arg + 1 < argc) {
+      history_path = argv[++arg];
+    } else if (strcmp(argv[arg], "--pressure") == 0 && arg + 1 < argc) {
+      stall_ms = std::max(1, std::atoi(argv[++arg]));
+    } else if (argv[arg][0] != '-') {
+      interval_ms = std::max(1, std::atoi(argv[arg]));
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--history <file>] [--pressure <stall_ms>] [interval_ms]"
+                << std::endl;
+      return 1;
+    }
+  }
 
-unsigned long ReadBytesFromLine(std::string &line) {
-  std::string label, unit;
-  unsigned long value;
-  std::istringstream iss(line);
-  iss >> label >> value >> unit;
-  return value;
-}
+  history::Store store;
+  if (!history_path.empty() &&
+      !store.open(history_path, {"mem.available_kb", "mem.free_kb",
+                                 "mem.cached_kb", "mem.buffers_kb",
+                                 "swap.free_kb"})) {
+    return 1;
+  }
 
-MemoryStats ReadMemoryInfo() {
-  std::ifstream memfile("/proc/meminfo");
-  std::string line;
-  MemoryStats output;
+  // With a pressure trigger, the loop sleeps in poll() until the kernel
+  // reports stalls, instead of waking up every interval
+  procfs::PressureWatch watch;
+  if (stall_ms > 0 &&
+      !watch.open(procfs::Resource::MEMORY, static_cast<uint64_t>(stall_ms))) {
+    perror("Error: Could not arm a trigger in /proc/pressure/memory");
+    return 1;
+  }
+  pollfd event = {watch.fd(), POLLPRI, 0};
 
-  while (std::getline(memfile, line)) {
-    if (line.find("MemTotal:") == 0) {
-      output.total_memory = ReadBytesFromLine(line);
-    }
-    if (line.find("MemFree:") == 0) {
-      output.freed_memory = ReadBytesFromLine(line);
-    }
-    if (line.find("MemAvailable:") == 0) {
-      output.available_memory = ReadBytesFromLine(line);
-    }
-    if (line.find("Cached:") == 0) {
-      output.cached_memory = ReadBytesFromLine(line);
-    }
-    if (line.find("Buffers:") == 0) {
-      output.buffered_memory = ReadBytesFromLine(line);
-    }
-    if (line.find("SwapTotal:") == 0) {
-      output.total_swap = ReadBytesFromLine(line);
-    }
-    if (line.find("SwapFree:") == 0) {
-      output.freed_swap = ReadBytesFromLine(line);
-    }
-    if (line.find("SwapCached:") == 0) {
-      output.cached_swap = ReadBytesFromLine(line);
+  procfs::Sampler sampler;
+  procfs::MemInfo stats;
+  procfs::PressureStats pressure;
+  std::ostringstream status;
+  status << std::fixed << std::setprecision(2);
+  const char *error = nullptr;
+  {
+    term::Screen screen;
+    bool first = true;
+    while (!screen.quit_requested()) {
+      bool sample = true;
+      if (stall_ms > 0 && !first) {
+        bool failed = false;
+        sample = watch.should_sample(event.revents, failed);
+        if (failed) {
+          error = "Error: The memory pressure trigger stopped working";
+          break;
+        }
+      }
+      first = false;
+
+      if (sample) {
+        if (!sampler.read_meminfo(stats)) {
+          error = "Error: Could not read /proc/meminfo";
+          break;
+        }
+        if (!history_path.empty()) {
+          int64_t now = history::now_ms();
+          store.append(0, now, static_cast<double>(stats.available));
+          store.append(1, now, static_cast<double>(stats.free));
+          store.append(2, now, static_cast<double>(stats.cached));
+          store.append(3, now, static_cast<double>(stats.buffers));
+          store.append(4, now, static_cast<double>(stats.swap_free));
+        }
+        if (stall_ms > 0 && !watch.read(pressure)) {
+          error = "Error: Could not read /proc/pressure/memory";
+          break;
+        }
+      }
+
+      const std::pair<const char *, uint64_t> rows[] = {
+          {"Total Memory     : ", stats.total},
+          {"Free Memory      : ", stats.free},
+          {"Available Memory : ", stats.available},
+          {"Cached Memory    : ", stats.cached},
+          {"Buffered Memory  : ", stats.buffers},
+          {"Total Swap       : ", stats.swap_total},
+          {"Free Swap        : ", stats.swap_free},
+          {"Cached Swap      : ", stats.swap_cached},
+      };
+      screen.clear();
+      screen.print(0, 0, "Memory Statistics:", term::Style::BOLD);
+      int row = 1;
+      for (const auto &[label, value] : rows) {
+        screen.print(row++, 2, label + std::to_string(value) + " kB");
+      }
+      if (stall_ms > 0) {
+        status.str("");
+        status << "Pressure: some " << pressure.some.avg10 << "%, full "
+               << pressure.full.avg10 << "% over 10 s";
+        screen.print(++row, 2, status.str());
+        screen.print(++row, 2,
+                     watch.is_sampling()
+                         ? "Sampling while memory is under pressure"
+                         : "Idle until memory stalls for " +
+                               std::to_string(stall_ms) + " ms in 2 s",
+                     watch.is_sampling() ? term::Style::WARN
+                                         : term::Style::DIM);
+      }
+      screen.present();
+      int timeout = stall_ms > 0 ? watch.timeout(interval_ms) : interval_ms;
+      if (screen.wait(timeout, event) == 'q') {
+        break;
+      }
     }
   }
-  return output;
-}
-
-int main() {
-  while (true) {
-    MemoryStats stats = ReadMemoryInfo();
-    std::system("clear");
-    std::cout << "Memory Statistics:\n";
-    std::cout << "  Total Memory     : " << stats.total_memory << " kB\n";
-    std::cout << "  Free Memory      : " << stats.freed_memory << " kB\n";
-    std::cout << "  Available Memory : " << stats.available_memory << " kB\n";
-    std::cout << "  Cached Memory    : " << stats.cached_memory << " kB\n";
-    std::cout << "  Buffered Memory  : " << stats.buffered_memory << " kB\n";
-    std::cout << "  Total Swap       : " << stats.total_swap << " kB\n";
-    std::cout << "  Free Swap        : " << stats.freed_swap << " kB\n";
-    std::cout << "  Cached Swap      : " << stats.cached_swap << " kB\n";
-    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  if (error != nullptr) {
+    perror(error);
+    return 1;
   }
+  return 0;
 }
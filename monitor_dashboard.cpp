@@ -0,0 +1,210 @@
+// Build:
+//   g++ -std=c++17 -O2 -pthread monitor_dashboard.cpp proc_sampler.cpp
+//       proc_table.cpp term_render.cpp instrument.cpp -o monitor_dashboard
+//
+// CPU, memory, disk and the busiest processes on one screen, redrawn in
+// place every interval. Press q or Ctrl-C to leave.
+//   monitor_dashboard [--interval <ms>] [<mount point> ...]   (default /)
+#include "instrument.h"
+#include "proc_sampler.h"
+#include "proc_table.h"
+#include "term_render.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const size_t SCAN_THREADS = 4;
+// Width of one per-core column
+const int CORE_COLUMN = 36;
+
+term::Style LevelStyle(double percent) {
+  if (percent >= 90)
+    return term::Style::BAD;
+  if (percent >= 70)
+    return term::Style::WARN;
+  return term::Style::GOOD;
+}
+
+std::string Format(const char *format, double a, double b = 0,
+                   double c = 0) {
+  char text[128];
+  snprintf(text, sizeof(text), format, a, b, c);
+  return text;
+}
+
+// A labelled meter with the percentage after it; returns the next row.
+int DrawMeter(term::Screen &screen, int row, int col, int width,
+              const std::string &label, double percent,
+              const std::string &detail) {
+  const int label_width = 8;
+  int bar_width = std::max(10, std::min(50, width - label_width - 8));
+  screen.print(row, col, label);
+  screen.bar(row, col + label_width, bar_width, percent / 100,
+             LevelStyle(percent));
+  screen.print(row, col + label_width + bar_width + 1,
+               Format("%5.1f%%", percent), LevelStyle(percent));
+  screen.print(row, col + label_width + bar_width + 8, detail,
+               term::Style::DIM);
+  return row + 1;
+}
+
+void print_usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--interval <ms>] [<mount point> ...]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  INSTRUMENT_INSTALL(argv[0], false);
+  int interval_ms = 1000;
+  std::vector<std::string> mounts;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--interval") == 0 && arg + 1 < argc) {
+      interval_ms = std::max(1, std::atoi(argv[++arg]));
+    } else if (argv[arg][0] != '-') {
+      mounts.push_back(argv[arg]);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (mounts.empty()) {
+    mounts.push_back("/");
+  }
+  char hostname[256] = "";
+  gethostname(hostname, sizeof(hostname) - 1);
+
+  procfs::Sampler sampler;
+  procfs::StatSample previous, current;
+  procfs::MemInfo memory;
+  threading::PoolOptions pool_options;
+  pool_options.threads = SCAN_THREADS;
+  pool_options.pin_threads = false;
+  threading::ThreadPool pool(pool_options);
+  procfs::ProcessTable processes(&pool);
+  std::vector<procfs::ProcessUsage> usage;
+  if (!sampler.read_stat(previous) || !processes.sample(usage)) {
+    perror("Error: Could not read /proc");
+    return 1;
+  }
+
+  bool ok = true;
+  {
+    term::Screen screen;
+    while (!screen.quit_requested()) {
+      if (screen.wait(interval_ms) == 'q') {
+        break;
+      }
+      if (!sampler.read_stat(current) || !sampler.read_meminfo(memory) ||
+          !processes.sample(usage)) {
+        ok = false;
+        break;
+      }
+
+      const int width = screen.width();
+      screen.clear();
+      time_t now = time(nullptr);
+      char clock[32];
+      strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&now));
+      std::string title = std::string(" ") + hostname + "  " + clock +
+                          "  every " + std::to_string(interval_ms) +
+                          " ms  (q to quit)";
+      title.resize(std::max<size_t>(title.size(), width), ' ');
+      screen.print(0, 0, title, term::Style::INVERSE);
+
+      int row = 2;
+      screen.print(row++, 0, "CPU", term::Style::BOLD);
+      row = DrawMeter(screen, row, 1, width, "all",
+                      procfs::busy_percent(previous.total, current.total),
+                      Format("%.0f running, %.0f blocked",
+                             static_cast<double>(current.procs_running),
+                             static_cast<double>(current.procs_blocked)));
+      size_t cpus = std::min(previous.cpus.size(), current.cpus.size());
+      int columns = std::max(1, width / CORE_COLUMN);
+      for (size_t cpu = 0; cpu < cpus; cpu++) {
+        double busy =
+            procfs::busy_percent(previous.cpus[cpu], current.cpus[cpu]);
+        int r = row + static_cast<int>(cpu) / columns;
+        int c = 1 + static_cast<int>(cpu) % columns * CORE_COLUMN;
+        screen.print(r, c, "cpu" + std::to_string(cpu));
+        screen.bar(r, c + 7, CORE_COLUMN - 16, busy / 100, LevelStyle(busy));
+        screen.print(r, c + CORE_COLUMN - 8, Format("%5.1f%%", busy),
+                     LevelStyle(busy));
+      }
+      row += static_cast<int>((cpus + columns - 1) / columns) + 1;
+
+      const double GIB = 1024.0 * 1024.0; // meminfo is in kB
+      screen.print(row++, 0, "Memory", term::Style::BOLD);
+      if (memory.total > 0) {
+        double used = static_cast<double>(memory.total - memory.available);
+        row = DrawMeter(screen, row, 1, width, "ram",
+                        100 * used / static_cast<double>(memory.total),
+                        Format("%.1f of %.1f GiB, %.1f GiB cached",
+                               used / GIB, memory.total / GIB,
+                               memory.cached / GIB));
+      }
+      if (memory.swap_total > 0) {
+        double used = static_cast<double>(memory.swap_total - memory.swap_free);
+        row = DrawMeter(screen, row, 1, width, "swap",
+                        100 * used / static_cast<double>(memory.swap_total),
+                        Format("%.1f of %.1f GiB", used / GIB,
+                               memory.swap_total / GIB));
+      }
+      row++;
+
+      screen.print(row++, 0, "Disk", term::Style::BOLD);
+      for (const std::string &mount : mounts) {
+        struct statvfs fs;
+        if (statvfs(mount.c_str(), &fs) != 0 || fs.f_blocks == 0) {
+          screen.print(row++, 1, mount + ": unavailable", term::Style::BAD);
+          continue;
+        }
+        double block = static_cast<double>(fs.f_frsize);
+        double total = fs.f_blocks * block;
+        double used = (fs.f_blocks - fs.f_bfree) * block;
+        row = DrawMeter(screen, row, 1, width, mount, 100 * used / total,
+                        Format("%.1f of %.1f GB", used / 1e9, total / 1e9));
+      }
+      row++;
+
+      // Whatever height is left goes to the process list
+      int rows_left = screen.height() - row - 1;
+      if (rows_left > 0) {
+        size_t count =
+            std::min(usage.size(), static_cast<size_t>(rows_left));
+        std::partial_sort(
+            usage.begin(), usage.begin() + count, usage.end(),
+            [](const procfs::ProcessUsage &a, const procfs::ProcessUsage &b) {
+              return a.cpu_percent > b.cpu_percent;
+            });
+        screen.print(row++, 0, "    PID S   CPU%     RSS MB  COMMAND",
+                     term::Style::BOLD);
+        for (size_t i = 0; i < count; i++) {
+          const procfs::ProcessUsage &p = usage[i];
+          char line[96];
+          snprintf(line, sizeof(line), "%7d %c %6.1f %10.1f  %s", p.pid,
+                   p.state, p.cpu_percent, p.rss_kb / 1024.0, p.comm);
+          screen.print(row++, 0, line);
+        }
+      }
+      screen.present();
+      std::swap(previous, current);
+    }
+  }
+  if (!ok) {
+    perror("Error: Could not read /proc");
+    return 1;
+  }
+  return 0;
+}
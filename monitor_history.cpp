@@ -0,0 +1,97 @@
+// Build:
+//   g++ -std=c++17 -O2 monitor_history.cpp series_store.cpp -o monitor_history
+//
+// Reads back what cpu_utilization --history and memory_info --history
+// recorded, as CSV:
+//   monitor_history cpu.ring                     list the series
+//   monitor_history cpu.ring cpu.busy --tier 1m --last 86400
+#include "series_store.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+void print_usage(const char *program) {
+  cerr << "Usage: " << program << " <file> [<series> [options]]\n"
+       << "  --tier <t>        raw, 1s, 1m or 1h (default 1s)\n"
+       << "  --last <seconds>  how far back to go (default 3600)\n"
+       << "  --from <ms>       start of the range, in ms since the epoch\n"
+       << "  --to <ms>         end of the range (default now)" << endl;
+}
+
+bool parse_tier(const char *name, history::Tier &tier) {
+  const char *NAMES[] = {"raw", "1s", "1m", "1h"};
+  for (size_t i = 0; i < history::TIER_COUNT; i++) {
+    if (strcmp(name, NAMES[i]) == 0) {
+      tier = static_cast<history::Tier>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  history::Store store;
+  if (!store.open_read_only(argv[1])) {
+    return 1;
+  }
+  if (argc == 2) {
+    for (size_t i = 0; i < store.series_count(); i++) {
+      cout << store.series_name(i) << endl;
+    }
+    return 0;
+  }
+
+  int series = store.find_series(argv[2]);
+  if (series < 0) {
+    cerr << "Error: No series '" << argv[2] << "' in " << argv[1] << endl;
+    return 1;
+  }
+  history::Tier tier = history::Tier::SECOND;
+  int64_t to_ms = history::now_ms();
+  int64_t from_ms = -1;
+  int64_t last_seconds = 3600;
+  for (int arg = 3; arg < argc; arg++) {
+    if (arg + 1 >= argc) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    std::string option = argv[arg];
+    const char *value = argv[++arg];
+    if (option == "--tier" && parse_tier(value, tier)) {
+      continue;
+    } else if (option == "--last") {
+      last_seconds = std::atoll(value);
+    } else if (option == "--from") {
+      from_ms = std::atoll(value);
+    } else if (option == "--to") {
+      to_ms = std::atoll(value);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (from_ms < 0) {
+    from_ms = to_ms - last_seconds * 1000;
+  }
+
+  std::vector<history::Point> points;
+  store.query(static_cast<size_t>(series), tier, from_ms, to_ms, points);
+  cout.precision(12);
+  cout << "time_ms,min,avg,max\n";
+  for (const history::Point &point : points) {
+    cout << point.time_ms << ',' << point.min << ',' << point.avg << ','
+         << point.max << '\n';
+  }
+  cout << std::flush;
+  return 0;
+}
@@ -0,0 +1,218 @@
+#include "net_core.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+namespace net {
+
+namespace {
+
+// Returns >0 when ready, 0 on timeout, -1 on error.
+int wait_for(int fd, short events, int timeout_ms) {
+  pollfd pfd{fd, events, 0};
+  while (true) {
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    return ready;
+  }
+}
+
+std::string format_peer(const sockaddr_in &addr) {
+  char ip[INET_ADDRSTRLEN] = "?";
+  inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+  return std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+} // namespace
+
+Connection::Connection(int fd, std::string peer,
+                       std::atomic<size_t> *active_counter)
+    : m_fd(fd), m_peer(std::move(peer)), m_active_counter(active_counter) {}
+
+Connection::~Connection() {
+  close(m_fd);
+  if (m_active_counter)
+    m_active_counter->fetch_sub(1);
+}
+
+ssize_t Connection::read(char *buffer, size_t size, int timeout_ms) {
+  while (true) {
+    ssize_t n = recv(m_fd, buffer, size, 0);
+    if (n >= 0)
+      return n;
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return -1;
+
+    int ready = wait_for(m_fd, POLLIN, timeout_ms);
+    if (ready == 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    if (ready < 0)
+      return -1;
+  }
+}
+
+ssize_t Connection::write_some(std::string_view data, int timeout_ms) {
+  while (true) {
+    ssize_t n = send(m_fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n >= 0)
+      return n;
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return -1;
+
+    int ready = wait_for(m_fd, POLLOUT, timeout_ms);
+    if (ready == 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    if (ready < 0)
+      return -1;
+  }
+}
+
+bool Connection::write_all(std::string_view data, int timeout_ms) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n =
+        send(m_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      return false;
+
+    int ready = wait_for(m_fd, POLLOUT, timeout_ms);
+    if (ready == 0)
+      errno = ETIMEDOUT;
+    if (ready <= 0)
+      return false;
+  }
+  return true;
+}
+
+void Connection::shutdown() { ::shutdown(m_fd, SHUT_RDWR); }
+
+Acceptor::Acceptor(const ListenerOptions &options) : m_options(options) {}
+
+Acceptor::~Acceptor() {
+  if (m_listen_fd >= 0)
+    close(m_listen_fd);
+}
+
+bool Acceptor::open() {
+  m_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (m_listen_fd == -1) {
+    perror("Socket creation Failed");
+    return false;
+  }
+
+  int opt = 1;
+  if (m_options.reuse_address &&
+      setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) <
+          0) {
+    perror("setsockopt SO_REUSEADDR failed");
+  }
+  if (m_options.reuse_port &&
+      setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) <
+          0) {
+    perror("setsockopt SO_REUSEPORT failed");
+  }
+
+  sockaddr_in server_addr{};
+  server_addr.sin_addr.s_addr = INADDR_ANY;
+  server_addr.sin_port = htons(m_options.port);
+  server_addr.sin_family = AF_INET;
+
+  if (bind(m_listen_fd, reinterpret_cast<sockaddr *>(&server_addr),
+           sizeof(server_addr)) < 0) {
+    perror("Bind Failed");
+    close(m_listen_fd);
+    m_listen_fd = -1;
+    return false;
+  }
+
+  if (listen(m_listen_fd, m_options.backlog) < 0) {
+    perror("Listening Failed!");
+    close(m_listen_fd);
+    m_listen_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void Acceptor::configure_client_socket(int fd) const {
+  int opt = 1;
+  if (m_options.no_delay)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  if (m_options.keepalive) {
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,
+               &m_options.keepalive_idle_seconds, sizeof(int));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+               &m_options.keepalive_interval_seconds, sizeof(int));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &m_options.keepalive_probes,
+               sizeof(int));
+  }
+}
+
+std::unique_ptr<Connection> Acceptor::accept() {
+  int flags = SOCK_CLOEXEC | (m_options.non_blocking ? SOCK_NONBLOCK : 0);
+
+  while (true) {
+    sockaddr_in client_addr{};
+    socklen_t client_addr_len = sizeof(client_addr);
+    int client_fd =
+        accept4(m_listen_fd, reinterpret_cast<sockaddr *>(&client_addr),
+                &client_addr_len, flags);
+    if (client_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+          errno == ENOMEM) {
+        // Out of descriptors or memory: back off briefly instead of
+        // spinning, the pending connections stay in the backlog.
+        perror("Client acception failed.");
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      perror("Client acception failed.");
+      if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK)
+        return nullptr;
+      continue;
+    }
+
+    if (m_options.max_connections > 0 &&
+        m_active.load() >= m_options.max_connections) {
+      // Best effort, the socket is closed whether or not this goes out
+      send(client_fd, m_options.reject_message.data(),
+           m_options.reject_message.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+      close(client_fd);
+      m_rejected++;
+      continue;
+    }
+
+    configure_client_socket(client_fd);
+    m_active++;
+    m_accepted++;
+    return std::make_unique<Connection>(client_fd, format_peer(client_addr),
+                                        &m_active);
+  }
+}
+
+} // namespace net
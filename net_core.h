@@ -0,0 +1,103 @@
+#ifndef NET_CORE_H
+#define NET_CORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// Listening socket and per-client connection shared by tcp_server and
+// command_server.
+namespace net {
+
+struct ListenerOptions {
+  int port = 6380;
+  // The kernel caps this at net.core.somaxconn; 5 was far too small for a
+  // burst of connects and made the SYN queue drop clients.
+  int backlog = SOMAXCONN;
+  bool reuse_address = true;
+  // Lets several processes bind the same port and share the accept load.
+  bool reuse_port = false;
+  bool no_delay = true;
+  bool keepalive = true;
+  int keepalive_idle_seconds = 60;
+  int keepalive_interval_seconds = 10;
+  int keepalive_probes = 3;
+  // Accepted sockets are non-blocking; Connection waits with poll() so that
+  // reads and writes can time out.
+  bool non_blocking = true;
+  // 0 means unlimited. Clients over the limit get `reject_message` and are
+  // closed right away instead of queueing in the backlog.
+  size_t max_connections = 0;
+  std::string reject_message = "-ERR max number of clients reached\r\n";
+};
+
+class Connection {
+public:
+  Connection(int fd, std::string peer, std::atomic<size_t> *active_counter);
+  ~Connection();
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  int fd() const { return m_fd; }
+  const std::string &peer() const { return m_peer; }
+
+  // Waits up to `timeout_ms` (-1 = forever) for data. Returns the number of
+  // bytes read, 0 when the peer closed, -1 on error with errno set
+  // (ETIMEDOUT on timeout).
+  ssize_t read(char *buffer, size_t size, int timeout_ms = -1);
+
+  // Writes as much of `data` as the socket takes, waiting up to
+  // `timeout_ms` for it to become writable. Returns the number of bytes
+  // written, or -1 with errno set (ETIMEDOUT on timeout).
+  ssize_t write_some(std::string_view data, int timeout_ms = -1);
+
+  // Writes all of `data`, waiting for the socket to drain for at most
+  // `timeout_ms` without progress. Returns false on error or timeout.
+  bool write_all(std::string_view data, int timeout_ms = -1);
+
+  // Wakes up a thread blocked in read()/write_all() on this connection.
+  void shutdown();
+
+private:
+  int m_fd;
+  std::string m_peer;
+  std::atomic<size_t> *m_active_counter;
+};
+
+class Acceptor {
+public:
+  explicit Acceptor(const ListenerOptions &options);
+  ~Acceptor();
+  Acceptor(const Acceptor &) = delete;
+  Acceptor &operator=(const Acceptor &) = delete;
+
+  // socket + setsockopt + bind + listen; prints the failing step and
+  // returns false on error.
+  bool open();
+
+  // Blocks until a client within the connection limit arrives. Returns
+  // nullptr only if the listening socket is unusable.
+  std::unique_ptr<Connection> accept();
+
+  size_t active_connections() const { return m_active.load(); }
+  uint64_t accepted_connections() const { return m_accepted.load(); }
+  uint64_t rejected_connections() const { return m_rejected.load(); }
+  const ListenerOptions &options() const { return m_options; }
+
+private:
+  void configure_client_socket(int fd) const;
+
+  ListenerOptions m_options;
+  int m_listen_fd = -1;
+  std::atomic<size_t> m_active{0};
+  std::atomic<uint64_t> m_accepted{0};
+  std::atomic<uint64_t> m_rejected{0};
+};
+
+} // namespace net
+#endif // !NET_CORE_H
@@ -0,0 +1,257 @@
+// Build:
+//   g++ -std=c++17 -O2 net_monitor.cpp proc_sampler.cpp term_render.cpp
+//       instrument.cpp -o net_monitor
+//
+// Usage: net_monitor [--watch] [--port <port>] [interval_ms]   (default 1000)
+//   Prints, measured over one interval, the traffic of every network
+//   interface and the rate of TCP retransmits, listen queue overflows and
+//   SYN drops, plus the state of the listener on <port> (default 6380, the
+//   command_server's).
+//   --watch  keep sampling and redraw in place, until q or Ctrl-C
+#include "instrument.h"
+#include "proc_sampler.h"
+#include "term_render.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int DEFAULT_PORT = 6380;
+const double MIB = 1024.0 * 1024.0;
+
+// From /proc/net/tcp and tcp6
+const uint64_t TCP_ESTABLISHED = 0x01;
+const uint64_t TCP_LISTEN = 0x0A;
+
+struct PortState {
+  bool listening = false;
+  uint64_t accept_queue = 0; // Connections waiting for accept()
+  size_t established = 0;
+};
+
+uint64_t ParseHex(std::string_view text) {
+  uint64_t value = 0;
+  for (char c : text) {
+    int digit = c >= '0' && c <= '9'   ? c - '0'
+                : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                       : -1;
+    if (digit < 0) {
+      break;
+    }
+    value = value * 16 + static_cast<uint64_t>(digit);
+  }
+  return value;
+}
+
+// Adds up the sockets on `port` in /proc/net/tcp or tcp6. Returns false if
+// the file can't be read.
+bool ScanSockets(procfs::ProcFile &file, int port, PortState &state) {
+  std::string_view text;
+  if (!file.is_open() || !file.read(text)) {
+    return false;
+  }
+  procfs::Scanner scanner(text);
+  scanner.next_line(); // Headings
+  for (; !scanner.at_end(); scanner.next_line()) {
+    // "sl local_address rem_address st tx_queue:rx_queue ..."
+    scanner.skip_words(1);
+    std::string_view local = scanner.next_word();
+    scanner.skip_words(1);
+    uint64_t socket_state = ParseHex(scanner.next_word());
+    std::string_view queues = scanner.next_word();
+    size_t colon = local.rfind(':');
+    if (colon == std::string_view::npos ||
+        ParseHex(local.substr(colon + 1)) != static_cast<uint64_t>(port)) {
+      continue;
+    }
+    if (socket_state == TCP_LISTEN) {
+      // For a listener rx_queue is the accept queue
+      state.listening = true;
+      size_t rx_queue = std::min(queues.size(), queues.find(':') + 1);
+      state.accept_queue += ParseHex(queues.substr(rx_queue));
+    } else if (socket_state == TCP_ESTABLISHED) {
+      state.established++;
+    }
+  }
+  return true;
+}
+
+void PrintInterfaces(std::ostream &out,
+                     const std::vector<procfs::NetDevice> &before,
+                     const std::vector<procfs::NetDevice> &after,
+                     double seconds) {
+  out << "INTERFACE   rx MB/s  tx MB/s  rx pkt/s  tx pkt/s  errors/s"
+         "  drops/s\n";
+  for (const procfs::NetDevice &device : after) {
+    auto previous = std::find_if(
+        before.begin(), before.end(), [&](const procfs::NetDevice &other) {
+          return strcmp(other.name, device.name) == 0;
+        });
+    if (previous == before.end()) {
+      continue; // Came up since the last sample
+    }
+    // Counters restart when an interface is recreated
+    auto rate = [seconds](uint64_t a, uint64_t b) {
+      return b >= a ? static_cast<double>(b - a) / seconds : 0.0;
+    };
+    double errors = rate(previous->rx_errors, device.rx_errors) +
+                    rate(previous->tx_errors, device.tx_errors);
+    double drops = rate(previous->rx_drops, device.rx_drops) +
+                   rate(previous->tx_drops, device.tx_drops);
+    out << std::left << std::setw(10) << device.name << std::right
+        << std::setw(9) << rate(previous->rx_bytes, device.rx_bytes) / MIB
+        << std::setw(9) << rate(previous->tx_bytes, device.tx_bytes) / MIB
+        << std::setw(10) << rate(previous->rx_packets, device.rx_packets)
+        << std::setw(10) << rate(previous->tx_packets, device.tx_packets)
+        << std::setw(10) << errors << std::setw(9) << drops << '\n';
+  }
+}
+
+void PrintTcp(std::ostream &out, const procfs::TcpStats &before,
+              const procfs::TcpStats &after, double seconds) {
+  auto rate = [seconds](uint64_t a, uint64_t b) {
+    return b >= a ? static_cast<double>(b - a) / seconds : 0.0;
+  };
+  double out_segments = rate(before.out_segments, after.out_segments);
+  double retransmits =
+      rate(before.retransmitted_segments, after.retransmitted_segments);
+  out << "\nTCP per second:\n"
+      << "  Segments in / out       : "
+      << rate(before.in_segments, after.in_segments) << " / " << out_segments
+      << '\n'
+      << "  Retransmitted segments  : " << retransmits;
+  if (out_segments > 0) {
+    out << "  (" << 100 * retransmits / out_segments << "% of those sent)";
+  }
+  out << '\n'
+      << "  Opens active / passive  : "
+      << rate(before.active_opens, after.active_opens) << " / "
+      << rate(before.passive_opens, after.passive_opens) << '\n'
+      << "  Failed connects         : "
+      << rate(before.attempt_fails, after.attempt_fails) << '\n'
+      << "  Resets sent             : "
+      << rate(before.out_resets, after.out_resets) << '\n'
+      << "  Timeouts                : " << rate(before.timeouts, after.timeouts)
+      << '\n'
+      << "  Listen queue overflows  : "
+      << rate(before.listen_overflows, after.listen_overflows) << '\n'
+      << "  SYNs dropped, all       : "
+      << rate(before.listen_drops, after.listen_drops) << '\n'
+      << "  SYNs dropped, queue full: "
+      << rate(before.syn_queue_drops, after.syn_queue_drops) << '\n'
+      << "  Syncookies sent         : "
+      << rate(before.syncookies_sent, after.syncookies_sent) << '\n'
+      << "  Established now         : " << after.current_established << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  INSTRUMENT_INSTALL(argv[0], false);
+  int interval_ms = 1000;
+  int port = DEFAULT_PORT;
+  bool watch = false;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "--watch") == 0) {
+      watch = true;
+    } else if (strcmp(argv[arg], "--port") == 0 && arg + 1 < argc) {
+      port = std::atoi(argv[++arg]);
+    } else if (argv[arg][0] != '-') {
+      interval_ms = std::max(1, std::atoi(argv[arg]));
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--watch] [--port <port>] [interval_ms]" << std::endl;
+      return 1;
+    }
+  }
+
+  // Every file stays open and both samples are reused, swapped in turn
+  procfs::Sampler sampler;
+  std::vector<procfs::NetDevice> previous_devices, devices;
+  procfs::TcpStats previous_tcp, tcp;
+  if (!sampler.read_net_dev(previous_devices) ||
+      !sampler.read_tcp_stats(previous_tcp)) {
+    perror("Error: Could not read /proc/net");
+    return 1;
+  }
+  procfs::ProcFile tcp4_sockets, tcp6_sockets;
+  tcp4_sockets.open("/proc/net/tcp");
+  tcp6_sockets.open("/proc/net/tcp6");
+  auto last_sample = std::chrono::steady_clock::now();
+
+  std::ostringstream frame;
+  frame << std::fixed << std::setprecision(1);
+  auto sample = [&]() {
+    if (!sampler.read_net_dev(devices) || !sampler.read_tcp_stats(tcp)) {
+      return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double seconds =
+        std::chrono::duration<double>(now - last_sample).count();
+    last_sample = now;
+
+    frame.str("");
+    PrintInterfaces(frame, previous_devices, devices, seconds);
+    PrintTcp(frame, previous_tcp, tcp, seconds);
+    PortState state;
+    bool scanned = ScanSockets(tcp4_sockets, port, state);
+    scanned = ScanSockets(tcp6_sockets, port, state) || scanned;
+    frame << "\nPort " << port << ": ";
+    if (!scanned) {
+      frame << "unknown, /proc/net/tcp is unreadable\n";
+    } else if (state.listening) {
+      frame << "listening, " << state.accept_queue
+            << " waiting for accept, " << state.established
+            << " established\n";
+    } else {
+      frame << "not listening, " << state.established << " established\n";
+    }
+    std::swap(previous_devices, devices);
+    std::swap(previous_tcp, tcp);
+    return true;
+  };
+
+  if (!watch) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    if (!sample()) {
+      perror("Error: Could not read /proc/net");
+      return 1;
+    }
+    std::cout << frame.str();
+    return 0;
+  }
+
+  bool ok = true;
+  {
+    term::Screen screen;
+    while (!screen.quit_requested()) {
+      if (screen.wait(interval_ms) == 'q') {
+        break;
+      }
+      if (!sample()) {
+        ok = false;
+        break;
+      }
+      screen.clear();
+      screen.print_lines(0, 0, frame.str());
+      screen.present();
+    }
+  }
+  if (!ok) {
+    perror("Error: Could not read /proc/net");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include "notify_dispatch.h"
+#include "instrument.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace notify {
+
+namespace {
+
+// Between SIGTERM and SIGKILL for a helper that timed out
+const std::chrono::seconds KILL_GRACE(1);
+
+void replace_all(std::string &text, const std::string &from,
+                 const std::string &to) {
+  for (size_t pos = text.find(from); pos != std::string::npos;
+       pos = text.find(from, pos + to.size()))
+    text.replace(pos, from.size(), to);
+}
+
+} // namespace
+
+Dispatcher::Dispatcher(ErrorHandler on_error)
+    : m_on_error(std::move(on_error)) {}
+
+Dispatcher::~Dispatcher() {
+  if (m_signal_fd >= 0)
+    close(m_signal_fd);
+}
+
+bool Dispatcher::open() {
+  // Blocked, SIGCHLD is only seen through the signalfd. It mustn't be
+  // ignored instead, that would have the kernel reap the helpers itself.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &signals, nullptr) < 0)
+    return false;
+  m_signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  return m_signal_fd >= 0;
+}
+
+size_t Dispatcher::add_sink(Sink sink) {
+  sink.max_running = std::max(sink.max_running, 1u);
+  sink.max_queued = std::max<size_t>(sink.max_queued, 1);
+  m_sinks.push_back(SinkState{std::move(sink), {}, 0, 0, {}, false});
+  return m_sinks.size() - 1;
+}
+
+void Dispatcher::post(const std::string &message) {
+  for (SinkState &state : m_sinks) {
+    if (state.queued.size() == state.sink.max_queued) {
+      state.queued.pop_front();
+      state.dropped++;
+    }
+    state.queued.push_back(message);
+  }
+}
+
+bool Dispatcher::ready(const SinkState &state, Clock::time_point now) const {
+  return !state.queued.empty() && state.running < state.sink.max_running &&
+         (!state.started || now >= state.last_start + state.sink.min_interval);
+}
+
+int Dispatcher::timeout() const {
+  Clock::time_point now = Clock::now();
+  Clock::time_point next = Clock::time_point::max();
+  for (const Helper &helper : m_helpers)
+    next = std::min(next, helper.deadline);
+  for (const SinkState &state : m_sinks) {
+    // A sink at its limit of helpers waits for one to exit, on fd()
+    if (state.queued.empty() || state.running >= state.sink.max_running)
+      continue;
+    next = std::min(next, state.started
+                              ? state.last_start + state.sink.min_interval
+                              : now);
+  }
+  if (next == Clock::time_point::max())
+    return -1;
+  if (next <= now)
+    return 0;
+  auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - now);
+  return static_cast<int>(std::min<int64_t>(wait.count(), INT_MAX));
+}
+
+void Dispatcher::dispatch() {
+  signalfd_siginfo info;
+  while (m_signal_fd >= 0 &&
+         read(m_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+  }
+  Clock::time_point now = Clock::now();
+  reap(now);
+  for (size_t sink = 0; sink < m_sinks.size(); sink++) {
+    if (ready(m_sinks[sink], now))
+      start(sink, now);
+  }
+}
+
+void Dispatcher::reap(Clock::time_point now) {
+  // SIGCHLDs merge, so every helper is asked rather than one per signal
+  for (size_t i = 0; i < m_helpers.size();) {
+    Helper &helper = m_helpers[i];
+    SinkState &state = m_sinks[helper.sink];
+    int status = 0;
+    pid_t result = waitpid(helper.pid, &status, WNOHANG);
+    if (result == helper.pid || (result < 0 && errno == ECHILD)) {
+      if (result == helper.pid && !helper.terminated && WIFEXITED(status) &&
+          WEXITSTATUS(status) != 0)
+        report(state.sink.name + ": " + state.sink.command[0] +
+               " exited with status " + std::to_string(WEXITSTATUS(status)));
+      state.running--;
+      helper = m_helpers.back();
+      m_helpers.pop_back();
+      continue;
+    }
+    if (now >= helper.deadline) {
+      // The helper leads its own process group, which goes with it
+      if (!helper.terminated) {
+        report(state.sink.name + ": " + state.sink.command[0] +
+               " timed out, terminating it");
+        kill(-helper.pid, SIGTERM);
+        helper.terminated = true;
+        helper.deadline = now + KILL_GRACE;
+      } else {
+        kill(-helper.pid, SIGKILL);
+        helper.deadline = Clock::time_point::max();
+      }
+    }
+    i++;
+  }
+}
+
+void Dispatcher::start(size_t sink, Clock::time_point now) {
+  INSTRUMENT_SCOPE("notify.start");
+  SinkState &state = m_sinks[sink];
+  std::string message;
+  if (state.queued.size() == 1 && state.dropped == 0) {
+    message = state.queued.front();
+  } else {
+    message = std::to_string(state.queued.size() + state.dropped) + " alerts:";
+    for (const std::string &queued : state.queued)
+      message += "\n" + queued;
+    if (state.dropped > 0)
+      message += "\n(and " + std::to_string(state.dropped) + " more)";
+  }
+  state.queued.clear();
+  state.dropped = 0;
+  // A helper that can't be started is rate limited all the same, rather
+  // than retried on every dispatch
+  state.last_start = now;
+  state.started = true;
+
+  std::vector<std::string> args = state.sink.command;
+  for (std::string &arg : args)
+    replace_all(arg, "{message}", message);
+  std::vector<char *> argv;
+  for (std::string &arg : args)
+    argv.push_back(arg.data());
+  argv.push_back(nullptr);
+
+  // The helper starts with the signals we block or ignore back to normal,
+  // in a process group of its own, reading nothing
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+  sigaddset(&signals, SIGPIPE);
+  sigaddset(&signals, SIGCHLD);
+  posix_spawnattr_setsigdefault(&attributes, &signals);
+  posix_spawnattr_setpgroup(&attributes, 0);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK |
+                                            POSIX_SPAWN_SETSIGDEF |
+                                            POSIX_SPAWN_SETPGROUP);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+
+  pid_t pid = 0;
+  int error = argv[0] == nullptr
+                  ? EINVAL
+                  : posix_spawnp(&pid, argv[0], &actions, &attributes,
+                                 argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  if (error != 0) {
+    report(state.sink.name + ": Could not run " +
+           (args.empty() ? std::string("nothing") : args[0]) + ": " +
+           strerror(error));
+    return;
+  }
+  m_helpers.push_back(Helper{pid, sink, now + state.sink.timeout, false});
+  state.running++;
+}
+
+void Dispatcher::report(const std::string &message) const {
+  if (m_on_error)
+    m_on_error(message);
+}
+
+} // namespace notify
@@ -0,0 +1,95 @@
+#ifndef NOTIFY_DISPATCH_H
+#define NOTIFY_DISPATCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Desktop alerts for a daemon that mustn't wait on them. Alerts are queued
+// per sink (notify-send, kdialog, paplay, ...) and the helper programs are
+// started with posix_spawn, without a shell, and reaped once they exit. A
+// sink runs a limited number of helpers at a time, no more often than its
+// rate limit, and a helper that overstays its timeout is killed. Whatever
+// queues up meanwhile, such as a burst of timers expiring together, goes
+// out merged into one alert.
+//
+//   poll {dispatcher.fd(), POLLIN} with dispatcher.timeout()
+//   dispatcher.dispatch()
+namespace notify {
+
+struct Sink {
+  std::string name; // For error messages
+  // The helper's argv; "{message}" in an argument is replaced by the alert
+  std::vector<std::string> command;
+  // Between the starts of two helpers
+  std::chrono::milliseconds min_interval{1000};
+  // After this a helper gets SIGTERM, and SIGKILL a second later
+  std::chrono::milliseconds timeout{10000};
+  unsigned max_running = 1;
+  // Beyond this the oldest queued alerts are dropped, and counted
+  size_t max_queued = 20;
+};
+
+class Dispatcher {
+public:
+  using Clock = std::chrono::steady_clock;
+  using ErrorHandler = std::function<void(const std::string &)>;
+
+  // Failures to start a helper, helpers failing and timing out are reported
+  // to `on_error`.
+  explicit Dispatcher(ErrorHandler on_error = {});
+  // Helpers still running are left to finish on their own.
+  ~Dispatcher();
+  Dispatcher(const Dispatcher &) = delete;
+  Dispatcher &operator=(const Dispatcher &) = delete;
+
+  // Blocks SIGCHLD for a signalfd to report helpers exiting. Returns false
+  // with errno set. Call it before starting any threads.
+  bool open();
+  int fd() const { return m_signal_fd; }
+  size_t add_sink(Sink sink);
+
+  // Queues the alert for every sink. Nothing is started before dispatch().
+  void post(const std::string &message);
+  // Milliseconds until dispatch() has something to do, -1 for nothing but
+  // fd() becoming readable.
+  int timeout() const;
+  // Reaps helpers that exited, terminates overdue ones and starts the
+  // helpers the sinks may run now.
+  void dispatch();
+  size_t running() const { return m_helpers.size(); }
+
+private:
+  struct SinkState {
+    Sink sink;
+    std::deque<std::string> queued;
+    size_t dropped = 0;
+    unsigned running = 0;
+    Clock::time_point last_start;
+    bool started = false;
+  };
+
+  struct Helper {
+    pid_t pid = 0;
+    size_t sink = 0;
+    Clock::time_point deadline;
+    bool terminated = false; // SIGTERM was sent
+  };
+
+  void reap(Clock::time_point now);
+  bool ready(const SinkState &state, Clock::time_point now) const;
+  void start(size_t sink, Clock::time_point now);
+  void report(const std::string &message) const;
+
+  ErrorHandler m_on_error;
+  int m_signal_fd = -1;
+  std::vector<SinkState> m_sinks;
+  std::vector<Helper> m_helpers;
+};
+
+} // namespace notify
+#endif // !NOTIFY_DISPATCH_H
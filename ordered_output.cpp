@@ -0,0 +1,140 @@
+#include "ordered_output.h"
+#include "instrument.h"
+#include <cerrno>
+#include <unistd.h>
+
+namespace output {
+
+BufferedWriter::BufferedWriter(int fd, size_t capacity)
+    : m_fd(fd), m_capacity(capacity) {
+  m_buffer.reserve(capacity);
+}
+
+BufferedWriter::~BufferedWriter() { flush(); }
+
+void BufferedWriter::write(std::string_view data) {
+  if (m_buffer.size() + data.size() > m_capacity) {
+    flush();
+  }
+  if (data.size() >= m_capacity) {
+    // Too big to be worth copying
+    m_buffer.assign(data);
+    flush();
+    return;
+  }
+  m_buffer.append(data);
+}
+
+void BufferedWriter::flush() {
+  size_t written = 0;
+  while (written < m_buffer.size()) {
+    ssize_t n = ::write(m_fd, m_buffer.data() + written,
+                        m_buffer.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break; // stdout closed, e.g. piped into head; nothing sensible to do
+    written += static_cast<size_t>(n);
+  }
+  m_buffer.clear();
+}
+
+struct OrderedOutput::Node {
+  bool is_directory = false;
+  bool running = false;
+  bool listed = false; // Directories: children are known
+  bool done = false;   // Files: all output written
+  std::string buffer;
+  std::vector<std::unique_ptr<Node>> children;
+};
+
+OrderedOutput::OrderedOutput(BufferedWriter &writer,
+                             size_t max_buffered_per_file)
+    : m_writer(writer), m_max_buffered(max_buffered_per_file),
+      m_root(std::make_unique<Node>()) {
+  m_root->is_directory = true;
+  m_root->running = true;
+  m_cursor.push_back({m_root.get(), 0});
+  m_blocking = m_root.get();
+}
+
+OrderedOutput::~OrderedOutput() = default;
+
+std::vector<OrderedOutput::Node *>
+OrderedOutput::set_children(Node *dir, const std::vector<bool> &is_directory) {
+  std::vector<Node *> nodes;
+  INSTRUMENT_LOCK(lock, m_mutex, "lock.output");
+  for (bool child_is_directory : is_directory) {
+    dir->children.push_back(std::make_unique<Node>());
+    dir->children.back()->is_directory = child_is_directory;
+    nodes.push_back(dir->children.back().get());
+  }
+  dir->listed = true;
+  advance();
+  m_turn_changed.notify_all();
+  return nodes;
+}
+
+void OrderedOutput::begin(Node *node) {
+  INSTRUMENT_LOCK(lock, m_mutex, "lock.output");
+  node->running = true;
+}
+
+void OrderedOutput::write(Node *file, std::string_view data) {
+  INSTRUMENT_LOCK(lock, m_mutex, "lock.output");
+  if (file == m_blocking) {
+    m_writer.write(data);
+    return;
+  }
+  file->buffer.append(data);
+  INSTRUMENT_SCOPE("output.wait_turn");
+  m_turn_changed.wait(lock, [&] {
+    return file->buffer.size() <= m_max_buffered || m_blocking == nullptr ||
+           !m_blocking->running;
+  });
+}
+
+void OrderedOutput::finish(Node *file) {
+  INSTRUMENT_LOCK(lock, m_mutex, "lock.output");
+  file->done = true;
+  if (file == m_blocking) {
+    advance();
+    m_turn_changed.notify_all();
+  }
+}
+
+void OrderedOutput::advance() {
+  while (!m_cursor.empty()) {
+    Frame &frame = m_cursor.back();
+    Node *dir = frame.dir;
+    if (!dir->listed) {
+      m_blocking = dir;
+      return;
+    }
+    if (frame.next_child == dir->children.size()) {
+      dir->children.clear(); // Everything below is printed
+      m_cursor.pop_back();
+      continue;
+    }
+
+    Node *child = dir->children[frame.next_child].get();
+    if (child->is_directory) {
+      frame.next_child++;
+      m_cursor.push_back({child, 0});
+      continue;
+    }
+    if (!child->buffer.empty()) {
+      m_writer.write(child->buffer);
+      std::string().swap(child->buffer);
+    }
+    if (!child->done) {
+      // Its output goes straight to the writer from now on
+      m_blocking = child;
+      return;
+    }
+    frame.next_child++;
+  }
+  m_blocking = nullptr;
+}
+
+} // namespace output
@@ -0,0 +1,83 @@
+#ifndef ORDERED_OUTPUT_H
+#define ORDERED_OUTPUT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Streaming output for file_searcher that comes out in the same order no
+// matter how the parallel walk and search interleave: command line order at
+// the top, directory entries sorted by name below it.
+namespace output {
+
+// Collects small writes and hands them to write(2) in large blocks.
+class BufferedWriter {
+public:
+  explicit BufferedWriter(int fd, size_t capacity = 64 * 1024);
+  ~BufferedWriter();
+  BufferedWriter(const BufferedWriter &) = delete;
+  BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+  void write(std::string_view data);
+  void flush();
+
+private:
+  int m_fd;
+  size_t m_capacity;
+  std::string m_buffer;
+};
+
+// Mirrors the tree being searched. Every directory and file task owns a node;
+// output written for a file goes straight to the writer while that file is
+// the first one not printed yet, and is buffered in its node otherwise. Once
+// a file's buffer passes the limit its writer waits for its turn, as long as
+// the file holding up the output is actively being worked on (so waiting
+// can't deadlock the pool).
+class OrderedOutput {
+public:
+  struct Node;
+
+  OrderedOutput(BufferedWriter &writer, size_t max_buffered_per_file);
+  ~OrderedOutput();
+
+  // The top level, whose children are the paths from the command line.
+  Node *root() { return m_root.get(); }
+
+  // Declares the entries of a listed directory, in output order, and
+  // returns their nodes. Has to be called exactly once per directory node,
+  // with no entries if it couldn't be read.
+  std::vector<Node *> set_children(Node *dir,
+                                   const std::vector<bool> &is_directory);
+
+  // Marks a node as being worked on by a thread.
+  void begin(Node *node);
+  void write(Node *file, std::string_view data);
+  // No more output for this file; its node must not be used afterwards.
+  void finish(Node *file);
+
+private:
+  struct Frame {
+    Node *dir;
+    size_t next_child;
+  };
+
+  void advance();
+
+  BufferedWriter &m_writer;
+  const size_t m_max_buffered;
+  std::unique_ptr<Node> m_root;
+
+  std::mutex m_mutex;
+  std::condition_variable m_turn_changed;
+  // Depth first position of the next output; the node at the top of it that
+  // everything else is waiting for, or nullptr once all is printed
+  std::vector<Frame> m_cursor;
+  Node *m_blocking = nullptr;
+};
+
+} // namespace output
+#endif // !ORDERED_OUTPUT_H
@@ -0,0 +1,134 @@
+#include "pressure.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+
+namespace procfs {
+
+namespace {
+
+const char *pressure_path(Resource resource) {
+  switch (resource) {
+  case Resource::CPU:
+    return "/proc/pressure/cpu";
+  case Resource::MEMORY:
+    return "/proc/pressure/memory";
+  case Resource::IO:
+    return "/proc/pressure/io";
+  }
+  return "";
+}
+
+// "avg10=0.66 avg60=1.44 avg300=1.90 total=103834101"; the averages have
+// two decimals
+double next_average(Scanner &scanner) {
+  std::string_view word = scanner.next_word();
+  word.remove_prefix(std::min(word.size(), word.find('=') + 1));
+  Scanner number(word);
+  double value = static_cast<double>(number.next_u64());
+  std::string_view rest = number.rest_of_line();
+  if (!rest.empty() && rest[0] == '.') {
+    double scale = 0.1;
+    for (size_t i = 1; i < rest.size(); i++, scale /= 10)
+      value += (rest[i] - '0') * scale;
+  }
+  return value;
+}
+
+void read_line(Scanner &scanner, PressureLine &line) {
+  line.avg10 = next_average(scanner);
+  line.avg60 = next_average(scanner);
+  line.avg300 = next_average(scanner);
+  std::string_view total = scanner.next_word();
+  total.remove_prefix(std::min(total.size(), total.find('=') + 1));
+  line.total_us = Scanner(total).next_u64();
+}
+
+} // namespace
+
+const char *resource_name(Resource resource) {
+  switch (resource) {
+  case Resource::CPU:
+    return "cpu";
+  case Resource::MEMORY:
+    return "memory";
+  case Resource::IO:
+    return "io";
+  }
+  return "";
+}
+
+bool parse_pressure(std::string_view text, PressureStats &stats) {
+  Scanner scanner(text);
+  bool have_some = false;
+  for (; !scanner.at_end(); scanner.next_line()) {
+    std::string_view kind = scanner.next_word();
+    if (kind == "some") {
+      read_line(scanner, stats.some);
+      have_some = true;
+    } else if (kind == "full") {
+      read_line(scanner, stats.full);
+    }
+  }
+  return have_some;
+}
+
+PressureWatch::~PressureWatch() {
+  if (m_trigger_fd >= 0)
+    close(m_trigger_fd);
+}
+
+bool PressureWatch::open(Resource resource, uint64_t stall_ms) {
+  const char *path = pressure_path(resource);
+  int fd = ::open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  // Armed for as long as the fd stays open
+  std::string trigger = "some " + std::to_string(stall_ms * 1000) + " " +
+                        std::to_string(WINDOW_MS * 1000);
+  if (write(fd, trigger.c_str(), trigger.size() + 1) < 0 ||
+      !m_file.open(path)) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return false;
+  }
+  if (m_trigger_fd >= 0)
+    close(m_trigger_fd);
+  m_trigger_fd = fd;
+  return true;
+}
+
+int PressureWatch::timeout(int interval_ms) const {
+  return is_sampling() ? interval_ms : -1;
+}
+
+bool PressureWatch::is_sampling() const {
+  return std::chrono::steady_clock::now() < m_sample_until;
+}
+
+bool PressureWatch::should_sample(short revents, bool &error) {
+  error = false;
+  if (revents & (POLLERR | POLLNVAL)) {
+    // The cgroup or the trigger went away
+    error = true;
+    errno = ENODEV;
+    return false;
+  }
+  if (revents & POLLPRI) {
+    m_sample_until = std::chrono::steady_clock::now() +
+                     std::chrono::milliseconds(COOLDOWN_MS);
+    return true;
+  }
+  return is_sampling();
+}
+
+bool PressureWatch::read(PressureStats &stats) {
+  std::string_view text;
+  return m_file.read(text) && parse_pressure(text, stats);
+}
+
+} // namespace procfs
@@ -0,0 +1,74 @@
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+#include "proc_sampler.h"
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+// Pressure stall information (PSI, Linux 4.20 and later) from
+// /proc/pressure. Besides reading the averages, a monitor can arm a trigger
+// there and sleep in poll() until tasks have actually been stalling, rather
+// than waking up on a timer to find out that nothing happened.
+namespace procfs {
+
+enum class Resource { CPU, MEMORY, IO };
+
+struct PressureLine {
+  double avg10 = 0, avg60 = 0, avg300 = 0; // Percent of time stalled
+  uint64_t total_us = 0;
+};
+
+// "some": at least one task stalled; "full": all non-idle tasks did at once.
+// The CPU has no meaningful "full" line.
+struct PressureStats {
+  PressureLine some;
+  PressureLine full;
+};
+
+bool parse_pressure(std::string_view text, PressureStats &stats);
+const char *resource_name(Resource resource);
+
+// Paces a monitor by pressure. It stays idle until tasks stall on the
+// resource for `stall_ms` within a window, then asks for samples at the
+// monitor's interval until a cooldown passes without another event.
+//
+//   poll {watch.fd(), POLLPRI} with watch.timeout(interval_ms)
+//   if (watch.should_sample(revents)) take a sample
+class PressureWatch {
+public:
+  // The window is 2 s because that is what unprivileged users may arm
+  static const uint64_t WINDOW_MS = 2000;
+  static const int COOLDOWN_MS = 10000;
+
+  PressureWatch() = default;
+  ~PressureWatch();
+  PressureWatch(const PressureWatch &) = delete;
+  PressureWatch &operator=(const PressureWatch &) = delete;
+
+  // Arms the trigger. Returns false with errno set: ENOENT without PSI in
+  // the kernel, EINVAL for a stall longer than the window.
+  bool open(Resource resource, uint64_t stall_ms);
+  int fd() const { return m_trigger_fd; }
+
+  // What to pass to poll(): `interval_ms` while sampling, -1 (forever)
+  // otherwise.
+  int timeout(int interval_ms) const;
+  // Takes the revents of fd() after poll() returned, 0 if it timed out.
+  // Returns true if a sample is due now. Returns false otherwise, with
+  // `error` and errno set if the trigger has stopped working.
+  bool should_sample(short revents, bool &error);
+  bool is_sampling() const;
+
+  // The current averages. They are read through an fd of their own, which
+  // leaves the trigger alone.
+  bool read(PressureStats &stats);
+
+private:
+  int m_trigger_fd = -1;
+  ProcFile m_file;
+  std::chrono::steady_clock::time_point m_sample_until;
+};
+
+} // namespace procfs
+#endif // !PRESSURE_H
@@ -0,0 +1,511 @@
+#include "proc_sampler.h"
+#include "instrument.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <unistd.h>
+
+namespace procfs {
+
+namespace {
+
+// Enough for /proc/stat on a few hundred CPUs; bigger files grow the buffer
+// once and keep it.
+const size_t INITIAL_BUFFER_SIZE = 16 * 1024;
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+} // namespace
+
+ProcFile::~ProcFile() { close(); }
+
+ProcFile::ProcFile(ProcFile &&other) noexcept
+    : m_fd(other.m_fd), m_buffer(std::move(other.m_buffer)) {
+  other.m_fd = -1;
+}
+
+ProcFile &ProcFile::operator=(ProcFile &&other) noexcept {
+  if (this != &other) {
+    close();
+    m_fd = other.m_fd;
+    m_buffer = std::move(other.m_buffer);
+    other.m_fd = -1;
+  }
+  return *this;
+}
+
+bool ProcFile::open(const char *path) { return open_at(AT_FDCWD, path); }
+
+bool ProcFile::open_at(int dir_fd, const char *name) {
+  close();
+  m_fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+  return m_fd >= 0;
+}
+
+void ProcFile::close() {
+  if (m_fd >= 0)
+    ::close(m_fd);
+  m_fd = -1;
+}
+
+bool ProcFile::read(std::string_view &contents) {
+  if (m_fd < 0) {
+    errno = EBADF;
+    return false;
+  }
+  if (m_buffer.empty())
+    m_buffer.resize(INITIAL_BUFFER_SIZE);
+
+  size_t used = 0;
+  while (true) {
+    if (used == m_buffer.size())
+      m_buffer.resize(m_buffer.size() * 2);
+    ssize_t n = pread(m_fd, m_buffer.data() + used, m_buffer.size() - used,
+                      static_cast<off_t>(used));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0)
+      break;
+    used += static_cast<size_t>(n);
+  }
+  contents = std::string_view(m_buffer.data(), used);
+  return true;
+}
+
+std::string_view Scanner::rest_of_line() const {
+  std::string_view rest = m_text.substr(std::min(m_pos, m_text.size()));
+  return rest.substr(0, rest.find('\n'));
+}
+
+void Scanner::skip_blanks() {
+  while (m_pos < m_text.size() && is_blank(m_text[m_pos]))
+    m_pos++;
+}
+
+std::string_view Scanner::next_word() {
+  skip_blanks();
+  size_t start = m_pos;
+  while (m_pos < m_text.size() && !is_blank(m_text[m_pos]) &&
+         m_text[m_pos] != '\n')
+    m_pos++;
+  return m_text.substr(start, m_pos - start);
+}
+
+uint64_t Scanner::next_u64() {
+  skip_blanks();
+  uint64_t value = 0;
+  while (m_pos < m_text.size() &&
+         static_cast<unsigned>(m_text[m_pos] - '0') < 10) {
+    value = value * 10 + static_cast<unsigned>(m_text[m_pos] - '0');
+    m_pos++;
+  }
+  return value;
+}
+
+int64_t Scanner::next_i64() {
+  skip_blanks();
+  bool negative = m_pos < m_text.size() && m_text[m_pos] == '-';
+  if (negative)
+    m_pos++;
+  int64_t value = static_cast<int64_t>(next_u64());
+  return negative ? -value : value;
+}
+
+void Scanner::skip_words(size_t count) {
+  while (count-- > 0)
+    next_word();
+}
+
+void Scanner::next_line() {
+  size_t newline = m_text.find('\n', m_pos);
+  m_pos = newline == std::string_view::npos ? m_text.size() : newline + 1;
+}
+
+bool Scanner::skip_past_last(char c) {
+  std::string_view line = rest_of_line();
+  size_t found = line.rfind(c);
+  if (found == std::string_view::npos)
+    return false;
+  m_pos += found + 1;
+  return true;
+}
+
+double busy_percent(const CpuTimes &before, const CpuTimes &after) {
+  uint64_t total = after.total() - before.total();
+  uint64_t idle = after.idle_total() - before.idle_total();
+  if (total == 0 || idle > total)
+    return 0; // No tick in between, or a CPU that went offline
+  return 100.0 * static_cast<double>(total - idle) / static_cast<double>(total);
+}
+
+namespace {
+
+void read_cpu_times(Scanner &scanner, CpuTimes &times) {
+  times.user = scanner.next_u64();
+  times.nice = scanner.next_u64();
+  times.system = scanner.next_u64();
+  times.idle = scanner.next_u64();
+  times.iowait = scanner.next_u64();
+  times.irq = scanner.next_u64();
+  times.softirq = scanner.next_u64();
+  times.steal = scanner.next_u64();
+}
+
+} // namespace
+
+bool parse_stat(std::string_view text, StatSample &sample) {
+  Scanner scanner(text);
+  bool have_total = false;
+  size_t cpus_seen = 0;
+  for (; !scanner.at_end(); scanner.next_line()) {
+    if (scanner.line_starts_with("cpu ")) {
+      scanner.next_word();
+      read_cpu_times(scanner, sample.total);
+      have_total = true;
+    } else if (scanner.line_starts_with("cpu")) {
+      // "cpuN"; offline CPUs have no line, so go by the number
+      std::string_view label = scanner.next_word();
+      Scanner number(label.substr(3));
+      size_t cpu = static_cast<size_t>(number.next_u64());
+      if (cpu >= sample.cpus.size())
+        sample.cpus.resize(cpu + 1);
+      for (; cpus_seen < cpu; cpus_seen++)
+        sample.cpus[cpus_seen] = CpuTimes();
+      read_cpu_times(scanner, sample.cpus[cpu]);
+      cpus_seen = cpu + 1;
+    } else if (scanner.line_starts_with("ctxt ")) {
+      scanner.next_word();
+      sample.context_switches = scanner.next_u64();
+    } else if (scanner.line_starts_with("processes ")) {
+      scanner.next_word();
+      sample.processes_created = scanner.next_u64();
+    } else if (scanner.line_starts_with("procs_running ")) {
+      scanner.next_word();
+      sample.procs_running = scanner.next_u64();
+    } else if (scanner.line_starts_with("procs_blocked ")) {
+      scanner.next_word();
+      sample.procs_blocked = scanner.next_u64();
+    }
+  }
+  sample.cpus.resize(cpus_seen);
+  return have_total;
+}
+
+bool parse_meminfo(std::string_view text, MemInfo &info) {
+  struct Field {
+    std::string_view label;
+    uint64_t MemInfo::*value;
+  };
+  static const Field FIELDS[] = {
+      {"MemTotal:", &MemInfo::total},
+      {"MemFree:", &MemInfo::free},
+      {"MemAvailable:", &MemInfo::available},
+      {"Buffers:", &MemInfo::buffers},
+      {"Cached:", &MemInfo::cached},
+      {"SwapCached:", &MemInfo::swap_cached},
+      {"SwapTotal:", &MemInfo::swap_total},
+      {"SwapFree:", &MemInfo::swap_free},
+  };
+
+  // The fields come in this order, so the search carries on from the last
+  // one found instead of comparing every line against every label
+  Scanner scanner(text);
+  size_t next_field = 0;
+  size_t found = 0;
+  for (; !scanner.at_end() && found < std::size(FIELDS); scanner.next_line()) {
+    std::string_view label = scanner.next_word();
+    for (size_t i = 0; i < std::size(FIELDS); i++) {
+      const Field &field = FIELDS[(next_field + i) % std::size(FIELDS)];
+      if (field.label == label) {
+        info.*field.value = scanner.next_u64();
+        next_field = (next_field + i + 1) % std::size(FIELDS);
+        found++;
+        break;
+      }
+    }
+  }
+  return found > 0;
+}
+
+bool parse_diskstats(std::string_view text, std::vector<DiskStats> &devices) {
+  Scanner scanner(text);
+  size_t count = 0;
+  for (; !scanner.at_end(); scanner.next_line()) {
+    if (count == devices.size())
+      devices.emplace_back();
+    DiskStats &device = devices[count];
+    device.major = static_cast<uint32_t>(scanner.next_u64());
+    device.minor = static_cast<uint32_t>(scanner.next_u64());
+    std::string_view name = scanner.next_word();
+    if (name.empty())
+      continue;
+    size_t length = std::min(name.size(), sizeof(device.name) - 1);
+    memcpy(device.name, name.data(), length);
+    device.name[length] = '\0';
+    device.reads = scanner.next_u64();
+    scanner.skip_words(1); // Merged
+    device.sectors_read = scanner.next_u64();
+    device.read_ms = scanner.next_u64();
+    device.writes = scanner.next_u64();
+    scanner.skip_words(1);
+    device.sectors_written = scanner.next_u64();
+    device.write_ms = scanner.next_u64();
+    device.in_flight = scanner.next_u64();
+    device.io_ms = scanner.next_u64();
+    device.weighted_io_ms = scanner.next_u64();
+    count++;
+  }
+  devices.resize(count);
+  return count > 0;
+}
+
+DiskRates disk_rates(const DiskStats &before, const DiskStats &after,
+                     double elapsed_ms) {
+  // Counters only go down if the device was replaced in between
+  auto delta = [](uint64_t a, uint64_t b) {
+    return b >= a ? static_cast<double>(b - a) : 0.0;
+  };
+  // Sectors are 512 bytes here, whatever the device's own sector size
+  const double SECTOR = 512;
+  DiskRates rates;
+  if (elapsed_ms <= 0)
+    return rates;
+  double seconds = elapsed_ms / 1000;
+  double reads = delta(before.reads, after.reads);
+  double writes = delta(before.writes, after.writes);
+  rates.reads_per_s = reads / seconds;
+  rates.writes_per_s = writes / seconds;
+  rates.read_bytes_per_s =
+      delta(before.sectors_read, after.sectors_read) * SECTOR / seconds;
+  rates.write_bytes_per_s =
+      delta(before.sectors_written, after.sectors_written) * SECTOR / seconds;
+  if (reads + writes > 0)
+    rates.await_ms = (delta(before.read_ms, after.read_ms) +
+                      delta(before.write_ms, after.write_ms)) /
+                     (reads + writes);
+  rates.queue_depth =
+      delta(before.weighted_io_ms, after.weighted_io_ms) / elapsed_ms;
+  rates.utilization =
+      std::min(100.0, 100 * delta(before.io_ms, after.io_ms) / elapsed_ms);
+  return rates;
+}
+
+bool parse_net_dev(std::string_view text, std::vector<NetDevice> &devices) {
+  Scanner scanner(text);
+  // Two lines of column headings
+  scanner.next_line();
+  scanner.next_line();
+  size_t count = 0;
+  for (; !scanner.at_end(); scanner.next_line()) {
+    // "  eth0: 1234 ..."; a long first number can follow the colon directly
+    std::string_view line = scanner.rest_of_line();
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos)
+      continue;
+    std::string_view name = line.substr(0, colon);
+    name.remove_prefix(std::min(name.size(), name.find_first_not_of(' ')));
+    if (count == devices.size())
+      devices.emplace_back();
+    NetDevice &device = devices[count++];
+    size_t length = std::min(name.size(), sizeof(device.name) - 1);
+    memcpy(device.name, name.data(), length);
+    device.name[length] = '\0';
+
+    Scanner numbers(line.substr(colon + 1));
+    device.rx_bytes = numbers.next_u64();
+    device.rx_packets = numbers.next_u64();
+    device.rx_errors = numbers.next_u64();
+    device.rx_drops = numbers.next_u64();
+    numbers.skip_words(4); // fifo frame compressed multicast
+    device.tx_bytes = numbers.next_u64();
+    device.tx_packets = numbers.next_u64();
+    device.tx_errors = numbers.next_u64();
+    device.tx_drops = numbers.next_u64();
+  }
+  devices.resize(count);
+  return count > 0;
+}
+
+bool parse_tcp_stats(std::string_view text, TcpStats &stats) {
+  struct Field {
+    std::string_view name;
+    uint64_t TcpStats::*value;
+  };
+  static const Field FIELDS[] = {
+      {"ActiveOpens", &TcpStats::active_opens},
+      {"PassiveOpens", &TcpStats::passive_opens},
+      {"AttemptFails", &TcpStats::attempt_fails},
+      {"EstabResets", &TcpStats::estab_resets},
+      {"CurrEstab", &TcpStats::current_established},
+      {"InSegs", &TcpStats::in_segments},
+      {"OutSegs", &TcpStats::out_segments},
+      {"RetransSegs", &TcpStats::retransmitted_segments},
+      {"InErrs", &TcpStats::in_errors},
+      {"OutRsts", &TcpStats::out_resets},
+      {"ListenOverflows", &TcpStats::listen_overflows},
+      {"ListenDrops", &TcpStats::listen_drops},
+      {"TCPReqQFullDrop", &TcpStats::syn_queue_drops},
+      {"TCPReqQFullDoCookies", &TcpStats::syncookies_sent},
+      {"TCPTimeouts", &TcpStats::timeouts},
+  };
+
+  // Each table is a line of names followed by a line of values, both
+  // starting with the table's name
+  Scanner scanner(text);
+  bool found = false;
+  for (; !scanner.at_end(); scanner.next_line()) {
+    std::string_view table = scanner.next_word();
+    if (table != "Tcp:" && table != "TcpExt:")
+      continue;
+    Scanner names(scanner.rest_of_line());
+    scanner.next_line();
+    if (scanner.next_word() != table)
+      return false;
+    for (std::string_view name = names.next_word(); !name.empty();
+         name = names.next_word()) {
+      // Some values, like MaxConn, can be negative; none of those we keep
+      std::string_view value = scanner.next_word();
+      for (const Field &field : FIELDS) {
+        if (field.name == name) {
+          stats.*field.value = Scanner(value).next_u64();
+          found = true;
+          break;
+        }
+      }
+    }
+  }
+  return found;
+}
+
+namespace {
+
+// mountinfo escapes space, tab, newline and backslash as \ooo
+std::string unescape(std::string_view text) {
+  std::string result;
+  result.reserve(text.size());
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '\\' && i + 3 < text.size() &&
+        static_cast<unsigned>(text[i + 1] - '0') < 8) {
+      result += static_cast<char>((text[i + 1] - '0') * 64 +
+                                  (text[i + 2] - '0') * 8 +
+                                  (text[i + 3] - '0'));
+      i += 3;
+    } else {
+      result += text[i];
+    }
+  }
+  return result;
+}
+
+// Storage without a device number of its own
+bool is_storage_without_device(std::string_view fs_type) {
+  static const std::string_view TYPES[] = {
+      "nfs",   "nfs4",    "cifs",      "smb3", "smbfs",     "ceph",
+      "btrfs", "zfs",     "glusterfs", "9p",   "fuse.sshfs", "overlay"};
+  return std::find(std::begin(TYPES), std::end(TYPES), fs_type) !=
+         std::end(TYPES);
+}
+
+} // namespace
+
+bool parse_mountinfo(std::string_view text, std::vector<Mount> &mounts) {
+  mounts.clear();
+  Scanner scanner(text);
+  for (; !scanner.at_end(); scanner.next_line()) {
+    // id parent major:minor root mount_point options [optional...] - type
+    // source super_options
+    scanner.skip_words(2);
+    Mount mount;
+    mount.major = static_cast<uint32_t>(scanner.next_u64());
+    std::string_view minor = scanner.next_word(); // ":minor"
+    if (minor.empty())
+      continue;
+    mount.minor = static_cast<uint32_t>(Scanner(minor.substr(1)).next_u64());
+    scanner.skip_words(1); // Root
+    std::string_view mount_point = scanner.next_word();
+    scanner.skip_words(1); // Options
+    std::string_view word;
+    do {
+      word = scanner.next_word();
+    } while (!word.empty() && word != "-");
+    std::string_view fs_type = scanner.next_word();
+    std::string_view source = scanner.next_word();
+    if (mount_point.empty() || fs_type.empty())
+      continue;
+    if (mount.major == 0 && !is_storage_without_device(fs_type))
+      continue;
+    mount.mount_point = unescape(mount_point);
+    mount.fs_type = std::string(fs_type);
+    mount.source = unescape(source);
+    auto covered = std::find_if(mounts.begin(), mounts.end(),
+                                [&](const Mount &other) {
+                                  return other.mount_point == mount.mount_point;
+                                });
+    if (covered != mounts.end())
+      mounts.erase(covered);
+    mounts.push_back(std::move(mount));
+  }
+  return !mounts.empty();
+}
+
+bool Sampler::read_stat(StatSample &sample) {
+  INSTRUMENT_SCOPE("procfs.read_stat");
+  std::string_view text;
+  if (!m_stat.is_open() && !m_stat.open("/proc/stat"))
+    return false;
+  return m_stat.read(text) && parse_stat(text, sample);
+}
+
+bool Sampler::read_meminfo(MemInfo &info) {
+  INSTRUMENT_SCOPE("procfs.read_meminfo");
+  std::string_view text;
+  if (!m_meminfo.is_open() && !m_meminfo.open("/proc/meminfo"))
+    return false;
+  return m_meminfo.read(text) && parse_meminfo(text, info);
+}
+
+bool Sampler::read_diskstats(std::vector<DiskStats> &devices) {
+  INSTRUMENT_SCOPE("procfs.read_diskstats");
+  std::string_view text;
+  if (!m_diskstats.is_open() && !m_diskstats.open("/proc/diskstats"))
+    return false;
+  return m_diskstats.read(text) && parse_diskstats(text, devices);
+}
+
+bool Sampler::read_net_dev(std::vector<NetDevice> &devices) {
+  INSTRUMENT_SCOPE("procfs.read_net_dev");
+  std::string_view text;
+  if (!m_net_dev.is_open() && !m_net_dev.open("/proc/net/dev"))
+    return false;
+  return m_net_dev.read(text) && parse_net_dev(text, devices);
+}
+
+bool Sampler::read_tcp_stats(TcpStats &stats) {
+  INSTRUMENT_SCOPE("procfs.read_tcp_stats");
+  std::string_view text;
+  if (!m_snmp.is_open() && !m_snmp.open("/proc/net/snmp"))
+    return false;
+  if (!m_snmp.read(text) || !parse_tcp_stats(text, stats))
+    return false;
+  // Older kernels or containers may lack netstat; its counters stay zero
+  if (!m_netstat.is_open() && !m_netstat.open("/proc/net/netstat"))
+    return true;
+  if (!m_netstat.read(text))
+    return false;
+  parse_tcp_stats(text, stats);
+  return true;
+}
+
+bool read_mounts(std::vector<Mount> &mounts) {
+  INSTRUMENT_SCOPE("procfs.read_mounts");
+  ProcFile file;
+  std::string_view text;
+  return file.open("/proc/self/mountinfo") && file.read(text) &&
+         parse_mountinfo(text, mounts);
+}
+
+} // namespace procfs
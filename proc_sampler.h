@@ -0,0 +1,196 @@
+#ifndef PROC_SAMPLER_H
+#define PROC_SAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Cheap repeated reads of /proc for the system monitors. Files are opened
+// once and read again from offset 0 with pread, which makes the kernel
+// regenerate them, into a buffer that is kept between samples; parsing works
+// on that buffer in place, so a sample allocates nothing once the buffers
+// have grown to size.
+namespace procfs {
+
+// A /proc file held open for re-reading.
+class ProcFile {
+public:
+  ProcFile() = default;
+  ~ProcFile();
+  ProcFile(const ProcFile &) = delete;
+  ProcFile &operator=(const ProcFile &) = delete;
+  ProcFile(ProcFile &&other) noexcept;
+  ProcFile &operator=(ProcFile &&other) noexcept;
+
+  // Return false with errno set on failure. The second form opens `name`
+  // relative to the directory fd, as openat(2) does.
+  bool open(const char *path);
+  bool open_at(int dir_fd, const char *name);
+  void close();
+  bool is_open() const { return m_fd >= 0; }
+
+  // The current contents, valid until the next read. Returns false with
+  // errno set on failure, e.g. ESRCH once a process is gone.
+  bool read(std::string_view &contents);
+
+private:
+  int m_fd = -1;
+  std::vector<char> m_buffer;
+};
+
+// Forward-only cursor over /proc text. Numbers are parsed by hand; nothing
+// here allocates.
+class Scanner {
+public:
+  explicit Scanner(std::string_view text) : m_text(text) {}
+
+  bool at_end() const { return m_pos >= m_text.size(); }
+  // What is left of the current line, without the newline.
+  std::string_view rest_of_line() const;
+  bool line_starts_with(std::string_view prefix) const {
+    return m_text.compare(m_pos, prefix.size(), prefix) == 0;
+  }
+
+  // Skips spaces and tabs, then returns the run of other characters up to
+  // the next space or newline.
+  std::string_view next_word();
+  // Skips spaces and tabs and parses an unsigned decimal number; 0 if there
+  // is none.
+  uint64_t next_u64();
+  int64_t next_i64();
+  void skip_words(size_t count);
+  // Moves past the next newline.
+  void next_line();
+  // Moves to just past the last occurrence of `c` on the rest of the line;
+  // returns false and stays put if there is none.
+  bool skip_past_last(char c);
+
+private:
+  void skip_blanks();
+
+  std::string_view m_text;
+  size_t m_pos = 0;
+};
+
+// Times from one "cpu" line of /proc/stat, in clock ticks.
+struct CpuTimes {
+  uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0,
+           softirq = 0, steal = 0;
+
+  uint64_t total() const {
+    return user + nice + system + idle + iowait + irq + softirq + steal;
+  }
+  uint64_t idle_total() const { return idle + iowait; }
+};
+
+// Busy share of the time between two samples, 0 to 100.
+double busy_percent(const CpuTimes &before, const CpuTimes &after);
+
+struct StatSample {
+  CpuTimes total;
+  std::vector<CpuTimes> cpus; // Indexed by CPU number, offline ones zero
+  uint64_t context_switches = 0;
+  uint64_t processes_created = 0;
+  uint64_t procs_running = 0;
+  uint64_t procs_blocked = 0;
+};
+
+// Sizes in kB, as /proc/meminfo reports them.
+struct MemInfo {
+  uint64_t total = 0, free = 0, available = 0, cached = 0, buffers = 0,
+           swap_total = 0, swap_free = 0, swap_cached = 0;
+};
+
+// Counters of one block device from /proc/diskstats, since boot.
+struct DiskStats {
+  char name[32] = "";
+  uint32_t major = 0, minor = 0;
+  uint64_t reads = 0, sectors_read = 0, read_ms = 0;
+  uint64_t writes = 0, sectors_written = 0, write_ms = 0;
+  uint64_t in_flight = 0;
+  uint64_t io_ms = 0;          // Time with at least one request in flight
+  uint64_t weighted_io_ms = 0; // Request time summed over all requests
+};
+
+// What a device did between two samples `elapsed_ms` apart.
+struct DiskRates {
+  double reads_per_s = 0, writes_per_s = 0;
+  double read_bytes_per_s = 0, write_bytes_per_s = 0;
+  double await_ms = 0;     // Average time a request took, queueing included
+  double queue_depth = 0;  // Average number of requests in flight
+  double utilization = 0;  // Share of the time the device was busy, 0 to 100
+};
+
+DiskRates disk_rates(const DiskStats &before, const DiskStats &after,
+                     double elapsed_ms);
+
+// Counters of one network interface from /proc/net/dev, since it came up.
+struct NetDevice {
+  char name[16] = "";
+  uint64_t rx_bytes = 0, rx_packets = 0, rx_errors = 0, rx_drops = 0;
+  uint64_t tx_bytes = 0, tx_packets = 0, tx_errors = 0, tx_drops = 0;
+};
+
+// TCP counters from /proc/net/snmp and /proc/net/netstat, since boot, but
+// for current_established, which is a gauge.
+struct TcpStats {
+  uint64_t active_opens = 0, passive_opens = 0, attempt_fails = 0;
+  uint64_t estab_resets = 0, current_established = 0;
+  uint64_t in_segments = 0, out_segments = 0, retransmitted_segments = 0;
+  uint64_t in_errors = 0, out_resets = 0;
+  // Connections the accept queue had no room for, and SYNs dropped for any
+  // reason on a listener; the second includes the first
+  uint64_t listen_overflows = 0, listen_drops = 0;
+  // SYNs dropped because the SYN queue was full without syncookies, and
+  // syncookies sent because it was full
+  uint64_t syn_queue_drops = 0, syncookies_sent = 0;
+  uint64_t timeouts = 0;
+};
+
+// One line of /proc/self/mountinfo.
+struct Mount {
+  uint32_t major = 0, minor = 0;
+  std::string mount_point;
+  std::string fs_type;
+  std::string source;
+};
+
+bool parse_stat(std::string_view text, StatSample &sample);
+bool parse_meminfo(std::string_view text, MemInfo &info);
+// Devices in the order the kernel lists them; `devices` is reused.
+bool parse_diskstats(std::string_view text, std::vector<DiskStats> &devices);
+bool parse_net_dev(std::string_view text, std::vector<NetDevice> &devices);
+// Fills in what the "Tcp:" table of /proc/net/snmp or the "TcpExt:" table of
+// /proc/net/netstat has; either may be passed.
+bool parse_tcp_stats(std::string_view text, TcpStats &stats);
+// Mounts backed by storage: block devices and network filesystems, but not
+// proc, sysfs, tmpfs, cgroup and the like. A mount point mounted over again
+// is listed once, for what is mounted on top.
+bool parse_mountinfo(std::string_view text, std::vector<Mount> &mounts);
+
+// The system-wide /proc files, each opened lazily on first use.
+class Sampler {
+public:
+  bool read_stat(StatSample &sample);
+  bool read_meminfo(MemInfo &info);
+  bool read_diskstats(std::vector<DiskStats> &devices);
+  bool read_net_dev(std::vector<NetDevice> &devices);
+  // Both /proc/net/snmp and /proc/net/netstat
+  bool read_tcp_stats(TcpStats &stats);
+
+private:
+  ProcFile m_stat;
+  ProcFile m_meminfo;
+  ProcFile m_diskstats;
+  ProcFile m_net_dev;
+  ProcFile m_snmp;
+  ProcFile m_netstat;
+};
+
+// The mount table of this process, read once.
+bool read_mounts(std::vector<Mount> &mounts);
+
+} // namespace procfs
+#endif // !PROC_SAMPLER_H
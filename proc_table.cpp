@@ -0,0 +1,180 @@
+#include "proc_table.h"
+#include "instrument.h"
+#include "proc_sampler.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace procfs {
+
+namespace {
+
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+const size_t DIRENT_BUFFER_SIZE = 64 * 1024;
+// /proc/[pid]/stat is a few hundred bytes
+const size_t STAT_BUFFER_SIZE = 1024;
+const size_t PIDS_PER_PIECE = 256;
+
+bool parse_pid(const char *name, int &pid) {
+  pid = 0;
+  if (*name == '\0')
+    return false;
+  for (; *name != '\0'; name++) {
+    if (*name < '0' || *name > '9')
+      return false;
+    pid = pid * 10 + (*name - '0');
+  }
+  return true;
+}
+
+} // namespace
+
+ProcessTable::ProcessTable(threading::ThreadPool *pool,
+                           size_t parallel_threshold)
+    : m_pool(pool), m_parallel_threshold(parallel_threshold),
+      m_dirent_buffer(DIRENT_BUFFER_SIZE),
+      m_ticks_per_second(sysconf(_SC_CLK_TCK)),
+      m_page_kb(sysconf(_SC_PAGESIZE) / 1024) {}
+
+ProcessTable::~ProcessTable() {
+  if (m_proc_fd >= 0)
+    close(m_proc_fd);
+}
+
+bool ProcessTable::list_pids() {
+  if (m_proc_fd < 0) {
+    m_proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_proc_fd < 0)
+      return false;
+  } else if (lseek(m_proc_fd, 0, SEEK_SET) != 0) {
+    return false;
+  }
+
+  m_pids.clear();
+  while (true) {
+    long n = syscall(SYS_getdents64, m_proc_fd, m_dirent_buffer.data(),
+                     m_dirent_buffer.size());
+    if (n < 0)
+      return false;
+    if (n == 0)
+      break;
+    for (long offset = 0; offset < n;) {
+      auto *entry = reinterpret_cast<linux_dirent64 *>(
+          m_dirent_buffer.data() + offset);
+      offset += entry->d_reclen;
+      int pid;
+      if (entry->d_type == DT_DIR && parse_pid(entry->d_name, pid))
+        m_pids.push_back(pid);
+    }
+  }
+  std::sort(m_pids.begin(), m_pids.end());
+  return true;
+}
+
+// Runs on pool threads: touches nothing but `entry`.
+void ProcessTable::read_entry(Entry &entry) const {
+  entry.valid = false;
+  char path[32];
+  snprintf(path, sizeof(path), "%d/stat", entry.pid);
+  int fd = openat(m_proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  char buffer[STAT_BUFFER_SIZE];
+  ssize_t n = pread(fd, buffer, sizeof(buffer), 0);
+  close(fd);
+  if (n <= 0)
+    return;
+
+  // "pid (comm) state ppid ..."; comm may hold spaces and parentheses of
+  // its own, so fields are counted from the last ')'
+  std::string_view text(buffer, static_cast<size_t>(n));
+  size_t open_paren = text.find('(');
+  size_t close_paren = text.rfind(')');
+  if (open_paren == std::string_view::npos ||
+      close_paren == std::string_view::npos || close_paren < open_paren)
+    return;
+  size_t comm_length = std::min(close_paren - open_paren - 1,
+                                sizeof(entry.usage.comm) - 1);
+  memcpy(entry.usage.comm, buffer + open_paren + 1, comm_length);
+  entry.usage.comm[comm_length] = '\0';
+
+  Scanner scanner(text.substr(close_paren + 1));
+  std::string_view state = scanner.next_word(); // Field 3
+  entry.usage.state = state.empty() ? '?' : state[0];
+  scanner.skip_words(10);                   // ppid .. cmajflt
+  uint64_t utime = scanner.next_u64();      // 14
+  uint64_t stime = scanner.next_u64();      // 15
+  scanner.skip_words(4);                    // cutime .. nice
+  entry.usage.threads = scanner.next_u64(); // 20
+  scanner.skip_words(1);                    // itrealvalue
+  entry.start_time = scanner.next_u64();    // 22
+  scanner.skip_words(1);                    // vsize
+  int64_t rss_pages = scanner.next_i64();   // 24
+  entry.cpu_ticks = utime + stime;
+  entry.usage.rss_kb =
+      rss_pages > 0 ? static_cast<uint64_t>(rss_pages) * m_page_kb : 0;
+  entry.usage.pid = entry.pid;
+  entry.valid = true;
+}
+
+bool ProcessTable::sample(std::vector<ProcessUsage> &usage) {
+  INSTRUMENT_SCOPE("procfs.process_table");
+  if (!list_pids())
+    return false;
+  auto now = std::chrono::steady_clock::now();
+
+  m_current.resize(m_pids.size());
+  for (size_t i = 0; i < m_pids.size(); i++)
+    m_current[i].pid = m_pids[i];
+  auto read_range = [this](size_t begin, size_t end) {
+    INSTRUMENT_SCOPE("procfs.read_processes");
+    for (size_t i = begin; i < end; i++)
+      read_entry(m_current[i]);
+  };
+  if (m_pool != nullptr && m_pids.size() > m_parallel_threshold)
+    m_pool->parallel_for(0, m_pids.size(), PIDS_PER_PIECE, read_range);
+  else
+    read_range(0, m_pids.size());
+  INSTRUMENT_GAUGE("processes", static_cast<int64_t>(m_pids.size()));
+
+  // Both lists are sorted by pid, so one merge pass pairs them up
+  double elapsed_ticks =
+      std::chrono::duration<double>(now - m_previous_time).count() *
+      static_cast<double>(m_ticks_per_second);
+  bool have_previous = !m_previous.empty();
+  usage.clear();
+  size_t p = 0;
+  for (Entry &entry : m_current) {
+    if (!entry.valid)
+      continue;
+    while (p < m_previous.size() && m_previous[p].pid < entry.pid)
+      p++;
+    entry.usage.cpu_percent = 0;
+    if (have_previous && p < m_previous.size() &&
+        m_previous[p].pid == entry.pid && m_previous[p].valid &&
+        m_previous[p].start_time == entry.start_time && elapsed_ticks > 0) {
+      uint64_t ticks = entry.cpu_ticks - m_previous[p].cpu_ticks;
+      entry.usage.cpu_percent =
+          100.0 * static_cast<double>(ticks) / elapsed_ticks;
+    }
+    usage.push_back(entry.usage);
+  }
+
+  m_current.swap(m_previous);
+  m_previous_time = now;
+  return true;
+}
+
+} // namespace procfs
@@ -0,0 +1,64 @@
+#ifndef PROC_TABLE_H
+#define PROC_TABLE_H
+
+#include "thread_pool.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-process CPU accounting from /proc/[pid]/stat, top style: every sample
+// reads all processes and reports their CPU use since the previous one.
+namespace procfs {
+
+struct ProcessUsage {
+  int pid = 0;
+  char comm[17] = {}; // The kernel truncates names to 15 characters
+  char state = '?';
+  double cpu_percent = 0; // Of one CPU, so up to 100 * threads
+  uint64_t rss_kb = 0;
+  uint64_t threads = 0;
+};
+
+class ProcessTable {
+public:
+  // Hosts with more processes than `parallel_threshold` are read in parallel
+  // on `pool` when one is given.
+  explicit ProcessTable(threading::ThreadPool *pool = nullptr,
+                        size_t parallel_threshold = 2048);
+  ~ProcessTable();
+  ProcessTable(const ProcessTable &) = delete;
+  ProcessTable &operator=(const ProcessTable &) = delete;
+
+  // Reads every process into `usage`, which is reused. CPU use is relative
+  // to the previous call and zero on the first. Returns false with errno set
+  // if /proc can't be read.
+  bool sample(std::vector<ProcessUsage> &usage);
+
+private:
+  struct Entry {
+    int pid;
+    bool valid; // False if the process went away while being read
+    uint64_t cpu_ticks;
+    uint64_t start_time; // Tells a reused pid from the process before it
+    ProcessUsage usage;
+  };
+
+  bool list_pids();
+  void read_entry(Entry &entry) const;
+
+  threading::ThreadPool *m_pool;
+  const size_t m_parallel_threshold;
+  int m_proc_fd = -1;
+  std::vector<char> m_dirent_buffer;
+  std::vector<int> m_pids;
+  // Sorted by pid; swapped every sample so neither is reallocated
+  std::vector<Entry> m_current;
+  std::vector<Entry> m_previous;
+  std::chrono::steady_clock::time_point m_previous_time;
+  long m_ticks_per_second;
+  long m_page_kb;
+};
+
+} // namespace procfs
+#endif // !PROC_TABLE_H
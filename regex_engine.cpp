@@ -0,0 +1,696 @@
+#include "regex_engine.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+namespace regex {
+
+namespace {
+
+const int MAX_REPEAT = 1000;
+const size_t MAX_PREFILTER_LITERALS = 512;
+// Beyond this the DFA cache is thrown away and rebuilt as the input demands,
+// which bounds memory for patterns whose DFA would blow up.
+const size_t MAX_DFA_STATES = 4096;
+
+struct Node {
+  enum Kind { EMPTY, CHARS, CONCAT, ALTERNATE, REPEAT, BOL, EOL };
+  explicit Node(Kind kind) : kind(kind) {}
+
+  Kind kind;
+  std::bitset<256> chars;
+  std::vector<std::unique_ptr<Node>> children;
+  int min = 0;
+  int max = 0; // -1 for unbounded
+};
+using NodePtr = std::unique_ptr<Node>;
+
+class Parser {
+public:
+  Parser(const std::string &pattern, bool ignore_case)
+      : m_pattern(pattern), m_ignore_case(ignore_case) {}
+
+  NodePtr parse() {
+    NodePtr node = parse_alternation();
+    if (m_pos < m_pattern.size())
+      error("unmatched ')'");
+    return node;
+  }
+
+private:
+  bool at_end() const { return m_pos >= m_pattern.size(); }
+  char peek() const { return m_pattern[m_pos]; }
+
+  [[noreturn]] void error(const std::string &what) const {
+    throw std::invalid_argument("invalid regex '" + m_pattern +
+                                "': " + what + " at offset " +
+                                std::to_string(m_pos));
+  }
+
+  // With ignore_case, puts both cases of every letter in `chars`
+  void fold_case(std::bitset<256> &chars) const {
+    if (!m_ignore_case)
+      return;
+    for (int c = 'a'; c <= 'z'; c++) {
+      if (chars[c] || chars[std::toupper(c)]) {
+        chars[c] = true;
+        chars[std::toupper(c)] = true;
+      }
+    }
+  }
+
+  NodePtr chars_node(std::bitset<256> chars) const {
+    fold_case(chars);
+    NodePtr node = std::make_unique<Node>(Node::CHARS);
+    node->chars = chars;
+    return node;
+  }
+
+  NodePtr parse_alternation() {
+    NodePtr first = parse_concat();
+    if (at_end() || peek() != '|')
+      return first;
+    NodePtr node = std::make_unique<Node>(Node::ALTERNATE);
+    node->children.push_back(std::move(first));
+    while (!at_end() && peek() == '|') {
+      m_pos++;
+      node->children.push_back(parse_concat());
+    }
+    return node;
+  }
+
+  NodePtr parse_concat() {
+    NodePtr node = std::make_unique<Node>(Node::CONCAT);
+    while (!at_end() && peek() != '|' && peek() != ')')
+      node->children.push_back(parse_repeat());
+    if (node->children.empty())
+      return std::make_unique<Node>(Node::EMPTY);
+    if (node->children.size() == 1)
+      return std::move(node->children[0]);
+    return node;
+  }
+
+  NodePtr parse_repeat() {
+    NodePtr atom = parse_atom();
+    while (!at_end()) {
+      int min = 0;
+      int max = 0;
+      char c = peek();
+      if (c == '*') {
+        min = 0, max = -1;
+        m_pos++;
+      } else if (c == '+') {
+        min = 1, max = -1;
+        m_pos++;
+      } else if (c == '?') {
+        min = 0, max = 1;
+        m_pos++;
+      } else if (c == '{' && parse_counted(min, max)) {
+      } else {
+        break;
+      }
+      // A lazy '?' changes which match is found, not whether a line matches
+      if (!at_end() && peek() == '?')
+        m_pos++;
+      if (atom->kind == Node::BOL || atom->kind == Node::EOL)
+        error("nothing to repeat");
+      NodePtr node = std::make_unique<Node>(Node::REPEAT);
+      node->min = min;
+      node->max = max;
+      node->children.push_back(std::move(atom));
+      atom = std::move(node);
+    }
+    return atom;
+  }
+
+  // {m}, {m,} or {m,n}. Anything else leaves m_pos alone and the '{' is
+  // taken literally.
+  bool parse_counted(int &min, int &max) {
+    size_t pos = m_pos + 1;
+    auto number = [&](int &value) {
+      size_t start = pos;
+      value = 0;
+      while (pos < m_pattern.size() && std::isdigit(m_pattern[pos])) {
+        value = std::min(value * 10 + (m_pattern[pos] - '0'), MAX_REPEAT + 1);
+        pos++;
+      }
+      return pos > start;
+    };
+    if (!number(min))
+      return false;
+    max = min;
+    if (pos < m_pattern.size() && m_pattern[pos] == ',') {
+      pos++;
+      if (!number(max))
+        max = -1;
+    }
+    if (pos >= m_pattern.size() || m_pattern[pos] != '}')
+      return false;
+    m_pos = pos + 1;
+    if (min > MAX_REPEAT || max > MAX_REPEAT)
+      error("repeat count above " + std::to_string(MAX_REPEAT));
+    if (max != -1 && max < min)
+      error("bad repeat range");
+    return true;
+  }
+
+  NodePtr parse_atom() {
+    char c = peek();
+    switch (c) {
+    case '(': {
+      m_pos++;
+      if (m_pattern.compare(m_pos, 2, "?:") == 0)
+        m_pos += 2;
+      NodePtr inner = parse_alternation();
+      if (at_end() || peek() != ')')
+        error("missing ')'");
+      m_pos++;
+      return inner;
+    }
+    case '*':
+    case '+':
+    case '?':
+      error("nothing to repeat");
+    case '^':
+      m_pos++;
+      return std::make_unique<Node>(Node::BOL);
+    case '$':
+      m_pos++;
+      return std::make_unique<Node>(Node::EOL);
+    case '.': {
+      m_pos++;
+      std::bitset<256> chars;
+      chars.set();
+      chars['\n'] = false;
+      return chars_node(chars);
+    }
+    case '[':
+      m_pos++;
+      return chars_node(parse_class());
+    case '\\': {
+      m_pos++;
+      std::bitset<256> chars;
+      parse_escape(chars);
+      return chars_node(chars);
+    }
+    default: {
+      m_pos++;
+      std::bitset<256> chars;
+      chars[static_cast<uint8_t>(c)] = true;
+      return chars_node(chars);
+    }
+    }
+  }
+
+  // Handles the part after a backslash, adding what it stands for to
+  // `chars`. Returns the byte for single character escapes, -1 for classes.
+  int parse_escape(std::bitset<256> &chars) {
+    if (at_end())
+      error("trailing backslash");
+    char c = m_pattern[m_pos++];
+    auto add_range = [&](int from, int to) {
+      for (int b = from; b <= to; b++)
+        chars[b] = true;
+    };
+    std::bitset<256> set;
+    switch (c) {
+    case 'd':
+    case 'D':
+      for (int b = '0'; b <= '9'; b++)
+        set[b] = true;
+      break;
+    case 'w':
+    case 'W':
+      for (int b = 0; b < 256; b++)
+        set[b] = std::isalnum(b) || b == '_';
+      break;
+    case 's':
+    case 'S':
+      for (char b : std::string(" \t\n\r\f\v"))
+        set[static_cast<uint8_t>(b)] = true;
+      break;
+    case 'n':
+      add_range('\n', '\n');
+      return '\n';
+    case 't':
+      add_range('\t', '\t');
+      return '\t';
+    case 'r':
+      add_range('\r', '\r');
+      return '\r';
+    default:
+      if (std::isalnum(static_cast<uint8_t>(c)))
+        error(std::string("unsupported escape \\") + c);
+      add_range(static_cast<uint8_t>(c), static_cast<uint8_t>(c));
+      return static_cast<uint8_t>(c);
+    }
+    chars |= std::isupper(static_cast<uint8_t>(c)) ? ~set : set;
+    return -1;
+  }
+
+  std::bitset<256> parse_class() {
+    std::bitset<256> chars;
+    bool negated = false;
+    if (!at_end() && peek() == '^') {
+      negated = true;
+      m_pos++;
+    }
+    bool first = true;
+    while (true) {
+      if (at_end())
+        error("missing ']'");
+      char c = peek();
+      if (c == ']' && !first)
+        break;
+      first = false;
+      m_pos++;
+
+      int low = static_cast<uint8_t>(c);
+      if (c == '\\') {
+        low = parse_escape(chars);
+        if (low < 0)
+          continue; // \d and friends can't start a range
+      }
+      if (m_pos + 1 < m_pattern.size() && peek() == '-' &&
+          m_pattern[m_pos + 1] != ']') {
+        m_pos++;
+        int high = static_cast<uint8_t>(m_pattern[m_pos++]);
+        if (high == '\\') {
+          std::bitset<256> ignored;
+          high = parse_escape(ignored);
+          if (high < 0)
+            error("bad class range");
+        }
+        if (high < low)
+          error("bad class range");
+        for (int b = low; b <= high; b++)
+          chars[b] = true;
+      } else {
+        chars[low] = true;
+      }
+    }
+    m_pos++; // ']'
+    // Folded before negating, so [^a] leaves out 'A' as well
+    fold_case(chars);
+    if (negated) {
+      chars.flip();
+      chars['\n'] = false;
+    }
+    return chars;
+  }
+
+  const std::string &m_pattern;
+  bool m_ignore_case;
+  size_t m_pos = 0;
+};
+
+class NfaBuilder {
+public:
+  explicit NfaBuilder(Nfa &nfa) : m_nfa(nfa) {}
+
+  // Builds `node` so that it continues to state `next` and returns its entry
+  // state. Building back to front means no dangling outputs to patch.
+  int build(const Node &node, int next) {
+    switch (node.kind) {
+    case Node::EMPTY:
+      return next;
+    case Node::CHARS: {
+      m_nfa.char_sets.push_back(node.chars);
+      Nfa::State state{Nfa::CHARS};
+      state.chars = static_cast<int>(m_nfa.char_sets.size() - 1);
+      state.out = next;
+      return add(state);
+    }
+    case Node::BOL:
+    case Node::EOL: {
+      Nfa::State state{node.kind == Node::BOL ? Nfa::BOL : Nfa::EOL};
+      state.out = next;
+      return add(state);
+    }
+    case Node::CONCAT:
+      for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+        next = build(**it, next);
+      return next;
+    case Node::ALTERNATE: {
+      int entry = build(*node.children.back(), next);
+      for (size_t i = node.children.size() - 1; i-- > 0;)
+        entry = split(build(*node.children[i], next), entry);
+      return entry;
+    }
+    case Node::REPEAT:
+      return build_repeat(node, next);
+    }
+    return next;
+  }
+
+private:
+  int add(const Nfa::State &state) {
+    m_nfa.states.push_back(state);
+    return static_cast<int>(m_nfa.states.size() - 1);
+  }
+
+  int split(int out, int out1) {
+    Nfa::State state{Nfa::SPLIT};
+    state.out = out;
+    state.out1 = out1;
+    return add(state);
+  }
+
+  int build_repeat(const Node &node, int next) {
+    const Node &child = *node.children[0];
+    int tail = next;
+    if (node.max == -1) {
+      // x*: a split that either runs the body, which loops back, or leaves
+      int loop = split(-1, next);
+      m_nfa.states[loop].out = build(child, loop);
+      tail = loop;
+    } else {
+      // The optional copies nest: x{0,2} is (x(x)?)?
+      for (int i = node.min; i < node.max; i++)
+        tail = split(build(child, tail), next);
+    }
+    for (int i = 0; i < node.min; i++)
+      tail = build(child, tail);
+    return tail;
+  }
+
+  Nfa &m_nfa;
+};
+
+int single_literal(const Node &node, bool ignore_case) {
+  if (node.kind != Node::CHARS)
+    return -1;
+  size_t count = node.chars.count();
+  for (int b = 0; b < 256; b++) {
+    if (!node.chars[b])
+      continue;
+    if (count == 1)
+      return b;
+    if (count == 2 && ignore_case && std::islower(b) &&
+        node.chars[std::toupper(b)])
+      return b;
+  }
+  return -1;
+}
+
+size_t shortest(const std::vector<std::string> &literals) {
+  size_t length = SIZE_MAX;
+  for (const std::string &literal : literals)
+    length = std::min(length, literal.size());
+  return literals.empty() ? 0 : length;
+}
+
+// A set of literals at least one of which occurs in every match of `node`,
+// or an empty set when there is nothing useful to require.
+std::vector<std::string> required_literals(const Node &node,
+                                           bool ignore_case) {
+  switch (node.kind) {
+  case Node::CHARS: {
+    int c = single_literal(node, ignore_case);
+    if (c < 0)
+      return {};
+    return {std::string(1, static_cast<char>(c))};
+  }
+  case Node::REPEAT:
+    if (node.min == 0)
+      return {};
+    return required_literals(*node.children[0], ignore_case);
+  case Node::ALTERNATE: {
+    std::vector<std::string> all;
+    for (const NodePtr &child : node.children) {
+      std::vector<std::string> literals =
+          required_literals(*child, ignore_case);
+      if (literals.empty() || shortest(literals) == 0)
+        return {};
+      all.insert(all.end(), literals.begin(), literals.end());
+      if (all.size() > MAX_PREFILTER_LITERALS)
+        return {};
+    }
+    return all;
+  }
+  case Node::CONCAT: {
+    // Either a run of consecutive literal characters or whatever a single
+    // child requires; keep the candidate with the longest shortest literal.
+    std::vector<std::string> best;
+    auto consider = [&](std::vector<std::string> candidate) {
+      if (candidate.empty())
+        return;
+      if (shortest(candidate) > shortest(best) ||
+          (shortest(candidate) == shortest(best) &&
+           candidate.size() < best.size()))
+        best = std::move(candidate);
+    };
+    std::string run;
+    for (const NodePtr &child : node.children) {
+      int c = single_literal(*child, ignore_case);
+      if (c >= 0) {
+        run += static_cast<char>(c);
+        continue;
+      }
+      if (!run.empty())
+        consider({run});
+      run.clear();
+      consider(required_literals(*child, ignore_case));
+    }
+    if (!run.empty())
+      consider({run});
+    return best;
+  }
+  default:
+    return {};
+  }
+}
+
+} // namespace
+
+Compiled compile(const std::string &pattern, bool ignore_case) {
+  NodePtr root = Parser(pattern, ignore_case).parse();
+
+  Compiled compiled;
+  Nfa &nfa = compiled.nfa;
+  nfa.states.push_back(Nfa::State{Nfa::MATCH});
+  nfa.start = NfaBuilder(nfa).build(*root, 0);
+
+  compiled.required_literals = required_literals(*root, ignore_case);
+  if (shortest(compiled.required_literals) == 0)
+    compiled.required_literals.clear();
+  compiled.literals_case_folded = ignore_case;
+  return compiled;
+}
+
+RegexMatcher::RegexMatcher(const std::string &pattern, bool ignore_case) {
+  Compiled compiled = compile(pattern, ignore_case);
+  auto program = std::make_shared<Program>();
+  program->nfa = std::move(compiled.nfa);
+  program->required_literals = compiled.required_literals;
+
+  // Bytes no char set tells apart share a class and so a DFA table column.
+  // Start from "newline or not" and split classes by every set in turn.
+  std::array<uint16_t, 256> &byte_class = program->byte_class;
+  byte_class.fill(0);
+  byte_class['\n'] = 1;
+  size_t num_classes = 2;
+  for (const std::bitset<256> &set : program->nfa.char_sets) {
+    std::vector<int> renamed(num_classes * 2, -1);
+    size_t next_class = 0;
+    for (int b = 0; b < 256; b++) {
+      int &slot = renamed[byte_class[b] * 2 + (set[b] ? 1 : 0)];
+      if (slot < 0)
+        slot = static_cast<int>(next_class++);
+      byte_class[b] = static_cast<uint16_t>(slot);
+    }
+    num_classes = next_class;
+  }
+  program->num_classes = num_classes;
+
+  m_program = std::move(program);
+
+  const std::vector<std::string> &literals = compiled.required_literals;
+  if (literals.size() == 1 && !compiled.literals_case_folded) {
+    m_prefilter = std::make_unique<match::LiteralMatcher>(literals[0]);
+  } else if (!literals.empty()) {
+    m_prefilter = std::make_unique<match::AhoCorasickMatcher>(
+        literals, compiled.literals_case_folded);
+  }
+  reset_cache();
+}
+
+RegexMatcher::RegexMatcher(std::shared_ptr<const Program> program,
+                           std::unique_ptr<match::Matcher> prefilter)
+    : m_program(std::move(program)), m_prefilter(std::move(prefilter)) {
+  reset_cache();
+}
+
+std::unique_ptr<match::Matcher> RegexMatcher::clone() const {
+  return std::unique_ptr<match::Matcher>(new RegexMatcher(
+      m_program, m_prefilter ? m_prefilter->clone() : nullptr));
+}
+
+const char *RegexMatcher::find(const char *begin, const char *end) {
+  if (!m_prefilter)
+    return find_in_lines(begin, end);
+
+  // Only lines holding a required literal are worth running the DFA on
+  while (begin < end) {
+    const char *hit = m_prefilter->find(begin, end);
+    if (hit == nullptr)
+      return nullptr;
+    const char *line_start = static_cast<const char *>(
+        memrchr(begin, '\n', static_cast<size_t>(hit - begin)));
+    line_start = line_start ? line_start + 1 : begin;
+    const char *line_end = static_cast<const char *>(
+        std::memchr(hit, '\n', static_cast<size_t>(end - hit)));
+    if (line_end == nullptr)
+      line_end = end;
+
+    const char *match = find_in_lines(line_start, line_end);
+    if (match != nullptr)
+      return match;
+    begin = line_end + 1;
+  }
+  return nullptr;
+}
+
+const char *RegexMatcher::find_in_lines(const char *begin, const char *end) {
+  const std::array<uint16_t, 256> &byte_class = m_program->byte_class;
+  const size_t num_classes = m_program->num_classes;
+
+  const char *p = begin;
+  while (p < end) {
+    int state = line_start_state();
+    if (m_accepting[state])
+      return p;
+    for (; p < end && *p != '\n'; p++) {
+      uint8_t byte = static_cast<uint8_t>(*p);
+      int next = m_transitions[state * num_classes + byte_class[byte]];
+      state = next != UNKNOWN ? next : next_state(state, byte);
+      if (m_accepting[state])
+        return p;
+    }
+    if (matches_at_line_end(state))
+      return p;
+    p++; // Past the newline
+  }
+  return nullptr;
+}
+
+void RegexMatcher::closure(std::vector<int> &seeds, bool at_line_start,
+                           bool at_line_end, std::vector<int> &out) {
+  const Nfa &nfa = m_program->nfa;
+  if (++m_generation == 0) {
+    std::fill(m_visited.begin(), m_visited.end(), 0);
+    m_generation = 1;
+  }
+  out.clear();
+  m_stack.assign(seeds.begin(), seeds.end());
+  while (!m_stack.empty()) {
+    int id = m_stack.back();
+    m_stack.pop_back();
+    if (m_visited[id] == m_generation)
+      continue;
+    m_visited[id] = m_generation;
+
+    const Nfa::State &state = nfa.states[id];
+    switch (state.kind) {
+    case Nfa::CHARS:
+    case Nfa::MATCH:
+      out.push_back(id);
+      break;
+    case Nfa::SPLIT:
+      m_stack.push_back(state.out1);
+      m_stack.push_back(state.out);
+      break;
+    case Nfa::BOL:
+      if (at_line_start)
+        m_stack.push_back(state.out);
+      break;
+    case Nfa::EOL:
+      // Kept in the set until the end of the line decides it
+      if (at_line_end)
+        m_stack.push_back(state.out);
+      else
+        out.push_back(id);
+      break;
+    }
+  }
+  std::sort(out.begin(), out.end());
+}
+
+void RegexMatcher::reset_cache() {
+  m_state_ids.clear();
+  m_state_sets.clear();
+  m_accepting.clear();
+  m_accepting_at_line_end.clear();
+  m_transitions.clear();
+  m_line_start = UNKNOWN;
+  m_visited.assign(m_program->nfa.states.size(), 0);
+  m_generation = 0;
+}
+
+int RegexMatcher::intern(std::vector<int> &&nfa_states) {
+  auto it = m_state_ids.find(nfa_states);
+  if (it != m_state_ids.end())
+    return it->second;
+
+  const Nfa &nfa = m_program->nfa;
+  bool accepting = false;
+  for (int id : nfa_states)
+    accepting |= nfa.states[id].kind == Nfa::MATCH;
+
+  int state = static_cast<int>(m_state_sets.size());
+  m_state_ids.emplace(nfa_states, state);
+  m_state_sets.push_back(std::move(nfa_states));
+  m_accepting.push_back(accepting);
+  m_accepting_at_line_end.push_back(-1);
+  m_transitions.resize(m_transitions.size() + m_program->num_classes,
+                       UNKNOWN);
+  return state;
+}
+
+int RegexMatcher::line_start_state() {
+  if (m_line_start == UNKNOWN) {
+    std::vector<int> seeds{m_program->nfa.start};
+    std::vector<int> set;
+    closure(seeds, true, false, set);
+    m_line_start = intern(std::move(set));
+  }
+  return m_line_start;
+}
+
+int RegexMatcher::next_state(int state, uint8_t byte) {
+  const Nfa &nfa = m_program->nfa;
+  // The search is unanchored: a match may also start at the next byte
+  std::vector<int> seeds{nfa.start};
+  for (int id : m_state_sets[state]) {
+    const Nfa::State &nfa_state = nfa.states[id];
+    if (nfa_state.kind == Nfa::CHARS && nfa.char_sets[nfa_state.chars][byte])
+      seeds.push_back(nfa_state.out);
+  }
+  std::vector<int> set;
+  closure(seeds, false, false, set);
+
+  if (m_state_sets.size() >= MAX_DFA_STATES) {
+    reset_cache();
+    return intern(std::move(set));
+  }
+  int next = intern(std::move(set));
+  m_transitions[state * m_program->num_classes + m_program->byte_class[byte]] =
+      next;
+  return next;
+}
+
+bool RegexMatcher::matches_at_line_end(int state) {
+  if (m_accepting_at_line_end[state] < 0) {
+    std::vector<int> seeds = m_state_sets[state];
+    std::vector<int> set;
+    closure(seeds, false, true, set);
+    bool accepting = false;
+    for (int id : set)
+      accepting |= m_program->nfa.states[id].kind == Nfa::MATCH;
+    m_accepting_at_line_end[state] = accepting;
+  }
+  return m_accepting_at_line_end[state];
+}
+
+} // namespace regex
@@ -0,0 +1,99 @@
+#ifndef REGEX_ENGINE_H
+#define REGEX_ENGINE_H
+
+#include "matcher.h"
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Line oriented regex search for file_searcher. The pattern is parsed into a
+// Thompson NFA once; searching runs a DFA whose states are built lazily from
+// NFA state sets as the input needs them and cached per matcher, so each byte
+// costs one table lookup once the cache is warm.
+//
+// Supported syntax: literals, '.', [classes] with ranges and negation,
+// \d \w \s \D \W \S and escaped metacharacters, (groups), (?:groups), '|',
+// '*', '+', '?', {m}, {m,}, {m,n}, '^' and '$'. A pattern matches a line if
+// it matches anywhere inside it, like grep.
+namespace regex {
+
+struct Nfa {
+  enum Kind : uint8_t { CHARS, SPLIT, BOL, EOL, MATCH };
+  struct State {
+    Kind kind;
+    int chars = -1; // Index into char_sets for CHARS
+    int out = -1;
+    int out1 = -1; // Second branch of SPLIT
+  };
+
+  std::vector<State> states;
+  std::vector<std::bitset<256>> char_sets;
+  int start = -1;
+};
+
+struct Compiled {
+  Nfa nfa;
+  // Every matching line contains at least one of these; empty when no such
+  // set could be derived and the whole input has to go through the DFA.
+  std::vector<std::string> required_literals;
+  bool literals_case_folded = false;
+};
+
+// Throws std::invalid_argument describing the first syntax error.
+Compiled compile(const std::string &pattern, bool ignore_case);
+
+class RegexMatcher : public match::Matcher {
+public:
+  RegexMatcher(const std::string &pattern, bool ignore_case);
+
+  const char *find(const char *begin, const char *end) override;
+  std::unique_ptr<match::Matcher> clone() const override;
+  std::vector<std::string> required_literals() const override {
+    return m_program->required_literals;
+  }
+
+private:
+  struct Program {
+    Nfa nfa;
+    std::array<uint16_t, 256> byte_class;
+    size_t num_classes = 0;
+    std::vector<std::string> required_literals;
+  };
+
+  static constexpr int UNKNOWN = -1;
+
+  RegexMatcher(std::shared_ptr<const Program> program,
+               std::unique_ptr<match::Matcher> prefilter);
+
+  const char *find_in_lines(const char *begin, const char *end);
+  int intern(std::vector<int> &&nfa_states);
+  int line_start_state();
+  int next_state(int state, uint8_t byte);
+  bool matches_at_line_end(int state);
+  void closure(std::vector<int> &seeds, bool at_line_start, bool at_line_end,
+               std::vector<int> &out);
+  void reset_cache();
+
+  std::shared_ptr<const Program> m_program;
+  std::unique_ptr<match::Matcher> m_prefilter;
+
+  // The lazy DFA. Dropped and rebuilt from scratch when it grows too big.
+  std::map<std::vector<int>, int> m_state_ids;
+  std::vector<std::vector<int>> m_state_sets;
+  std::vector<uint8_t> m_accepting;
+  std::vector<int8_t> m_accepting_at_line_end; // -1 until computed
+  std::vector<int> m_transitions;              // state * num_classes + class
+  int m_line_start = UNKNOWN;
+
+  // Scratch space for closure()
+  std::vector<uint32_t> m_visited;
+  uint32_t m_generation = 0;
+  std::vector<int> m_stack;
+};
+
+} // namespace regex
+#endif // !REGEX_ENGINE_H
@@ -0,0 +1,250 @@
+#include "scan_engine.h"
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#endif
+
+namespace scan {
+
+namespace {
+
+const size_t READ_BLOCK_SIZE = 1 << 20;
+
+bool match_rest(const char *candidate, std::string_view needle) {
+  // First and last bytes are already known to match
+  return needle.size() <= 2 ||
+         std::memcmp(candidate + 1, needle.data() + 1, needle.size() - 2) == 0;
+}
+
+const char *find_literal_scalar(const char *begin, const char *end,
+                                std::string_view needle) {
+  const size_t n = needle.size();
+  const char first = needle[0];
+  while (static_cast<size_t>(end - begin) >= n) {
+    // glibc's memchr is vectorized already, it makes a good first filter
+    begin = static_cast<const char *>(
+        std::memchr(begin, first, static_cast<size_t>(end - begin) - n + 1));
+    if (begin == nullptr)
+      return nullptr;
+    if (begin[n - 1] == needle[n - 1] && match_rest(begin, needle))
+      return begin;
+    begin++;
+  }
+  return nullptr;
+}
+
+size_t count_newlines_scalar(const char *begin, const char *end) {
+  size_t count = 0;
+  while ((begin = static_cast<const char *>(
+              std::memchr(begin, '\n', static_cast<size_t>(end - begin))))) {
+    count++;
+    begin++;
+  }
+  return count;
+}
+
+#ifdef SCAN_HAVE_X86
+
+// Compare a block of candidate start positions against the needle's first
+// byte and the block shifted by n-1 against its last byte; only positions
+// where both agree get a full compare. Rare bytes at both ends make false
+// positives very unlikely on real text.
+__attribute__((target("sse2"))) const char *
+find_literal_sse2(const char *begin, const char *end, std::string_view needle) {
+  const size_t n = needle.size();
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[n - 1]);
+  const char *p = begin;
+
+  while (p + n - 1 + 16 <= end) {
+    __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i block_last =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + n - 1));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                      _mm_cmpeq_epi8(block_last, last))));
+    while (mask != 0) {
+      int bit = __builtin_ctz(mask);
+      if (match_rest(p + bit, needle))
+        return p + bit;
+      mask &= mask - 1;
+    }
+    p += 16;
+  }
+  return find_literal_scalar(p, end, needle);
+}
+
+__attribute__((target("avx2"))) const char *
+find_literal_avx2(const char *begin, const char *end, std::string_view needle) {
+  const size_t n = needle.size();
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[n - 1]);
+  const char *p = begin;
+
+  while (p + n - 1 + 32 <= end) {
+    __m256i block_first =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i block_last =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + n - 1));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                         _mm256_cmpeq_epi8(block_last, last))));
+    while (mask != 0) {
+      int bit = __builtin_ctz(mask);
+      if (match_rest(p + bit, needle))
+        return p + bit;
+      mask &= mask - 1;
+    }
+    p += 32;
+  }
+  return find_literal_sse2(p, end, needle);
+}
+
+__attribute__((target("avx2,popcnt"))) size_t
+count_newlines_avx2(const char *begin, const char *end) {
+  const __m256i newline = _mm256_set1_epi8('\n');
+  size_t count = 0;
+  const char *p = begin;
+  while (p + 32 <= end) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    count += static_cast<size_t>(__builtin_popcount(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)))));
+    p += 32;
+  }
+  return count + count_newlines_scalar(p, end);
+}
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2") &&
+                               __builtin_cpu_supports("popcnt");
+  return has_avx2;
+}
+
+#endif // SCAN_HAVE_X86
+
+} // namespace
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(const std::string &path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int saved_errno = errno;
+    ::close(fd);
+    errno = saved_errno;
+    return false;
+  }
+
+  // Regular files with a size are mapped; /proc files, pipes and the like
+  // report 0 and have to be read.
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                         MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      madvise(mapping, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+      m_data = static_cast<const char *>(mapping);
+      m_size = static_cast<size_t>(st.st_size);
+      m_mapped = true;
+      ::close(fd); // The mapping keeps its own reference
+      return true;
+    }
+  }
+
+  bool ok = read_fallback(fd);
+  int saved_errno = errno;
+  ::close(fd);
+  errno = saved_errno;
+  return ok;
+}
+
+bool MappedFile::read_fallback(int fd) {
+  size_t used = 0;
+  while (true) {
+    if (m_buffer.size() - used < READ_BLOCK_SIZE)
+      m_buffer.resize(used + READ_BLOCK_SIZE);
+    ssize_t n = read(fd, m_buffer.data() + used, READ_BLOCK_SIZE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0)
+      break;
+    used += static_cast<size_t>(n);
+  }
+  m_buffer.resize(used);
+  m_data = m_buffer.data();
+  m_size = used;
+  return true;
+}
+
+void MappedFile::close() {
+  if (m_mapped)
+    munmap(const_cast<char *>(m_data), m_size);
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+  m_buffer.clear();
+}
+
+const char *find_literal(const char *begin, const char *end,
+                         std::string_view needle) {
+  if (needle.empty())
+    return begin;
+  if (static_cast<size_t>(end - begin) < needle.size())
+    return nullptr;
+  if (needle.size() == 1)
+    return static_cast<const char *>(
+        std::memchr(begin, needle[0], static_cast<size_t>(end - begin)));
+#ifdef SCAN_HAVE_X86
+  if (cpu_has_avx2())
+    return find_literal_avx2(begin, end, needle);
+  return find_literal_sse2(begin, end, needle);
+#else
+  return find_literal_scalar(begin, end, needle);
+#endif
+}
+
+size_t count_newlines(const char *begin, const char *end) {
+#ifdef SCAN_HAVE_X86
+  if (cpu_has_avx2())
+    return count_newlines_avx2(begin, end);
+#endif
+  return count_newlines_scalar(begin, end);
+}
+
+std::string_view line_aligned_chunk(std::string_view data, size_t begin,
+                                    size_t end) {
+  // Both edges resolve the same way: a line starts right after the first
+  // newline at or past `offset - 1`.
+  auto line_start_from = [&](size_t offset) {
+    if (offset == 0)
+      return size_t(0);
+    if (offset >= data.size())
+      return data.size();
+    const void *newline =
+        std::memchr(data.data() + offset - 1, '\n', data.size() - offset + 1);
+    return newline ? static_cast<size_t>(static_cast<const char *>(newline) -
+                                         data.data()) +
+                         1
+                   : data.size();
+  };
+  size_t first = line_start_from(begin);
+  size_t last = line_start_from(end);
+  if (first >= last)
+    return std::string_view(data.data() + first, 0);
+  return data.substr(first, last - first);
+}
+
+} // namespace scan
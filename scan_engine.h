@@ -0,0 +1,93 @@
+#ifndef SCAN_ENGINE_H
+#define SCAN_ENGINE_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Whole-buffer substring search for file_searcher. Files are mapped (or read
+// in large blocks when they can't be mapped) and searched in one pass with a
+// vectorized first/last byte filter; line numbers and line bounds are only
+// worked out around the matches.
+namespace scan {
+
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Returns false with errno set if the file can't be opened or read.
+  bool open(const std::string &path);
+  void close();
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  std::string_view view() const { return std::string_view(m_data, m_size); }
+
+private:
+  bool read_fallback(int fd);
+
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+  bool m_mapped = false;
+  std::vector<char> m_buffer;
+};
+
+// First occurrence of `needle` in [begin, end), or nullptr.
+const char *find_literal(const char *begin, const char *end,
+                         std::string_view needle);
+
+size_t count_newlines(const char *begin, const char *end);
+
+// The lines of `data` that start inside [begin, end), newline included. The
+// regions returned for consecutive byte ranges tile the buffer exactly, so
+// each line, and every match in it, belongs to exactly one chunk no matter
+// where the byte boundaries fall.
+std::string_view line_aligned_chunk(std::string_view data, size_t begin,
+                                    size_t end);
+
+// Calls on_match(line_number, line) for every line of `data` that `find`
+// reports, in order, until on_match returns false. `find(begin, end)` is
+// called with `begin` at the start of a line and returns a position inside
+// the first matching line (its '\n' included) or nullptr. Lines are split on
+// '\n' like std::getline; the line passed on excludes the newline. Returns
+// the number of newlines in `data`, or up to the last reported line when
+// stopped early; a chunked search needs it to rebase its line numbers.
+template <typename Finder, typename Callback>
+size_t scan_lines(std::string_view data, Finder &&find, Callback &&on_match) {
+  const char *begin = data.data();
+  const char *end = begin + data.size();
+  const char *cursor = begin;
+  size_t line_number = 1; // Line number of the line starting at `cursor`
+
+  while (cursor < end) {
+    const char *hit = find(cursor, end);
+    if (hit == nullptr)
+      break;
+
+    const char *line_start = static_cast<const char *>(
+        memrchr(cursor, '\n', static_cast<size_t>(hit - cursor)));
+    line_start = line_start ? line_start + 1 : cursor;
+    line_number += count_newlines(cursor, line_start);
+
+    const char *line_end =
+        static_cast<const char *>(std::memchr(hit, '\n', end - hit));
+    bool more = on_match(line_number,
+                         std::string_view(line_start,
+                                          (line_end ? line_end : end) -
+                                              line_start));
+    if (line_end == nullptr || !more)
+      return line_number - 1 + (line_end != nullptr);
+
+    cursor = line_end + 1;
+    line_number++;
+  }
+  return line_number - 1 + count_newlines(cursor, end);
+}
+
+} // namespace scan
+#endif // !SCAN_ENGINE_H
@@ -0,0 +1,291 @@
+#include "series_store.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace history {
+
+namespace {
+
+const char MAGIC[8] = {'M', 'O', 'N', 'R', 'I', 'N', 'G', '1'};
+const uint32_t VERSION = 1;
+
+// Bucket width per tier; the raw tier has none
+const int64_t TIER_WIDTH_MS[TIER_COUNT] = {0, 1000, 60 * 1000,
+                                           60 * 60 * 1000};
+
+size_t entry_size(size_t tier) {
+  return tier == 0 ? sizeof(Sample) : sizeof(Bucket);
+}
+
+size_t ring_bytes(size_t tier, uint32_t capacity) {
+  return sizeof(RingHeader) + capacity * entry_size(tier);
+}
+
+size_t series_bytes(const uint32_t capacity[TIER_COUNT]) {
+  size_t bytes = 0;
+  for (size_t tier = 0; tier < TIER_COUNT; tier++)
+    bytes += ring_bytes(tier, capacity[tier]);
+  return bytes;
+}
+
+// Slot of the i-th oldest entry
+inline uint64_t slot(const RingHeader &ring, uint64_t capacity, uint64_t i) {
+  return (ring.next + capacity - ring.count + i) % capacity;
+}
+
+inline uint64_t last_slot(const RingHeader &ring, uint64_t capacity) {
+  return (ring.next + capacity - 1) % capacity;
+}
+
+// Makes the entry visible before the ring header that points at it, for
+// readers mapping the same file
+inline void advance(RingHeader &ring, uint64_t capacity) {
+  std::atomic_thread_fence(std::memory_order_release);
+  ring.next = (ring.next + 1) % capacity;
+  if (ring.count < capacity)
+    ring.count++;
+}
+
+} // namespace
+
+int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+Store::~Store() { close(); }
+
+void Store::close() {
+  if (m_base != nullptr)
+    munmap(m_base, m_size);
+  m_base = nullptr;
+  m_header = nullptr;
+  m_size = 0;
+}
+
+bool Store::map(const std::string &path, bool writable) {
+  close();
+  int fd = ::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  if (fd < 0) {
+    perror(("Error: Could not open " + path).c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    std::cerr << "Error: " << path << " is not a history file" << std::endl;
+    ::close(fd);
+    return false;
+  }
+  int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *mapping = mmap(nullptr, static_cast<size_t>(st.st_size), protection,
+                       MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    perror(("Error: Could not map " + path).c_str());
+    return false;
+  }
+  m_base = static_cast<char *>(mapping);
+  m_size = static_cast<size_t>(st.st_size);
+  m_header = reinterpret_cast<Header *>(m_base);
+
+  const Header &h = *m_header;
+  bool valid =
+      memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 && h.version == VERSION &&
+      h.file_size == m_size &&
+      h.series_offset + h.series_count * sizeof(SeriesEntry) <= m_size &&
+      h.series_offset + h.series_count * sizeof(SeriesEntry) +
+              h.series_count * series_bytes(h.capacity) ==
+          m_size;
+  for (size_t tier = 0; valid && tier < TIER_COUNT; tier++)
+    valid = h.capacity[tier] > 0;
+  if (!valid) {
+    std::cerr << "Error: " << path << " is not a valid history file"
+              << std::endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool Store::open(const std::string &path,
+                 const std::vector<std::string> &series,
+                 const StoreOptions &options) {
+  for (const std::string &name : series) {
+    if (name.empty() || name.size() >= sizeof(SeriesEntry::name)) {
+      std::cerr << "Error: Invalid series name '" << name << "'" << std::endl;
+      return false;
+    }
+  }
+
+  if (access(path.c_str(), F_OK) != 0) {
+    // Laid out in a temporary file and renamed, so a crash can't leave a
+    // half-initialized store behind
+    size_t series_offset = sizeof(Header);
+    size_t size = series_offset + series.size() * sizeof(SeriesEntry) +
+                  series.size() * series_bytes(options.capacity);
+    std::string temp_path = path + ".tmp";
+    int fd = ::open(temp_path.c_str(),
+                    O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      perror(("Error: Could not create " + temp_path).c_str());
+      if (fd >= 0)
+        ::close(fd);
+      return false;
+    }
+    void *mapping =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      perror(("Error: Could not map " + temp_path).c_str());
+      return false;
+    }
+    // Everything else, ring headers included, starts out zero
+    char *base = static_cast<char *>(mapping);
+    Header &header = *reinterpret_cast<Header *>(base);
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.series_count = static_cast<uint32_t>(series.size());
+    std::copy(options.capacity, options.capacity + TIER_COUNT,
+              header.capacity);
+    header.series_offset = series_offset;
+    header.file_size = size;
+    auto *entries = reinterpret_cast<SeriesEntry *>(base + series_offset);
+    size_t offset = series_offset + series.size() * sizeof(SeriesEntry);
+    for (size_t i = 0; i < series.size(); i++) {
+      strncpy(entries[i].name, series[i].c_str(), sizeof(entries[i].name));
+      entries[i].offset = offset;
+      offset += series_bytes(options.capacity);
+    }
+    munmap(mapping, size);
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+      perror(("Error: Could not create " + path).c_str());
+      return false;
+    }
+  }
+
+  if (!map(path, true))
+    return false;
+  bool same = m_header->series_count == series.size() &&
+              std::equal(options.capacity, options.capacity + TIER_COUNT,
+                         m_header->capacity);
+  for (size_t i = 0; same && i < series.size(); i++)
+    same = series_name(i) == series[i];
+  if (!same) {
+    std::cerr << "Error: " << path
+              << " was created with other series or sizes" << std::endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool Store::open_read_only(const std::string &path) {
+  return map(path, false);
+}
+
+std::string Store::series_name(size_t series) const {
+  const auto *entries =
+      reinterpret_cast<const SeriesEntry *>(m_base + m_header->series_offset);
+  const char *name = entries[series].name;
+  return std::string(name, strnlen(name, sizeof(entries[series].name)));
+}
+
+int Store::find_series(const std::string &name) const {
+  for (size_t i = 0; i < series_count(); i++) {
+    if (series_name(i) == name)
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+
+RingHeader *Store::ring(size_t series, Tier tier) const {
+  const auto *entries =
+      reinterpret_cast<const SeriesEntry *>(m_base + m_header->series_offset);
+  size_t offset = entries[series].offset;
+  for (size_t t = 0; t < static_cast<size_t>(tier); t++)
+    offset += ring_bytes(t, m_header->capacity[t]);
+  return reinterpret_cast<RingHeader *>(m_base + offset);
+}
+
+void Store::append(size_t series, int64_t time_ms, double value) {
+  RingHeader &raw = *ring(series, Tier::RAW);
+  uint64_t capacity = m_header->capacity[0];
+  auto *samples = reinterpret_cast<Sample *>(&raw + 1);
+  if (raw.count > 0)
+    time_ms = std::max(time_ms, samples[last_slot(raw, capacity)].time_ms);
+  samples[raw.next] = Sample{time_ms, value};
+  advance(raw, capacity);
+
+  for (size_t tier = 1; tier < TIER_COUNT; tier++) {
+    RingHeader &ring_header = *ring(series, static_cast<Tier>(tier));
+    capacity = m_header->capacity[tier];
+    auto *buckets = reinterpret_cast<Bucket *>(&ring_header + 1);
+    int64_t start = time_ms - time_ms % TIER_WIDTH_MS[tier];
+    if (ring_header.count > 0) {
+      Bucket &last = buckets[last_slot(ring_header, capacity)];
+      if (last.start_ms >= start) {
+        last.min = std::min(last.min, value);
+        last.max = std::max(last.max, value);
+        last.sum += value;
+        last.count++;
+        continue;
+      }
+    }
+    buckets[ring_header.next] = Bucket{start, value, value, value, 1};
+    advance(ring_header, capacity);
+  }
+}
+
+void Store::query(size_t series, Tier tier, int64_t from_ms, int64_t to_ms,
+                  std::vector<Point> &points) const {
+  points.clear();
+  size_t t = static_cast<size_t>(tier);
+  RingHeader ring_header = *ring(series, tier);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t capacity = m_header->capacity[t];
+  const void *entries = ring(series, tier) + 1;
+  const int64_t width = TIER_WIDTH_MS[t];
+
+  auto time_at = [&](uint64_t i) {
+    uint64_t s = slot(ring_header, capacity, i);
+    return t == 0 ? static_cast<const Sample *>(entries)[s].time_ms
+                  : static_cast<const Bucket *>(entries)[s].start_ms;
+  };
+
+  // First entry that ends at or after from_ms; entries are in time order
+  uint64_t low = 0, high = ring_header.count;
+  while (low < high) {
+    uint64_t mid = low + (high - low) / 2;
+    if (time_at(mid) + std::max<int64_t>(width - 1, 0) < from_ms)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  for (uint64_t i = low; i < ring_header.count && time_at(i) <= to_ms; i++) {
+    uint64_t s = slot(ring_header, capacity, i);
+    if (t == 0) {
+      const Sample &sample = static_cast<const Sample *>(entries)[s];
+      points.push_back(
+          {sample.time_ms, sample.value, sample.value, sample.value});
+    } else {
+      const Bucket &bucket = static_cast<const Bucket *>(entries)[s];
+      points.push_back({bucket.start_ms, bucket.min,
+                        bucket.sum / static_cast<double>(bucket.count),
+                        bucket.max});
+    }
+  }
+}
+
+} // namespace history
@@ -0,0 +1,118 @@
+#ifndef SERIES_STORE_H
+#define SERIES_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Fixed-size, round-robin history for the system monitors. Every series
+// keeps its latest raw samples plus min/avg/max over 1 second, 1 minute and
+// 1 hour buckets, each in a ring of its own, so old data ages out tier by
+// tier and the file never grows. It is used straight from a shared mmap:
+// samples survive a restart of the monitor, and readers can query a file
+// that is being written.
+//
+// Layout, every ring sized when the file is created:
+//   Header
+//   SeriesEntry[series_count]
+//   per series:  RingHeader, Sample[raw_capacity]
+//                RingHeader, Bucket[capacity] for each bucketed tier
+namespace history {
+
+enum class Tier { RAW, SECOND, MINUTE, HOUR };
+const size_t TIER_COUNT = 4;
+
+struct StoreOptions {
+  // Ring sizes per tier. The defaults keep about an hour of 10 Hz samples,
+  // a day of seconds, a week of minutes and a year of hours: some 4.8 MB
+  // per series.
+  uint32_t capacity[TIER_COUNT] = {36000, 86400, 10080, 8760};
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t series_count;
+  uint32_t capacity[TIER_COUNT];
+  uint64_t series_offset;
+  uint64_t file_size;
+};
+
+struct SeriesEntry {
+  char name[48];
+  uint64_t offset; // Of the series' first ring
+};
+
+struct RingHeader {
+  uint64_t next; // Slot the next entry goes to
+  uint64_t count;
+};
+
+struct Sample {
+  int64_t time_ms;
+  double value;
+};
+
+struct Bucket {
+  int64_t start_ms;
+  double min;
+  double max;
+  double sum;
+  uint64_t count;
+};
+
+// One query result. Raw samples have min == avg == max.
+struct Point {
+  int64_t time_ms;
+  double min;
+  double avg;
+  double max;
+};
+
+class Store {
+public:
+  Store() = default;
+  ~Store();
+  Store(const Store &) = delete;
+  Store &operator=(const Store &) = delete;
+
+  // Opens the store at `path` for writing, creating it with these series
+  // and ring sizes if it doesn't exist. An existing file has to have been
+  // created with the same ones. Returns false with a message on stderr.
+  bool open(const std::string &path, const std::vector<std::string> &series,
+            const StoreOptions &options = StoreOptions());
+  // Opens an existing store read-only, whatever its series.
+  bool open_read_only(const std::string &path);
+  void close();
+
+  size_t series_count() const { return m_header ? m_header->series_count : 0; }
+  std::string series_name(size_t series) const;
+  // Index of the series with this name, or -1.
+  int find_series(const std::string &name) const;
+
+  // Records a sample and folds it into the current bucket of every tier.
+  // Times are expected to only move forward; an earlier one is recorded as
+  // if taken at the latest time seen.
+  void append(size_t series, int64_t time_ms, double value);
+
+  // The entries of `tier` overlapping [from_ms, to_ms], oldest first, in
+  // `points` (which is cleared). Finds the start by binary search, so the
+  // cost is in the number of points returned, not the size of the ring.
+  void query(size_t series, Tier tier, int64_t from_ms, int64_t to_ms,
+             std::vector<Point> &points) const;
+
+private:
+  bool map(const std::string &path, bool writable);
+  RingHeader *ring(size_t series, Tier tier) const;
+
+  Header *m_header = nullptr;
+  char *m_base = nullptr;
+  size_t m_size = 0;
+};
+
+// Milliseconds since the epoch, the time base of the store.
+int64_t now_ms();
+
+} // namespace history
+#endif // !SERIES_STORE_H
@@ -1,67 +1,97 @@
+// Build:
+//   g++ -std=c++17 -O2 -pthread sys_details.cpp cpu_topology.cpp
+//       -o sys_details
+//
+// Usage: sys_details [workers]
+//   Prints the CPU layout and where `workers` threads (default: one per
+//   CPU) would best be pinned.
+#include "cpu_topology.h"
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <ostream>
-#include <set>
-#include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
-int main() {
+namespace {
+
+std::string FormatSize(uint64_t bytes) {
+  if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0) {
+    return std::to_string(bytes / (1024 * 1024)) + " MiB";
+  }
+  return std::to_string(bytes / 1024) + " KiB";
+}
+
+void PrintCaches(const topology::Topology &machine) {
+  std::cout << "Caches:" << std::endl;
+  for (const topology::Cache &cache : machine.caches()) {
+    const char *type = cache.type == 'D'   ? "d"
+                       : cache.type == 'I' ? "i"
+                                           : "";
+    std::cout << "  L" << cache.level << type << " "
+              << FormatSize(cache.size_bytes) << "\tshared by CPUs "
+              << topology::format_cpu_list(cache.cpus) << std::endl;
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
   unsigned int num_cores = std::thread::hardware_concurrency();
   std::cout << "Number of cores are " << num_cores << std::endl;
 
+  // The model name is only in cpuinfo; the layout comes from sysfs
   std::ifstream cpu_info_file("/proc/cpuinfo");
   std::string line;
-  int processors = 0;
   std::string model_name;
-  std::set<std::pair<int, int>> physical_cores;
-
-  if (!cpu_info_file.is_open()) {
-    std::cerr << "Couldn't open cpuinfo file" << std::endl;
-    return 1;
-  }
-
-  int current_physical_id = -1;
-  int current_core_id = -1;
-
   while (std::getline(cpu_info_file, line)) {
-    // if the line start with processor; which means the processor
-    // specification begins
-    if (line.find("processor") == 0) {
-      processors++;
-    }
+    // model name      : AMD Ryzen 5 5500U with Radeon Graphics
     if (line.find("model name") == 0) {
-      // We just need any of the model as all processor core model name come
-      // under one processor
-      if (model_name.empty()) {
-        model_name = line.substr(
-            line.find(":") +
-            2); // model name      : AMD Ryzen 5 5500U with Radeon Graphics
-      }
-    }
-
-    if (line.find("physical id") == 0) {
-      std::stringstream pysical_id(line.substr(line.find(":") + 2));
-      pysical_id >> current_physical_id;
+      model_name = line.substr(line.find(":") + 2);
+      break;
     }
-    if (line.find("core id") == 0) {
-      std::stringstream core_id(line.substr(line.find(":") + 2));
-      core_id >> current_core_id;
+  }
 
-      if (current_physical_id != -1 && current_core_id != -1) {
-        physical_cores.insert({current_physical_id, current_core_id});
-      }
-    }
+  topology::Topology machine;
+  if (!machine.load()) {
+    return 1;
   }
-  cpu_info_file.close();
   std::cout << "CPU Information:" << std::endl;
   std::cout << "  Model name is : " << model_name << std::endl;
-  std::cout << "  Logical processors (threads) is : " << processors
+  std::cout << "  Logical processors (threads) is : " << machine.cpus().size()
             << std::endl;
-  std::cout << "  Physical cores is : " << physical_cores.size() << std::endl;
+  std::cout << "  Physical cores is : " << machine.cores().size() << std::endl;
+  std::cout << "  Sockets is : " << machine.package_count() << std::endl;
+  std::cout << "  NUMA nodes is : " << machine.nodes().size() << std::endl;
+
+  for (const topology::Core &core : machine.cores()) {
+    std::cout << "Physical core id : " << core.package << "\t"
+              << "Core id : " << core.core_id << "\t"
+              << "Node : " << core.node << "\t"
+              << "Threads : " << topology::format_cpu_list(core.threads)
+              << std::endl;
+  }
+  PrintCaches(machine);
+  std::cout << "NUMA nodes:" << std::endl;
+  for (const topology::Node &node : machine.nodes()) {
+    std::cout << "  node" << node.id << "\tCPUs "
+              << topology::format_cpu_list(node.cpus);
+    if (node.memory_kb > 0) {
+      std::cout << "\t" << node.memory_kb / 1024 << " MiB";
+    }
+    std::cout << std::endl;
+  }
 
-  for (auto pair : physical_cores) {
-    std::cout << "Physical core id : " << pair.first << "\t"
-              << "Core id : " << pair.second << std::endl;
+  size_t workers = machine.cpus().size();
+  if (argc > 1) {
+    workers = static_cast<size_t>(std::max(1, std::atoi(argv[1])));
+  }
+  std::vector<int> plan = machine.pinning_plan(workers);
+  std::cout << "Pinning plan for " << workers << " workers :";
+  for (int cpu : plan) {
+    std::cout << " " << cpu;
   }
+  std::cout << std::endl;
 }
@@ -0,0 +1,219 @@
+#include "term_render.h"
+#include "instrument.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace term {
+
+namespace {
+
+volatile sig_atomic_t g_resized = 0;
+volatile sig_atomic_t g_quit = 0;
+
+// A cursor movement takes at least six bytes
+const int SHORT_GAP = 4;
+
+void on_resize(int) { g_resized = 1; }
+void on_quit(int) { g_quit = 1; }
+
+// Without SA_RESTART, so a signal cuts a wait short and the frame is redrawn
+// (or the loop ends) right away
+void install(int signal_number, void (*handler)(int)) {
+  struct sigaction action = {};
+  action.sa_handler = handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(signal_number, &action, nullptr);
+}
+
+const char *sgr(Style style) {
+  switch (style) {
+  case Style::NORMAL:
+    return "\x1b[0m";
+  case Style::BOLD:
+    return "\x1b[0;1m";
+  case Style::DIM:
+    return "\x1b[0;2m";
+  case Style::GOOD:
+    return "\x1b[0;32m";
+  case Style::WARN:
+    return "\x1b[0;33m";
+  case Style::BAD:
+    return "\x1b[0;1;31m";
+  case Style::INVERSE:
+    return "\x1b[0;7m";
+  }
+  return "\x1b[0m";
+}
+
+} // namespace
+
+Screen::Screen() {
+  install(SIGWINCH, on_resize);
+  install(SIGINT, on_quit);
+  install(SIGTERM, on_quit);
+  if (tcgetattr(STDIN_FILENO, &m_saved_termios) == 0) {
+    termios raw = m_saved_termios;
+    raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    m_restore_termios = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+  }
+  m_read_keys = isatty(STDIN_FILENO);
+  // Alternate screen, cursor hidden
+  write_all("\x1b[?1049h\x1b[?25l");
+  update_size();
+}
+
+Screen::~Screen() {
+  write_all("\x1b[0m\x1b[?25h\x1b[?1049l");
+  if (m_restore_termios)
+    tcsetattr(STDIN_FILENO, TCSANOW, &m_saved_termios);
+  signal(SIGWINCH, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+}
+
+void Screen::update_size() {
+  struct winsize size;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 &&
+      size.ws_row > 0) {
+    m_width = size.ws_col;
+    m_height = size.ws_row;
+  }
+  size_t cells = static_cast<size_t>(m_width) * m_height;
+  m_back.assign(cells, Cell());
+  m_front.assign(cells, Cell());
+  m_full_redraw = true;
+}
+
+void Screen::clear() {
+  if (g_resized) {
+    g_resized = 0;
+    update_size();
+  }
+  std::fill(m_back.begin(), m_back.end(), Cell());
+}
+
+void Screen::print(int row, int col, std::string_view text, Style style) {
+  if (row < 0 || row >= m_height)
+    return;
+  Cell *line = &m_back[static_cast<size_t>(row) * m_width];
+  for (size_t i = 0; i < text.size(); i++) {
+    int x = col + static_cast<int>(i);
+    if (x >= m_width)
+      break;
+    if (x >= 0)
+      line[x] = Cell{text[i] == '\t' ? ' ' : text[i], style};
+  }
+}
+
+int Screen::print_lines(int row, int col, std::string_view text,
+                        Style style) {
+  while (!text.empty()) {
+    size_t end = text.find('\n');
+    print(row++, col, text.substr(0, end), style);
+    if (end == std::string_view::npos)
+      break;
+    text.remove_prefix(end + 1);
+  }
+  return row;
+}
+
+void Screen::bar(int row, int col, int width, double fraction, Style style) {
+  if (width < 3)
+    return;
+  int inner = width - 2;
+  int filled = static_cast<int>(std::clamp(fraction, 0.0, 1.0) * inner + 0.5);
+  print(row, col, "[", Style::DIM);
+  print(row, col + 1, std::string(filled, '|'), style);
+  print(row, col + 1 + filled, std::string(inner - filled, ' '));
+  print(row, col + 1 + inner, "]", Style::DIM);
+}
+
+void Screen::present() {
+  INSTRUMENT_SCOPE("screen.present");
+  m_output.clear();
+  if (m_full_redraw) {
+    m_output += "\x1b[0m\x1b[2J";
+    m_style = Style::NORMAL;
+    std::fill(m_front.begin(), m_front.end(), Cell());
+  }
+
+  auto emit = [this](size_t i) {
+    if (m_back[i].style != m_style) {
+      m_output += sgr(m_back[i].style);
+      m_style = m_back[i].style;
+    }
+    m_output += m_back[i].ch;
+    m_front[i] = m_back[i];
+  };
+
+  // Where the cursor is, as far as is known
+  int cursor_row = -1, cursor_col = -1;
+  for (int row = 0; row < m_height; row++) {
+    size_t line = static_cast<size_t>(row) * m_width;
+    for (int col = 0; col < m_width; col++) {
+      if (m_back[line + col] == m_front[line + col])
+        continue;
+      if (row == cursor_row && col > cursor_col &&
+          col - cursor_col <= SHORT_GAP) {
+        // Rewriting a few unchanged cells is shorter than moving past them
+        for (int skipped = cursor_col; skipped < col; skipped++)
+          emit(line + skipped);
+      } else if (row != cursor_row || col != cursor_col) {
+        m_output += "\x1b[";
+        m_output += std::to_string(row + 1);
+        m_output += ';';
+        m_output += std::to_string(col + 1);
+        m_output += 'H';
+      }
+      emit(line + col);
+      cursor_row = row;
+      cursor_col = col + 1;
+    }
+  }
+  m_full_redraw = false;
+  if (!m_output.empty())
+    write_all(m_output);
+}
+
+void Screen::write_all(const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(STDOUT_FILENO, data.data() + written,
+                        data.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    written += static_cast<size_t>(n);
+  }
+}
+
+int Screen::wait(int timeout_ms) {
+  pollfd none = {-1, 0, 0};
+  return wait(timeout_ms, none);
+}
+
+int Screen::wait(int timeout_ms, pollfd &event) {
+  event.revents = 0;
+  if (g_resized || g_quit)
+    return 0;
+  // Not a terminal, e.g. /dev/null: it would poll readable at EOF forever.
+  // poll() skips negative fds.
+  pollfd fds[2] = {{m_read_keys ? STDIN_FILENO : -1, POLLIN, 0}, event};
+  if (poll(fds, 2, timeout_ms) <= 0)
+    return 0; // Timeout, or EINTR from a signal
+  event.revents = fds[1].revents;
+  char key;
+  if ((fds[0].revents & POLLIN) && read(STDIN_FILENO, &key, 1) == 1)
+    return static_cast<unsigned char>(key);
+  return 0;
+}
+
+bool Screen::quit_requested() const { return g_quit != 0; }
+
+} // namespace term
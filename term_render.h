@@ -0,0 +1,82 @@
+#ifndef TERM_RENDER_H
+#define TERM_RENDER_H
+
+#include <cstdint>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <termios.h>
+#include <vector>
+
+// Full-screen drawing for the monitors. A frame is drawn into a back buffer
+// of cells and compared with what the terminal already shows; only cells that
+// changed are sent, with ANSI cursor movement, in a single write. Nothing is
+// cleared between frames, so nothing flickers.
+namespace term {
+
+enum class Style : uint8_t { NORMAL, BOLD, DIM, GOOD, WARN, BAD, INVERSE };
+
+// Owns the terminal while it exists: switches to the alternate screen, hides
+// the cursor and reads keys unbuffered, and puts everything back on
+// destruction. SIGWINCH, SIGINT and SIGTERM are handled while it lives, so
+// only one can exist at a time.
+class Screen {
+public:
+  Screen();
+  ~Screen();
+  Screen(const Screen &) = delete;
+  Screen &operator=(const Screen &) = delete;
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+
+  // Starts a frame with every cell blank. Picks up a resize first, so the
+  // frame is drawn for the current size.
+  void clear();
+  // Text is clipped to the screen; it should be plain ASCII.
+  void print(int row, int col, std::string_view text,
+             Style style = Style::NORMAL);
+  // Prints text of several lines, each starting at `col`; returns the row
+  // after the last one.
+  int print_lines(int row, int col, std::string_view text,
+                  Style style = Style::NORMAL);
+  // A meter `width` cells wide filled to `fraction` (0 to 1).
+  void bar(int row, int col, int width, double fraction, Style style);
+  // Sends the difference to the previous frame to the terminal.
+  void present();
+
+  // Waits up to timeout_ms (-1 for no limit) for a key press, resize or
+  // signal. Returns the key, or 0 if there was none.
+  int wait(int timeout_ms);
+  // Also wakes up for `event`, an fd of the caller's, whose revents are set
+  // on return.
+  int wait(int timeout_ms, pollfd &event);
+  // Set once SIGINT or SIGTERM arrived.
+  bool quit_requested() const;
+
+private:
+  struct Cell {
+    char ch = ' ';
+    Style style = Style::NORMAL;
+    bool operator==(const Cell &other) const {
+      return ch == other.ch && style == other.style;
+    }
+  };
+
+  void update_size();
+  void write_all(const std::string &data);
+
+  int m_width = 80;
+  int m_height = 24;
+  std::vector<Cell> m_front; // What the terminal shows
+  std::vector<Cell> m_back;  // The frame being drawn
+  bool m_full_redraw = true;
+  Style m_style = Style::NORMAL; // The terminal's current attributes
+  std::string m_output;
+  termios m_saved_termios;
+  bool m_restore_termios = false;
+  bool m_read_keys = false;
+};
+
+} // namespace term
+#endif // !TERM_RENDER_H
@@ -1,4 +1,23 @@
-#include "utils.h"
+// Build:
+//   g++ -std=c++17 -O2 terminal_timer.cpp timer_wheel.cpp notify_dispatch.cpp
+//       instrument.cpp -o terminal_timer
+//
+// Usage: terminal_timer <command> [args...]
+//   start <duration> [--name <name>] [message...]
+//   stop [<name>]      cancel a timer; without a name, stop the daemon
+//   list
+//   status [<name>]
+// Durations combine hours, minutes, seconds and milliseconds, fractions
+// allowed: 1h2m3s, 1.5s, 250ms. A bare number is seconds.
+//
+// One daemon keeps every timer in a timing wheel and sleeps on a single
+// timerfd armed for the earliest of them. The commands talk to it over a
+// Unix socket, and `start` launches it when it isn't running. Alerts go out
+// through notify-send and kdialog without holding up the other timers.
+#include "instrument.h"
+#include "notify_dispatch.h"
+#include "timer_wheel.h"
+#include <algorithm>
 #include <cctype>
 #include <cerrno>
 #include <chrono>
@@ -9,21 +28,35 @@
 #include <ctime>
 #include <fcntl.h>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <ostream>
-#include <stdexcept>
+#include <poll.h>
+#include <sstream>
 #include <string>
+#include <sys/file.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 using std::cerr;
 using std::endl;
 
+// Held locked by the running daemon, and holds its PID
 const std::string PID_FILE_PATH = "/tmp/term_timer.pid";
 const std::string LOG_FILE_PATH = "/tmp/term_timer.log";
-volatile sig_atomic_t g_terminate_flag = 0;
+const std::string SOCKET_PATH = "/tmp/term_timer.sock";
+// Two years, within what the timing wheel can hold
+const int64_t MAX_DURATION_MS = 2LL * 365 * 24 * 3600 * 1000;
+const size_t MAX_REQUEST_SIZE = 4096;
 
 class Logger {
 public:
@@ -79,289 +112,690 @@ private:
   }
 };
 
+void daemonize();
+int64_t parse_duration_ms(const std::string &);
+std::string format_duration(uint64_t ms);
+std::string format_clock_time(uint64_t ms_from_now);
+int send_request(const std::string &request, bool launch);
+
 /*
- * The format of start is changed, Now the user can provide `s` for seconds,`m`
- * for minutes and `h` for hours. Example: 2h3m1s
+ * The daemon's side. Every request is one line on its own connection:
+ *   start <ms> <name or -> [message]
+ *   stop [name]
+ *   list
+ *   status [name]
+ * and the reply, after which the daemon closes the connection, is "OK\n"
+ * followed by the text to show, or "ERR <message>\n".
+ *
+ * Time is counted in milliseconds since the daemon started, on the
+ * monotonic clock, so changing the wall clock doesn't move the timers.
  */
+class TimerDaemon {
+public:
+  explicit TimerDaemon(Logger &logger)
+      : m_logger(logger), m_notifier([&logger](const std::string &error) {
+          logger.log(Logger::Level::WARNING, error);
+        }) {}
+  ~TimerDaemon();
 
-Logger *g_logger = nullptr;
+  TimerDaemon(const TimerDaemon &) = delete;
+  TimerDaemon &operator=(const TimerDaemon &) = delete;
 
-void handle_signal(int sig_number);
-void daemonize();
-void run_timer_daemon_task(int duration_seconds);
-bool is_daemon_running();
-void create_pid_file();
-double parse_duration_seconds(const std::string &);
+  // Takes the PID file lock and the socket. Returns false if another daemon
+  // holds them or something couldn't be set up.
+  bool open();
+  void run();
+
+private:
+  struct Timer {
+    std::string message; // As given, may be empty
+    uint64_t duration_ms = 0;
+    timers::TimerId id = 0;
+  };
+
+  uint64_t now_ms() const;
+  uint64_t remaining_ms(const Timer &timer) const;
+  // Fires whatever is due and points the timerfd at the next expiry
+  void expire_due();
+  void arm();
+  void serve_client();
+  std::string handle(const std::string &request);
+  std::string start_timer(std::istringstream &args);
+  std::string stop_timer(const std::string &name);
+  std::string list_timers() const;
+  std::string status(const std::string &name) const;
+
+  Logger &m_logger;
+  notify::Dispatcher m_notifier;
+  int m_lock_fd = -1;
+  int m_listen_fd = -1;
+  int m_timer_fd = -1;
+  int m_signal_fd = -1;
+  uint64_t m_epoch_ns = 0;
+  uint64_t m_armed = timers::TimingWheel::NEVER;
+  bool m_running = true;
+  unsigned long m_next_number = 1; // For timer-N names
+  timers::TimingWheel m_wheel;
+  std::unordered_map<std::string, Timer> m_timers;
+  std::unordered_map<timers::TimerId, std::string> m_names;
+  std::vector<timers::TimerId> m_expired;
+};
 
 int main(int argc, char *argv[]) {
   if (argc < 2) {
     cerr << "Usage: " << argv[0] << " <command> [args...]" << endl;
     cerr << "Commands:" << endl;
-    cerr << "  start <duration_seconds>" << endl;
-    cerr << "  stop" << endl;
-    cerr << "  status" << endl;
+    cerr << "  start <duration> [--name <name>] [message...]" << endl;
+    cerr << "  stop [<name>]" << endl;
+    cerr << "  list" << endl;
+    cerr << "  status [<name>]" << endl;
     return 1;
   }
   std::string command = argv[1];
 
   if (command == "start") {
-    // TODO: Add message input support
-    if (argc != 3) {
-      cerr << "Usage: " << argv[0] << " start <duration_seconds>" << endl;
+    if (argc < 3) {
+      cerr << "Usage: " << argv[0]
+           << " start <duration> [--name <name>] [message...]" << endl;
       return 1;
     }
-
-    int duration_in_seconds;
-
-    try {
-      duration_in_seconds = parse_duration_seconds(argv[2]);
-    } catch (const std::invalid_argument &ia) {
-      cerr << "Error: Invalid duration '" << argv[2] << "'. " << ia.what()
+    int64_t duration_ms = parse_duration_ms(argv[2]);
+    if (duration_ms <= 0) {
+      cerr << "Error: Invalid duration '" << argv[2]
+           << "'. Use for example 1h2m3s, 1.5s or 250ms, up to two years."
            << endl;
       return 1;
     }
-    if (duration_in_seconds <= 0) {
-      cerr << "Error: Duration must be a positive number of seconds." << endl;
-      return 1;
-    }
 
-    // We need to check whether the daemon is running or not
-    if (is_daemon_running()) {
-      cerr << "Daemon is already running or PID file " << PID_FILE_PATH
-           << " is stale but points to an active process." << endl;
-      cerr << "Use '" << argv[0] << " status' and '" << argv[0] << " stop'."
-           << endl;
-      return 1;
+    std::string name = "-";
+    std::string message;
+    for (int arg = 3; arg < argc; arg++) {
+      if (strcmp(argv[arg], "--name") == 0 && arg + 1 < argc) {
+        name = argv[++arg];
+        bool valid = !name.empty() && name[0] != '-' &&
+                     std::none_of(name.begin(), name.end(), [](char c) {
+                       return std::isspace(static_cast<unsigned char>(c));
+                     });
+        if (!valid) {
+          cerr << "Error: Invalid timer name '" << name << "'." << endl;
+          return 1;
+        }
+      } else {
+        if (!message.empty()) {
+          message += ' ';
+        }
+        message += argv[arg];
+      }
     }
-    std::cout << "Starting the timer daemon";
-
-    if (signal(SIGINT, handle_signal) == SIG_ERR)
-      perror("Cannot set SIGINT handler");
+    // The request is a single line
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    return send_request("start " + std::to_string(duration_ms) + " " + name +
+                            " " + message,
+                        true);
+
+  } else if (command == "stop" || command == "status") {
+    std::string request = command;
+    if (argc > 2) {
+      request += " " + std::string(argv[2]);
+    }
+    return send_request(request, false);
+  } else if (command == "list") {
+    return send_request(command, false);
+  } else {
+    cerr << "Error: Unknown command '" << command << "'." << endl;
+    cerr << "Use 'start', 'stop', 'list' or 'status'." << endl;
+    return 1;
+  }
+}
 
-    if (signal(SIGTERM, handle_signal) == SIG_ERR)
-      perror("Cannot set SIGTERM handler");
+int connect_to_daemon() {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, SOCKET_PATH.c_str(), sizeof(address.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) <
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
 
+// Starts the daemon in the background and waits for it to take requests.
+// Returns its connection, or -1.
+int launch_daemon() {
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("Fork Failed");
+    return -1;
+  }
+  if (pid == 0) {
     daemonize();
-
-    g_logger = new Logger(LOG_FILE_PATH);
-    g_logger->log(Logger::Level::INFO, "Daemon Started working");
-    // The PID file should be created by the daemonized child process
-    create_pid_file();
-    run_timer_daemon_task(duration_in_seconds);
-
-  } else if (command == "stop") {
-    std::cout << "Stopping timer daemon..." << endl;
-    std::ifstream pid_file(PID_FILE_PATH);
-    if (!pid_file.is_open()) {
-      cerr << "Error: PID file " << PID_FILE_PATH
-           << " not found. Daemon not running or PID file missing." << endl;
-      return 1;
+    INSTRUMENT_INSTALL("terminal_timer", false);
+    {
+      Logger logger(LOG_FILE_PATH);
+      TimerDaemon daemon(logger);
+      if (daemon.open()) {
+        daemon.run();
+      }
     }
-
-    pid_t pid;
-    pid_file >> pid;
-    if (pid_file.fail() || pid <= 0) {
-      cerr << "Error: Invalid PID in " << PID_FILE_PATH << "." << endl;
-      pid_file.close();
-      std::remove(PID_FILE_PATH.c_str());
-      return 1;
+    exit(EXIT_SUCCESS);
+  }
+  // daemonize() leaves the first child as soon as the daemon is forked
+  waitpid(pid, nullptr, 0);
+  for (int attempt = 0; attempt < 200; attempt++) {
+    int fd = connect_to_daemon();
+    if (fd >= 0) {
+      return fd;
     }
-    pid_file.close();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return -1;
+}
 
-    // Checking the existance of process; ESRCH(No such process)
-    if (kill(pid, 0) == -1 && errno == ESRCH) {
-      cerr << "Process with PID " << pid
-           << " not found. Removing stale PID file." << endl;
-      std::remove(PID_FILE_PATH.c_str());
+// Sends one request and prints the daemon's reply. Returns the exit status.
+int send_request(const std::string &request, bool launch) {
+  int fd = connect_to_daemon();
+  if (fd < 0 && !launch) {
+    if (request == "stop") {
+      cerr << "Timer daemon is not running!" << endl;
       return 1;
     }
-
-    if (kill(pid, SIGTERM) == 0) {
-      std::cout << "Sent SIGTERM to process " << pid
-                << ". Waiting for it to stop..." << endl;
-      for (int i = 0; i <= 50; ++i) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        if (!is_daemon_running()) {
-          std::cout << "Daemon stopped." << endl;
-          return 0;
-        }
-      }
-      cerr << "Daemon (PID " << pid
-           << ") did not stop gracefully after 5 seconds." << endl;
-      cerr << "You might need to use 'kill -9 " << pid << "' if it's stuck."
+    if (request == "list") {
+      std::cout << "No timers." << endl;
+      return 0;
+    }
+    std::cout << "Timer daemon is not running!" << endl;
+    return request == "status" ? 0 : 1;
+  }
+  if (fd < 0) {
+    std::cout << "Starting the timer daemon" << endl;
+    fd = launch_daemon();
+    if (fd < 0) {
+      cerr << "Error: The timer daemon did not start, see " << LOG_FILE_PATH
            << endl;
       return 1;
-    } else {
-      perror(
-          ("Failed to send SIGTERM to process " + std::to_string(pid)).c_str());
-      if (errno == ESRCH) {
-        std::cout << "Process " << pid
-                  << " not found (might have already exited)." << std::endl;
-        std::remove(PID_FILE_PATH.c_str());
-      }
-      return 1;
     }
-  } else if (command == "status") {
-    if (is_daemon_running()) {
-      std::ifstream pid_file(PID_FILE_PATH);
-      pid_t pid;
-      if (pid_file.is_open()) {
-        pid_file >> pid;
-        pid_file.close();
-      }
-      if (pid > 0) {
-        std::cout << "Timer daemon is running (PID: " << pid << ")." << endl;
-      } else {
-        std::cout << "Timer daemon is running (PID could not be read from "
-                     "file, but process check passed)."
-                  << endl;
-      }
-    } else {
-      std::cout << "Timer daemon is not running!" << endl;
-    }
-  } else {
-    cerr << "Error: Unknown command '" << command << "'." << endl;
-    cerr << "Use 'start', 'stop', or 'status'." << endl;
+  }
+
+  std::string line = request + "\n";
+  if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) !=
+      static_cast<ssize_t>(line.size())) {
+    perror("Error: Could not send the request");
+    close(fd);
     return 1;
   }
-  return 0;
+  std::string reply;
+  char buffer[4096];
+  ssize_t received;
+  while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    reply.append(buffer, static_cast<size_t>(received));
+  }
+  close(fd);
+
+  if (reply.compare(0, 3, "OK\n") == 0) {
+    std::cout << reply.substr(3);
+    return 0;
+  }
+  if (reply.compare(0, 4, "ERR ") == 0) {
+    cerr << "Error: " << reply.substr(4);
+  } else {
+    cerr << "Error: No reply from the timer daemon." << endl;
+  }
+  return 1;
 }
 
-void run_timer_daemon_task(int duration_seconds) {
-  if (g_logger)
-    g_logger->log(Logger::Level::INFO, "Timer task started. Duration: " +
-                                           std::to_string(duration_seconds));
-  for (int i = 0; i < duration_seconds; ++i) {
-    if (g_terminate_flag) { // Termination by SIGNAL
-      if (g_logger)
-        g_logger->log(Logger::Level::INFO, "Timer task interrupted by signal.");
-      utils::send_notification("Timer stopped Prematurely by SIGNAL");
-      std::remove(PID_FILE_PATH.c_str());
-      if (g_logger)
-        g_logger->log(Logger::Level::INFO,
-                      "PID file removed. Exiting due to signal.");
-      exit(EXIT_SUCCESS);
-    }
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-  }
-  if (!g_terminate_flag) {
-    if (g_logger)
-      g_logger->log(Logger::Level::INFO, "Timer finished naturally.");
-    std::string alarm_message = "Your " + std::to_string(duration_seconds) +
-                                " second timer has finished.";
-    utils::send_notification(alarm_message);
-    utils::send_dialog(alarm_message);
-  }
-  std::remove(PID_FILE_PATH.c_str()); // Normal completion
-  if (g_logger)
-    g_logger->log(Logger::Level::INFO, "PID file removed. Exiting normally.");
-  delete g_logger;
-  exit(EXIT_SUCCESS);
+TimerDaemon::~TimerDaemon() {
+  if (m_listen_fd >= 0) {
+    close(m_listen_fd);
+    std::remove(SOCKET_PATH.c_str());
+  }
+  if (m_timer_fd >= 0) {
+    close(m_timer_fd);
+  }
+  if (m_signal_fd >= 0) {
+    close(m_signal_fd);
+  }
+  // The PID file stays; removing it would race with a daemon starting up,
+  // and the lock goes away with the descriptor
+  if (m_lock_fd >= 0) {
+    close(m_lock_fd);
+  }
 }
 
-bool is_daemon_running() {
-  std::ifstream pid_file(PID_FILE_PATH);
-  if (!pid_file.is_open()) {
+bool TimerDaemon::open() {
+  m_lock_fd = ::open(PID_FILE_PATH.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (m_lock_fd < 0) {
+    m_logger.log(Logger::Level::ERROR, "Could not open PID file " +
+                                           PID_FILE_PATH + ": " +
+                                           strerror(errno));
     return false;
   }
+  if (flock(m_lock_fd, LOCK_EX | LOCK_NB) < 0) {
+    m_logger.log(Logger::Level::WARNING, "Another daemon is running");
+    return false;
+  }
+  std::string pid = std::to_string(getpid()) + "\n";
+  if (ftruncate(m_lock_fd, 0) < 0 ||
+      write(m_lock_fd, pid.data(), pid.size()) < 0) {
+    m_logger.log(Logger::Level::WARNING,
+                 "Could not write PID file: " + std::string(strerror(errno)));
+  }
 
-  pid_t pid;
-  pid_file >> pid;
+  // With the lock held, a socket left behind is a crashed daemon's
+  std::remove(SOCKET_PATH.c_str());
+  m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, SOCKET_PATH.c_str(), sizeof(address.sun_path) - 1);
+  if (m_listen_fd < 0 ||
+      bind(m_listen_fd, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      chmod(SOCKET_PATH.c_str(), 0600) < 0 ||
+      listen(m_listen_fd, SOMAXCONN) < 0) {
+    m_logger.log(Logger::Level::ERROR, "Could not listen on " + SOCKET_PATH +
+                                           ": " + strerror(errno));
+    return false;
+  }
 
-  if (pid_file.fail() || pid <= 0) { // Corrupted PID File
-    pid_file.close();
-    std::remove(PID_FILE_PATH.c_str());
+  m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+  m_signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  signal(SIGPIPE, SIG_IGN);
+  if (m_timer_fd < 0 || m_signal_fd < 0 || !m_notifier.open()) {
+    m_logger.log(Logger::Level::ERROR,
+                 "Could not create the timerfd or signalfds: " +
+                     std::string(strerror(errno)));
     return false;
   }
-  pid_file.close();
-  if (kill(pid, 0) == 0) { // Just checking the process whether the process
-                           // exists and the user allowed to send signals
-    return true;
-  } else {
-    if (errno == ESRCH) { // if the signal errorno(provided by cerror) ==
-                          // process not exists
-      std::remove(PID_FILE_PATH.c_str());
+
+  // One dialog at a time: timers that fire while it is up are listed in
+  // the next one
+  notify::Sink desktop;
+  desktop.name = "desktop";
+  desktop.command = {"notify-send", "Timer Alert!", "{message}", "-u",
+                     "critical",    "-i",           "dialog-information"};
+  desktop.timeout = std::chrono::seconds(5);
+  m_notifier.add_sink(desktop);
+  notify::Sink dialog;
+  dialog.name = "dialog";
+  dialog.command = {"kdialog", "--title=TermAlarm", "--msgbox", "{message}"};
+  dialog.timeout = std::chrono::minutes(30);
+  m_notifier.add_sink(dialog);
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  m_epoch_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000 +
+               static_cast<uint64_t>(now.tv_nsec);
+  m_logger.log(Logger::Level::INFO, "Daemon Started working");
+  return true;
+}
+
+void TimerDaemon::run() {
+  pollfd fds[4] = {{m_signal_fd, POLLIN, 0},
+                   {m_timer_fd, POLLIN, 0},
+                   {m_listen_fd, POLLIN, 0},
+                   {m_notifier.fd(), POLLIN, 0}};
+  while (m_running) {
+    // The timerfd wakes us for the next expiry; the timeout is only for
+    // alerts that are held back or helpers that overstay
+    if (poll(fds, 4, m_notifier.timeout()) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      m_logger.log(Logger::Level::ERROR,
+                   "poll failed: " + std::string(strerror(errno)));
+      break;
     }
-    return false;
+    if (fds[0].revents & POLLIN) {
+      signalfd_siginfo info;
+      if (read(m_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        m_logger.log(Logger::Level::INFO,
+                     "Signal " + std::to_string(info.ssi_signo) +
+                         " received.");
+      }
+      if (!m_timers.empty()) {
+        m_notifier.post(std::to_string(m_timers.size()) +
+                        " timers stopped Prematurely by SIGNAL");
+        m_notifier.dispatch();
+      }
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      expire_due();
+    }
+    if (fds[2].revents & POLLIN) {
+      serve_client();
+    }
+    m_notifier.dispatch();
   }
+  m_logger.log(Logger::Level::INFO,
+               "Daemon exiting, " + std::to_string(m_timers.size()) +
+                   " timers cancelled.");
 }
 
-void create_pid_file() {
-  if (is_daemon_running()) {
-    cerr << "Error: Daemon seems to be already running (PID file exists and "
-            "process active)."
-         << endl;
-    cerr << "If not, remove " << PID_FILE_PATH << " manually." << endl;
-    exit(EXIT_FAILURE);
+uint64_t TimerDaemon::now_ms() const {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t ns = static_cast<uint64_t>(now.tv_sec) * 1000000000 +
+                static_cast<uint64_t>(now.tv_nsec);
+  return (ns - m_epoch_ns) / 1000000;
+}
+
+uint64_t TimerDaemon::remaining_ms(const Timer &timer) const {
+  uint64_t expires = m_wheel.expiry(timer.id);
+  uint64_t now = now_ms();
+  return expires > now ? expires - now : 0;
+}
+
+void TimerDaemon::expire_due() {
+  uint64_t expirations;
+  if (read(m_timer_fd, &expirations, sizeof(expirations)) > 0) {
+    m_armed = timers::TimingWheel::NEVER; // It is one-shot
+  }
+  INSTRUMENT_SCOPE("timers.expire");
+  m_expired.clear();
+  m_wheel.advance(now_ms(), m_expired);
+  INSTRUMENT_COUNT("timers.fired", static_cast<int64_t>(m_expired.size()));
+  for (timers::TimerId id : m_expired) {
+    auto name = m_names.find(id);
+    if (name == m_names.end()) {
+      continue;
+    }
+    auto timer = m_timers.find(name->second);
+    std::string alarm_message = timer->second.message;
+    if (alarm_message.empty()) {
+      alarm_message = "Your " + format_duration(timer->second.duration_ms) +
+                      " timer " + name->second + " has finished.";
+    }
+    m_logger.log(Logger::Level::INFO, "Timer " + name->second + " finished.");
+    m_notifier.post(alarm_message);
+    m_timers.erase(timer);
+    m_names.erase(name);
   }
-  if (g_logger)
-    g_logger->log(Logger::Level::INFO, "Creating PID file: " + PID_FILE_PATH);
+  INSTRUMENT_GAUGE("timers", static_cast<int64_t>(m_timers.size()));
+  arm();
+}
 
-  std::ofstream pid_file(PID_FILE_PATH, std::ios::out | std::ios::trunc);
-  if (!pid_file.is_open()) {
-    if (g_logger) {
-      g_logger->log(Logger::Level::ERROR,
-                    "Failed to write to PID file: " + PID_FILE_PATH +
-                        ". Error: " + strerror(errno));
-    } else {
-      cerr << "Error creating PID file: " << PID_FILE_PATH << endl;
+void TimerDaemon::arm() {
+  uint64_t next = m_wheel.next_expiry();
+  if (next == m_armed) {
+    return;
+  }
+  // Absolute, so the time spent getting here doesn't delay it
+  itimerspec spec{};
+  if (next != timers::TimingWheel::NEVER) {
+    uint64_t ns = m_epoch_ns + next * 1000000;
+    spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+  }
+  if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+    m_logger.log(Logger::Level::ERROR,
+                 "timerfd_settime failed: " + std::string(strerror(errno)));
+    return;
+  }
+  m_armed = next;
+}
+
+void TimerDaemon::serve_client() {
+  INSTRUMENT_SCOPE("timers.request");
+  int client = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (client < 0) {
+    return;
+  }
+  // A stuck client mustn't hold up the timers for long
+  timeval timeout{1, 0};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  std::string request;
+  char buffer[512];
+  while (request.find('\n') == std::string::npos &&
+         request.size() < MAX_REQUEST_SIZE) {
+    ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      break;
     }
-    exit(EXIT_FAILURE);
+    request.append(buffer, static_cast<size_t>(received));
   }
+  request = request.substr(0, request.find('\n'));
+
+  std::string reply = handle(request);
+  size_t sent = 0;
+  while (sent < reply.size()) {
+    ssize_t count = send(client, reply.data() + sent, reply.size() - sent,
+                         MSG_NOSIGNAL);
+    if (count <= 0) {
+      break;
+    }
+    sent += static_cast<size_t>(count);
+  }
+  close(client);
+}
 
-  pid_file << getpid();
-  if (pid_file.fail()) {
-    pid_file.close();
-    if (g_logger)
-      g_logger->log(Logger::Level::ERROR,
-                    "Failed to write to PID file: " + PID_FILE_PATH +
-                        ". Error: " + strerror(errno));
-    else
-      std::cerr << "Error writing to PID file: " << PID_FILE_PATH << std::endl;
-    std::remove(PID_FILE_PATH.c_str());
-    exit(EXIT_FAILURE);
+std::string TimerDaemon::handle(const std::string &request) {
+  // Nothing that is already due shows up as pending
+  expire_due();
+
+  std::istringstream args(request);
+  std::string command;
+  std::string name;
+  args >> command;
+  if (command == "start") {
+    std::string reply = start_timer(args);
+    arm();
+    return reply;
+  }
+  args >> name;
+  if (command == "stop" && name.empty()) {
+    m_running = false;
+    return "OK\nStopped the timer daemon, cancelling " +
+           std::to_string(m_timers.size()) + " timers.\n";
+  }
+  if (command == "stop") {
+    std::string reply = stop_timer(name);
+    arm();
+    return reply;
+  }
+  if (command == "list") {
+    return list_timers();
+  }
+  if (command == "status") {
+    return status(name);
   }
-  pid_file.close();
+  return "ERR Unknown request '" + command + "'\n";
 }
 
-double parse_duration_seconds(const std::string &duration_str) {
-  std::string digit_str = "";
-  double total_sec = 0;
-  for (const char &c : duration_str) {
-    if (std::isdigit(c)) {
-      digit_str += c;
-    } else {
-      if (!digit_str.empty()) {
-        char unit = std::tolower(c);
-        long long val;
-        try {
-          val = std::stoll(digit_str);
-        } catch (const std::invalid_argument &ia) {
-          return -1;
-        } catch (const std::out_of_range &oor) {
-          return -1;
-        }
+std::string TimerDaemon::start_timer(std::istringstream &args) {
+  uint64_t duration_ms = 0;
+  std::string name;
+  std::string message;
+  if (!(args >> duration_ms >> name) || duration_ms == 0 ||
+      duration_ms > static_cast<uint64_t>(MAX_DURATION_MS)) {
+    return "ERR Malformed start request\n";
+  }
+  std::getline(args >> std::ws, message);
+  if (name == "-") {
+    do {
+      name = "timer-" + std::to_string(m_next_number++);
+    } while (m_timers.count(name) > 0);
+  } else if (m_timers.count(name) > 0) {
+    return "ERR A timer named " + name + " is already running.\n";
+  }
 
-        if (unit == 'h') {
-          total_sec += val * 3600;
-        } else if (unit == 'm') {
-          total_sec += val * 60;
-        } else if (unit == 's') {
-          total_sec += val;
-        } else {
-          return -1;
-        }
+  Timer timer;
+  timer.message = message;
+  timer.duration_ms = duration_ms;
+  timer.id = m_wheel.add(now_ms() + duration_ms);
+  m_names.emplace(timer.id, name);
+  m_timers.emplace(name, timer);
+  m_logger.log(Logger::Level::INFO,
+               "Timer " + name + " started. Duration: " +
+                   format_duration(duration_ms));
+  return "OK\nStarted " + name + " for " + format_duration(duration_ms) +
+         ", due at " + format_clock_time(duration_ms) + ".\n";
+}
 
-        digit_str.clear();
-      } else {
-        std::cout << "char " << c << " don't have any digit to associate with!";
-        return -1;
+std::string TimerDaemon::stop_timer(const std::string &name) {
+  auto timer = m_timers.find(name);
+  if (timer == m_timers.end()) {
+    return "ERR No timer named " + name + ".\n";
+  }
+  std::string left = format_duration(remaining_ms(timer->second));
+  m_wheel.cancel(timer->second.id);
+  m_names.erase(timer->second.id);
+  m_timers.erase(timer);
+  m_logger.log(Logger::Level::INFO, "Timer " + name + " stopped.");
+  return "OK\nStopped " + name + " with " + left + " left.\n";
+}
+
+std::string TimerDaemon::list_timers() const {
+  if (m_timers.empty()) {
+    return "OK\nNo timers.\n";
+  }
+  std::vector<std::pair<uint64_t, const std::string *>> order;
+  for (const auto &[name, timer] : m_timers) {
+    order.emplace_back(remaining_ms(timer), &name);
+  }
+  std::sort(order.begin(), order.end(), [](const auto &a, const auto &b) {
+    return a.first < b.first || (a.first == b.first && *a.second < *b.second);
+  });
+
+  std::ostringstream out;
+  out << "OK\n"
+      << std::left << std::setw(16) << "NAME" << std::setw(16) << "REMAINING"
+      << std::setw(10) << "DUE"
+      << "MESSAGE\n";
+  for (const auto &[remaining, name] : order) {
+    out << std::setw(16) << *name << std::setw(16)
+        << format_duration(remaining) << std::setw(10)
+        << format_clock_time(remaining) << m_timers.at(*name).message << '\n';
+  }
+  return out.str();
+}
+
+std::string TimerDaemon::status(const std::string &name) const {
+  if (!name.empty()) {
+    auto timer = m_timers.find(name);
+    if (timer == m_timers.end()) {
+      return "ERR No timer named " + name + ".\n";
+    }
+    uint64_t remaining = remaining_ms(timer->second);
+    return "OK\n" + name + ": " + format_duration(remaining) + " left of " +
+           format_duration(timer->second.duration_ms) + ", due at " +
+           format_clock_time(remaining) + ".\n";
+  }
+
+  std::string reply = "OK\nTimer daemon is running (PID: " +
+                      std::to_string(getpid()) + "), " +
+                      std::to_string(m_timers.size()) + " timers.\n";
+  uint64_t next = m_wheel.next_expiry();
+  if (next != timers::TimingWheel::NEVER) {
+    for (const auto &[timer_name, timer] : m_timers) {
+      if (m_wheel.expiry(timer.id) == next) {
+        reply += "Next: " + timer_name + " in " +
+                 format_duration(remaining_ms(timer)) + ".\n";
+        break;
       }
     }
   }
-  return (total_sec > 0 && total_sec <= 2147483647)
-             ? static_cast<int>(total_sec)
-             : -1;
+  return reply;
+}
+
+/*
+ * Hours, minutes, seconds and milliseconds, each a number with an optional
+ * fraction and its unit: 2h3m1s, 1.5s, 250ms. A number without a unit is
+ * seconds. Returns -1 if the text isn't a positive duration of at most
+ * MAX_DURATION_MS.
+ */
+int64_t parse_duration_ms(const std::string &duration_str) {
+  double total_ms = 0;
+  size_t pos = 0;
+  if (duration_str.empty()) {
+    return -1;
+  }
+  while (pos < duration_str.size()) {
+    size_t digits = pos;
+    while (digits < duration_str.size() &&
+           (std::isdigit(static_cast<unsigned char>(duration_str[digits])) ||
+            duration_str[digits] == '.')) {
+      digits++;
+    }
+    if (digits == pos) {
+      return -1; // A unit without a number
+    }
+    char *end = nullptr;
+    std::string number = duration_str.substr(pos, digits - pos);
+    double value = std::strtod(number.c_str(), &end);
+    if (*end != '\0') {
+      return -1; // "1.2.3"
+    }
+    pos = digits;
+
+    std::string unit;
+    while (pos < duration_str.size() &&
+           std::isalpha(static_cast<unsigned char>(duration_str[pos]))) {
+      unit += static_cast<char>(std::tolower(duration_str[pos++]));
+    }
+    if (unit == "h") {
+      total_ms += value * 3600000;
+    } else if (unit == "m") {
+      total_ms += value * 60000;
+    } else if (unit == "s" || unit.empty()) {
+      total_ms += value * 1000;
+    } else if (unit == "ms") {
+      total_ms += value;
+    } else {
+      return -1;
+    }
+  }
+  int64_t rounded = static_cast<int64_t>(total_ms + 0.5);
+  return (rounded > 0 && rounded <= MAX_DURATION_MS) ? rounded : -1;
+}
+
+// "1h02m03s", "2m05.250s" or "0.250s"
+std::string format_duration(uint64_t ms) {
+  uint64_t hours = ms / 3600000;
+  uint64_t minutes = ms / 60000 % 60;
+  uint64_t seconds = ms / 1000 % 60;
+  uint64_t millis = ms % 1000;
+  std::ostringstream out;
+  out << std::setfill('0');
+  if (hours > 0) {
+    out << hours << 'h' << std::setw(2);
+  }
+  if (hours > 0 || minutes > 0) {
+    out << minutes << 'm' << std::setw(2);
+  }
+  out << seconds;
+  if (millis > 0) {
+    out << '.' << std::setw(3) << millis;
+  }
+  out << 's';
+  return out.str();
+}
+
+// The wall clock time `ms_from_now` from now, "HH:MM:SS"
+std::string format_clock_time(uint64_t ms_from_now) {
+  auto due = std::chrono::system_clock::now() +
+             std::chrono::milliseconds(ms_from_now);
+  std::time_t due_time_t = std::chrono::system_clock::to_time_t(due);
+  std::tm due_tm = *std::localtime(&due_time_t);
+  char time_buffer[16];
+  if (std::strftime(time_buffer, sizeof(time_buffer), "%H:%M:%S", &due_tm) ==
+      0) {
+    return "?";
+  }
+  return time_buffer;
 }
 
 void daemonize() {
@@ -399,12 +833,3 @@ void daemonize() {
     close(STDOUT_FILENO);
   }
 }
-
-void handle_signal(int sig_number) {
-  if (g_logger)
-    g_logger->log(Logger::Level::INFO,
-                  "Signal " + std::to_string(sig_number) + " received.");
-  if (sig_number == SIGINT || sig_number == SIGTERM) {
-    g_terminate_flag = 1;
-  }
-}
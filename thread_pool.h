@@ -0,0 +1,412 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A general purpose work-stealing executor shared by file_searcher, the
+// command_server background jobs and the monitors.
+//
+// Each worker owns a Chase-Lev deque: tasks a worker posts land on its own
+// deque, it takes them back LIFO without any locking, and idle workers steal
+// the oldest ones from the other end. Tasks posted from outside the pool, and
+// HIGH/LOW priority tasks from anywhere, go through small mutex protected
+// queues that workers check in priority order.
+namespace threading {
+
+enum class Priority { HIGH, NORMAL, LOW };
+
+struct PoolOptions {
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  // Pin worker i to the i-th CPU the process may run on
+  bool pin_threads = false;
+  // Pin worker i to cpus[i % cpus.size()] instead, e.g. following
+  // topology::Topology::pinning_plan()
+  std::vector<int> cpus;
+};
+
+namespace detail {
+
+struct Task {
+  virtual ~Task() = default;
+  virtual void run() = 0;
+};
+
+template <typename F> struct CallableTask : Task {
+  template <typename G>
+  explicit CallableTask(G &&g) : callable(std::forward<G>(g)) {}
+  void run() override { callable(); }
+  F callable;
+};
+
+template <typename F> Task *make_task(F &&f) {
+  return new CallableTask<std::decay_t<F>>(std::forward<F>(f));
+}
+
+// Chase-Lev work-stealing deque ("Correct and Efficient Work-Stealing for
+// Weak Memory Models", Le et al. 2013). push() and take() may only be called
+// by the owning worker, steal() by anyone.
+class WorkStealingDeque {
+public:
+  explicit WorkStealingDeque(size_t capacity = 256)
+      : m_array(new Array(capacity)) {
+    m_retired.emplace_back(m_array.load(std::memory_order_relaxed));
+  }
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  void push(Task *task) {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_acquire);
+    Array *array = m_array.load(std::memory_order_relaxed);
+    if (bottom - top > static_cast<int64_t>(array->capacity) - 1)
+      array = grow(array, top, bottom);
+    array->put(bottom, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  Task *take() {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    Array *array = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Task *task = array->get(bottom);
+    if (top == bottom) {
+      // Last element: race the thieves for it
+      if (!m_top.compare_exchange_strong(top, top + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+        task = nullptr;
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  Task *steal() {
+    int64_t top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom)
+      return nullptr;
+    Array *array = m_array.load(std::memory_order_acquire);
+    Task *task = array->get(top);
+    if (!m_top.compare_exchange_strong(top, top + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+      return nullptr; // Lost to another thief or the owner
+    return task;
+  }
+
+private:
+  struct Array {
+    explicit Array(size_t capacity)
+        : capacity(capacity), mask(capacity - 1), slots(capacity) {}
+    Task *get(int64_t i) const {
+      return slots[static_cast<size_t>(i) & mask].load(
+          std::memory_order_relaxed);
+    }
+    void put(int64_t i, Task *task) {
+      slots[static_cast<size_t>(i) & mask].store(task,
+                                                 std::memory_order_relaxed);
+    }
+    size_t capacity; // Always a power of two
+    size_t mask;
+    std::vector<std::atomic<Task *>> slots;
+  };
+
+  Array *grow(Array *old, int64_t top, int64_t bottom) {
+    auto *array = new Array(old->capacity * 2);
+    for (int64_t i = top; i < bottom; i++)
+      array->put(i, old->get(i));
+    // Thieves may still be reading the old array, so it stays allocated
+    // until the deque goes away
+    m_retired.emplace_back(array);
+    m_array.store(array, std::memory_order_release);
+    return array;
+  }
+
+  alignas(64) std::atomic<int64_t> m_top{0};
+  alignas(64) std::atomic<int64_t> m_bottom{0};
+  std::atomic<Array *> m_array;
+  std::vector<std::unique_ptr<Array>> m_retired;
+};
+
+} // namespace detail
+
+class ThreadPool {
+public:
+  explicit ThreadPool(const PoolOptions &options = PoolOptions())
+      : m_stop(false) {
+    size_t threads = std::max<size_t>(1, options.threads);
+    for (size_t i = 0; i < threads; i++)
+      m_deques.emplace_back(std::make_unique<detail::WorkStealingDeque>());
+
+    std::vector<int> cpus = options.cpus;
+    if (cpus.empty() && options.pin_threads) {
+      cpu_set_t allowed;
+      CPU_ZERO(&allowed);
+      if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+          if (CPU_ISSET(cpu, &allowed))
+            cpus.push_back(cpu);
+        }
+      }
+    }
+    for (size_t i = 0; i < threads; i++) {
+      m_workers.emplace_back([this, i] { worker_loop(i); });
+      if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % cpus.size()], &set);
+        pthread_setaffinity_np(m_workers.back().native_handle(), sizeof(set),
+                               &set);
+      }
+    }
+  }
+
+  // Finishes everything still queued, including tasks those tasks post.
+  ~ThreadPool() {
+    wait_idle();
+    {
+      std::lock_guard<std::mutex> lock(m_sleep_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &worker : m_workers)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return m_workers.size(); }
+
+  // Index of the calling worker thread of this pool, -1 for other threads.
+  // Handy for per-worker scratch state.
+  int current_worker() const {
+    return t_pool == this ? static_cast<int>(t_worker_index) : -1;
+  }
+
+  // Fire and forget; `f` must not throw.
+  template <typename F>
+  void post(F &&f, Priority priority = Priority::NORMAL) {
+    push(detail::make_task(std::forward<F>(f)), priority);
+    wake(1);
+  }
+
+  // Runs f(args...) on the pool; exceptions end up in the future.
+  template <typename F, typename... Args>
+  auto submit(F &&f, Args &&...args)
+      -> std::future<std::invoke_result_t<F, Args...>> {
+    using Result = std::invoke_result_t<F, Args...>;
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<Result> result = task->get_future();
+    post([task] { (*task)(); });
+    return result;
+  }
+
+  // Queues a range of callables with one wakeup for the lot.
+  template <typename Iterator>
+  void post_bulk(Iterator first, Iterator last,
+                 Priority priority = Priority::NORMAL) {
+    size_t count = 0;
+    for (; first != last; ++first, ++count)
+      push(detail::make_task(std::move(*first)), priority);
+    wake(count);
+  }
+
+  // Calls body(begin, end) over [first, last) in pieces of about `grain`
+  // items and returns when all are done. The calling thread works on pieces
+  // too, so this is safe to use from inside a pool task. The first exception
+  // thrown by `body` is rethrown here.
+  template <typename Body>
+  void parallel_for(size_t first, size_t last, size_t grain, Body &&body) {
+    if (first >= last)
+      return;
+    grain = std::max<size_t>(1, grain);
+    struct State {
+      std::atomic<size_t> next;
+      std::atomic<size_t> remaining;
+      size_t last;
+      size_t grain;
+      std::mutex mutex;
+      std::condition_variable done;
+      std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+    state->next = first;
+    state->last = last;
+    state->grain = grain;
+    size_t pieces = (last - first + grain - 1) / grain;
+    state->remaining = pieces;
+
+    // Helpers and the caller claim pieces from the same counter; a helper
+    // that starts after everything is claimed just returns
+    auto work = [state, &body] {
+      while (true) {
+        size_t begin = state->next.fetch_add(state->grain);
+        if (begin >= state->last)
+          return;
+        size_t end = std::min(begin + state->grain, state->last);
+        try {
+          body(begin, end);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (!state->error)
+            state->error = std::current_exception();
+        }
+        if (state->remaining.fetch_sub(1) == 1) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->done.notify_all();
+        }
+      }
+    };
+    size_t helpers = std::min(pieces - 1, size());
+    for (size_t i = 0; i < helpers; i++)
+      push(detail::make_task(work), Priority::HIGH);
+    wake(helpers);
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->remaining == 0; });
+    if (state->error)
+      std::rethrow_exception(state->error);
+  }
+
+  // Blocks until every queued and running task has finished. Must not be
+  // called from a pool task.
+  void wait_idle() {
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    m_idle.wait(lock, [this] { return m_pending == 0; });
+  }
+
+private:
+  struct SharedQueue {
+    std::mutex mutex;
+    std::deque<detail::Task *> tasks;
+    std::atomic<size_t> size{0};
+  };
+
+  void push(detail::Task *task, Priority priority) {
+    m_pending++;
+    // Counted before it becomes visible, so a worker can never take it and
+    // decrement first
+    m_queued++;
+    int worker = current_worker();
+    if (priority == Priority::NORMAL && worker >= 0) {
+      m_deques[worker]->push(task);
+    } else {
+      SharedQueue &queue = m_shared[static_cast<int>(priority)];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(task);
+      queue.size++;
+    }
+  }
+
+  void wake(size_t count) {
+    if (count == 0 || m_sleeping == 0)
+      return;
+    // Taking the lock orders this against a worker that has just checked
+    // m_queued and is about to wait
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    if (count == 1)
+      m_wake.notify_one();
+    else
+      m_wake.notify_all();
+  }
+
+  detail::Task *pop_shared(Priority priority) {
+    SharedQueue &queue = m_shared[static_cast<int>(priority)];
+    if (queue.size == 0)
+      return nullptr;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      return nullptr;
+    detail::Task *task = queue.tasks.front();
+    queue.tasks.pop_front();
+    queue.size--;
+    return task;
+  }
+
+  detail::Task *find_task(size_t index) {
+    detail::Task *task = pop_shared(Priority::HIGH);
+    if (task == nullptr)
+      task = m_deques[index]->take();
+    if (task == nullptr)
+      task = pop_shared(Priority::NORMAL);
+    for (size_t i = 1; task == nullptr && i < m_deques.size(); i++)
+      task = m_deques[(index + i) % m_deques.size()]->steal();
+    if (task == nullptr)
+      task = pop_shared(Priority::LOW);
+    return task;
+  }
+
+  void worker_loop(size_t index) {
+    t_pool = this;
+    t_worker_index = index;
+    while (true) {
+      detail::Task *task = find_task(index);
+      if (task != nullptr) {
+        m_queued--;
+        task->run();
+        delete task;
+        if (--m_pending == 0) {
+          std::lock_guard<std::mutex> lock(m_sleep_mutex);
+          m_idle.notify_all();
+        }
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(m_sleep_mutex);
+      m_sleeping++;
+      // A task may sit in a deque while a thief's failed steal makes it look
+      // empty, hence re-scanning whenever m_queued says there is work
+      m_wake.wait(lock, [this] { return m_queued > 0 || m_stop; });
+      m_sleeping--;
+      if (m_stop && m_queued == 0)
+        return;
+    }
+  }
+
+  static inline thread_local const ThreadPool *t_pool = nullptr;
+  static inline thread_local size_t t_worker_index = 0;
+
+  std::vector<std::unique_ptr<detail::WorkStealingDeque>> m_deques;
+  SharedQueue m_shared[3]; // Indexed by Priority
+  std::vector<std::thread> m_workers;
+
+  // Tasks sitting in a queue / tasks not finished yet (queued or running)
+  std::atomic<size_t> m_queued{0};
+  std::atomic<size_t> m_pending{0};
+  std::atomic<size_t> m_sleeping{0};
+
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  bool m_stop;
+};
+
+} // namespace threading
+#endif // !THREAD_POOL_H
@@ -0,0 +1,200 @@
+#include "timer_wheel.h"
+#include <algorithm>
+#include <iterator>
+
+namespace timers {
+
+namespace {
+
+const uint64_t SLOT_MASK = TimingWheel::SLOTS - 1;
+
+inline unsigned shift_of(unsigned level) {
+  return level * TimingWheel::SLOT_BITS;
+}
+
+inline uint64_t rotate_right(uint64_t bits, unsigned count) {
+  return count == 0 ? bits : (bits >> count) | (bits << (64 - count));
+}
+
+} // namespace
+
+TimingWheel::TimingWheel(uint64_t now) : m_now(now) {
+  for (auto &level : m_heads)
+    std::fill(std::begin(level), std::end(level), NIL);
+}
+
+const TimingWheel::Node *TimingWheel::find(TimerId id) const {
+  uint32_t index = static_cast<uint32_t>(id);
+  if (index >= m_nodes.size())
+    return nullptr;
+  const Node &node = m_nodes[index];
+  if (!node.pending || node.generation != static_cast<uint32_t>(id >> 32))
+    return nullptr;
+  return &node;
+}
+
+TimerId TimingWheel::add(uint64_t expires) {
+  const uint64_t reach = (uint64_t(1) << shift_of(LEVELS)) - 1;
+  expires = std::max(expires, m_now + 1);
+  if (expires - m_now > reach)
+    expires = m_now + reach;
+
+  uint32_t index;
+  if (!m_free.empty()) {
+    index = m_free.back();
+    m_free.pop_back();
+  } else {
+    index = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+  }
+  Node &node = m_nodes[index];
+  node.expires = expires;
+  node.pending = true;
+  place(index);
+  m_size++;
+  return (static_cast<uint64_t>(node.generation) << 32) | index;
+}
+
+bool TimingWheel::cancel(TimerId id) {
+  if (find(id) == nullptr)
+    return false;
+  uint32_t index = static_cast<uint32_t>(id);
+  unlink(index);
+  release(index);
+  return true;
+}
+
+uint64_t TimingWheel::expiry(TimerId id) const {
+  const Node *node = find(id);
+  return node ? node->expires : NEVER;
+}
+
+void TimingWheel::place(uint32_t index) {
+  uint64_t expires = m_nodes[index].expires;
+  if (expires <= m_now) {
+    // Only while cascading: due now, fired in the same advance step
+    link(index, 0, static_cast<unsigned>(m_now & SLOT_MASK));
+    return;
+  }
+  uint64_t delta = expires - m_now;
+  unsigned level = 0;
+  while (level + 1 < LEVELS && delta >= uint64_t(1) << shift_of(level + 1))
+    level++;
+  link(index, level,
+       static_cast<unsigned>((expires >> shift_of(level)) & SLOT_MASK));
+}
+
+void TimingWheel::link(uint32_t index, unsigned level, unsigned slot) {
+  Node &node = m_nodes[index];
+  node.level = static_cast<uint8_t>(level);
+  node.slot = static_cast<uint8_t>(slot);
+  node.prev = NIL;
+  node.next = m_heads[level][slot];
+  if (node.next != NIL)
+    m_nodes[node.next].prev = index;
+  m_heads[level][slot] = index;
+  m_occupied[level] |= uint64_t(1) << slot;
+}
+
+void TimingWheel::unlink(uint32_t index) {
+  Node &node = m_nodes[index];
+  if (node.prev != NIL)
+    m_nodes[node.prev].next = node.next;
+  else
+    m_heads[node.level][node.slot] = node.next;
+  if (node.next != NIL)
+    m_nodes[node.next].prev = node.prev;
+  if (m_heads[node.level][node.slot] == NIL)
+    m_occupied[node.level] &= ~(uint64_t(1) << node.slot);
+  node.prev = node.next = NIL;
+}
+
+void TimingWheel::release(uint32_t index) {
+  Node &node = m_nodes[index];
+  node.pending = false;
+  node.generation++;
+  m_free.push_back(index);
+  m_size--;
+}
+
+uint64_t TimingWheel::first_turn(unsigned level, unsigned &slot) const {
+  // The first occupied slot after the current one, going round. A slot
+  // only ever holds timers of the turn it comes up next.
+  uint64_t base = m_now >> shift_of(level);
+  unsigned current = static_cast<unsigned>(base & SLOT_MASK);
+  unsigned start = (current + 1) & SLOT_MASK;
+  unsigned offset = static_cast<unsigned>(
+      __builtin_ctzll(rotate_right(m_occupied[level], start)));
+  slot = (start + offset) & SLOT_MASK;
+  uint64_t turn = base - current + slot;
+  if (turn <= base)
+    turn += SLOTS;
+  return turn;
+}
+
+uint64_t TimingWheel::next_step() const {
+  uint64_t next = NEVER;
+  for (unsigned level = 0; level < LEVELS; level++) {
+    if (m_occupied[level] == 0)
+      continue;
+    // Level 0 slots are single ticks; higher ones cascade at their start
+    unsigned slot;
+    next = std::min(next, first_turn(level, slot) << shift_of(level));
+  }
+  return next;
+}
+
+uint64_t TimingWheel::next_expiry() const {
+  uint64_t next = NEVER;
+  for (unsigned level = 0; level < LEVELS; level++) {
+    if (m_occupied[level] == 0)
+      continue;
+    unsigned slot;
+    first_turn(level, slot);
+    for (uint32_t index = m_heads[level][slot]; index != NIL;
+         index = m_nodes[index].next)
+      next = std::min(next, m_nodes[index].expires);
+  }
+  return next;
+}
+
+void TimingWheel::advance(uint64_t now, std::vector<TimerId> &expired) {
+  while (true) {
+    uint64_t next = next_step();
+    if (next > now) {
+      m_now = std::max(m_now, now);
+      return;
+    }
+    m_now = next;
+
+    // Highest first, so timers cascading from one level can go on to the
+    // next in the same step
+    for (unsigned level = LEVELS - 1; level > 0; level--) {
+      uint64_t span = uint64_t(1) << shift_of(level);
+      if ((m_now & (span - 1)) != 0)
+        continue;
+      unsigned slot = static_cast<unsigned>((m_now >> shift_of(level)) &
+                                            SLOT_MASK);
+      uint32_t index = m_heads[level][slot];
+      m_heads[level][slot] = NIL;
+      m_occupied[level] &= ~(uint64_t(1) << slot);
+      while (index != NIL) {
+        uint32_t next_index = m_nodes[index].next;
+        place(index);
+        index = next_index;
+      }
+    }
+
+    unsigned slot = static_cast<unsigned>(m_now & SLOT_MASK);
+    while (m_heads[0][slot] != NIL) {
+      uint32_t index = m_heads[0][slot];
+      unlink(index);
+      expired.push_back((static_cast<uint64_t>(m_nodes[index].generation)
+                         << 32) |
+                        index);
+      release(index);
+    }
+  }
+}
+
+} // namespace timers
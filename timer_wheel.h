@@ -0,0 +1,80 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A hierarchical timing wheel for terminal_timer's daemon. Time is counted
+// in ticks (milliseconds there). There are LEVELS wheels of SLOTS slots; a
+// slot of level L spans SLOTS^L ticks, so level 0 holds timers due within
+// SLOTS ticks to the tick, and each level above covers SLOTS times as much.
+// When time reaches the start of a higher slot, its timers cascade down to
+// where they now belong. Adding and cancelling are O(1) and advancing costs
+// nothing for the ticks where nothing happens, however many timers wait.
+namespace timers {
+
+using TimerId = uint64_t;
+
+class TimingWheel {
+public:
+  static constexpr unsigned SLOT_BITS = 6;
+  static constexpr unsigned SLOTS = 1u << SLOT_BITS;
+  // 64^6 ticks, two years of milliseconds
+  static constexpr unsigned LEVELS = 6;
+  static constexpr uint64_t NEVER = UINT64_MAX;
+
+  explicit TimingWheel(uint64_t now = 0);
+
+  uint64_t now() const { return m_now; }
+  size_t size() const { return m_size; }
+
+  // A timer due at tick `expires`; one that is already due fires at the
+  // next tick. Further out than the wheels reach is brought in to the
+  // latest tick they can hold.
+  TimerId add(uint64_t expires);
+  // Returns false if the timer already fired or was cancelled.
+  bool cancel(TimerId id);
+  // The tick the timer fires at, or NEVER for one that isn't pending.
+  uint64_t expiry(TimerId id) const;
+
+  // The tick the earliest pending timer fires at, NEVER if there is none.
+  // Looks through one slot per level, the first occupied one.
+  uint64_t next_expiry() const;
+  // Moves time forward to `now`, appending the timers that fired to
+  // `expired` in the order they fell due.
+  void advance(uint64_t now, std::vector<TimerId> &expired);
+
+private:
+  static constexpr uint32_t NIL = UINT32_MAX;
+
+  struct Node {
+    uint64_t expires = 0;
+    uint32_t prev = NIL;
+    uint32_t next = NIL;
+    uint32_t generation = 0; // Makes ids of reused nodes distinct
+    uint8_t level = 0;
+    uint8_t slot = 0;
+    bool pending = false;
+  };
+
+  // The next tick something happens at: a timer fires or a slot cascades.
+  uint64_t next_step() const;
+  // Slot and turn of the first occupied slot of a level after the current
+  uint64_t first_turn(unsigned level, unsigned &slot) const;
+  const Node *find(TimerId id) const;
+  void place(uint32_t index);
+  void link(uint32_t index, unsigned level, unsigned slot);
+  void unlink(uint32_t index);
+  void release(uint32_t index);
+
+  uint64_t m_now;
+  size_t m_size = 0;
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_free;
+  uint32_t m_heads[LEVELS][SLOTS];
+  uint64_t m_occupied[LEVELS] = {}; // A bit per non-empty slot
+};
+
+} // namespace timers
+#endif // !TIMER_WHEEL_H
@@ -0,0 +1,390 @@
+#include "trigram_index.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace trigram {
+
+namespace {
+
+const char MAGIC[8] = {'F', 'S', 'T', 'R', 'I', 'G', 'R', 'M'};
+const uint32_t VERSION = 1;
+
+inline uint8_t fold(uint8_t byte) {
+  return (byte >= 'A' && byte <= 'Z') ? static_cast<uint8_t>(byte + 32) : byte;
+}
+
+// The distinct trigrams of a buffer, leaving out any that span a newline
+// since a match never does. The seen-set is a 2 MB bitmap over all 2^24
+// trigrams that is cleared again bit by bit, so collecting from a small file
+// costs nothing like clearing the whole map.
+class TrigramCollector {
+public:
+  TrigramCollector() : m_seen((1u << 24) / 64, 0) {}
+
+  void collect(std::string_view data, std::vector<uint32_t> &out) {
+    out.clear();
+    uint32_t trigram = 0;
+    int run = 0; // Bytes since the last newline
+    for (char c : data) {
+      uint8_t byte = static_cast<uint8_t>(c);
+      if (byte == '\n') {
+        run = 0;
+        continue;
+      }
+      trigram = ((trigram << 8) | fold(byte)) & 0xFFFFFF;
+      if (++run < 3)
+        continue;
+      uint64_t &word = m_seen[trigram >> 6];
+      uint64_t bit = uint64_t(1) << (trigram & 63);
+      if (word & bit)
+        continue;
+      word |= bit;
+      out.push_back(trigram);
+    }
+    for (uint32_t seen : out)
+      m_seen[seen >> 6] = 0;
+  }
+
+private:
+  std::vector<uint64_t> m_seen;
+};
+
+void walk_tree(const std::string &dir, int depth,
+               const walk::WalkOptions &options,
+               std::vector<std::string> &files) {
+  int child_depth = depth + 1;
+  bool descend = options.max_depth < 0 || child_depth <= options.max_depth;
+  std::vector<std::string> subdirs;
+  bool ok = walk::list_directory(
+      dir, [&](const std::string &path, walk::EntryType type) {
+        std::string_view name(path);
+        name.remove_prefix(path.rfind('/') + 1);
+        if (type == walk::EntryType::DIRECTORY) {
+          if (descend && !walk::is_excluded(name, options))
+            subdirs.push_back(path);
+        } else if (type == walk::EntryType::FILE) {
+          if (walk::is_included_file(name, options))
+            files.push_back(path);
+        }
+      });
+  if (!ok)
+    perror(("Error: Could not read directory " + dir).c_str());
+  for (const std::string &subdir : subdirs)
+    walk_tree(subdir, child_depth, options, files);
+}
+
+bool write_all(FILE *out, const void *data, size_t size) {
+  return size == 0 || fwrite(data, 1, size, out) == size;
+}
+
+} // namespace
+
+bool Index::open(const std::string &path) {
+  if (!m_file.open(path))
+    return false;
+  const char *base = m_file.data();
+  size_t size = m_file.size();
+  if (size < sizeof(Header))
+    return false;
+  const Header *header = reinterpret_cast<const Header *>(base);
+  if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header->version != VERSION)
+    return false;
+
+  auto fits = [size](uint64_t offset, uint64_t count, size_t element) {
+    return offset <= size && count <= (size - offset) / element;
+  };
+  if (!fits(header->files_offset, header->file_count, sizeof(FileEntry)) ||
+      header->paths_offset > header->trigrams_offset ||
+      !fits(header->trigrams_offset, header->trigram_count,
+            sizeof(TrigramEntry)) ||
+      header->postings_offset > size)
+    return false;
+
+  m_files = reinterpret_cast<const FileEntry *>(base + header->files_offset);
+  m_files_count = header->file_count;
+  m_paths = base + header->paths_offset;
+  m_trigrams =
+      reinterpret_cast<const TrigramEntry *>(base + header->trigrams_offset);
+  m_trigrams_count = header->trigram_count;
+  m_postings =
+      reinterpret_cast<const uint32_t *>(base + header->postings_offset);
+
+  // Everything else is trusted once the tables that point into the rest of
+  // the file are in bounds
+  size_t paths_size = header->trigrams_offset - header->paths_offset;
+  size_t postings_count = (size - header->postings_offset) / sizeof(uint32_t);
+  for (size_t i = 0; i < m_files_count; i++) {
+    if (m_files[i].path_offset + m_files[i].path_length > paths_size)
+      return false;
+  }
+  for (size_t i = 0; i < m_trigrams_count; i++) {
+    if (m_trigrams[i].first + m_trigrams[i].count > postings_count)
+      return false;
+  }
+  return true;
+}
+
+std::string_view Index::path(uint32_t id) const {
+  return std::string_view(m_paths + m_files[id].path_offset,
+                          m_files[id].path_length);
+}
+
+uint32_t Index::find_file(std::string_view path) const {
+  size_t low = 0;
+  size_t high = m_files_count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (this->path(static_cast<uint32_t>(mid)) < path)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low < m_files_count && this->path(static_cast<uint32_t>(low)) == path)
+    return static_cast<uint32_t>(low);
+  return NO_FILE;
+}
+
+std::pair<const uint32_t *, const uint32_t *>
+Index::postings(uint32_t trigram) const {
+  const TrigramEntry *end = m_trigrams + m_trigrams_count;
+  const TrigramEntry *entry = std::lower_bound(
+      m_trigrams, end, trigram,
+      [](const TrigramEntry &e, uint32_t t) { return e.trigram < t; });
+  if (entry == end || entry->trigram != trigram)
+    return {nullptr, nullptr};
+  return {m_postings + entry->first, m_postings + entry->first + entry->count};
+}
+
+std::vector<uint32_t> Index::candidates(
+    const std::vector<std::string> &literals) const {
+  std::vector<uint32_t> all(m_files_count);
+  for (size_t i = 0; i < m_files_count; i++)
+    all[i] = static_cast<uint32_t>(i);
+
+  std::vector<uint32_t> result;
+  if (literals.empty())
+    return all;
+
+  TrigramCollector collector;
+  std::vector<uint32_t> trigrams;
+  for (const std::string &literal : literals) {
+    if (literal.size() < 3 || literal.find('\n') != std::string::npos)
+      return all;
+    collector.collect(literal, trigrams);
+
+    // Intersect the shortest lists first so the working set shrinks fast
+    std::vector<std::pair<const uint32_t *, const uint32_t *>> lists;
+    for (uint32_t t : trigrams)
+      lists.push_back(postings(t));
+    std::sort(lists.begin(), lists.end(), [](const auto &a, const auto &b) {
+      return a.second - a.first < b.second - b.first;
+    });
+    std::vector<uint32_t> matching(lists[0].first, lists[0].second);
+    std::vector<uint32_t> narrowed;
+    for (size_t i = 1; i < lists.size() && !matching.empty(); i++) {
+      narrowed.clear();
+      std::set_intersection(matching.begin(), matching.end(), lists[i].first,
+                            lists[i].second, std::back_inserter(narrowed));
+      matching.swap(narrowed);
+    }
+
+    std::vector<uint32_t> merged;
+    std::set_union(result.begin(), result.end(), matching.begin(),
+                   matching.end(), std::back_inserter(merged));
+    result.swap(merged);
+  }
+  return result;
+}
+
+bool build_index(const std::string &index_path,
+                 const std::vector<std::string> &roots,
+                 const walk::WalkOptions &options, size_t num_threads,
+                 BuildStats &stats) {
+  Index previous;
+  bool have_previous = previous.open(index_path);
+
+  // Paths are stored absolute so the index works from any directory
+  std::vector<std::string> paths;
+  for (const std::string &root : roots) {
+    char resolved[PATH_MAX];
+    struct stat st;
+    if (realpath(root.c_str(), resolved) == nullptr ||
+        stat(resolved, &st) != 0) {
+      perror(("Error: Could not open " + root).c_str());
+      continue;
+    }
+    if (S_ISDIR(st.st_mode))
+      walk_tree(resolved, 0, options, paths);
+    else
+      paths.push_back(resolved);
+  }
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  if (paths.size() >= NO_FILE) {
+    std::cerr << "Error: Too many files for one index" << std::endl;
+    return false;
+  }
+
+  // Stat and, where needed, read every file in parallel. Ids are positions
+  // in the sorted path list, so each piece writes only its own entries.
+  const size_t file_count = paths.size();
+  std::vector<FileEntry> entries(file_count, FileEntry{});
+  std::vector<uint32_t> previous_ids(file_count, NO_FILE);
+  std::atomic<size_t> reused{0};
+  std::atomic<size_t> binary{0};
+
+  // Scratch space per thread: slot 0 is this thread, which takes pieces of
+  // the loop too, the rest are the pool workers
+  threading::PoolOptions pool_options;
+  pool_options.threads = std::max<size_t>(1, num_threads) - 1;
+  pool_options.pin_threads = false;
+  threading::ThreadPool pool(pool_options);
+  struct Slot {
+    TrigramCollector collector;
+    std::vector<uint32_t> trigrams;
+    std::vector<uint64_t> keys;
+  };
+  std::vector<Slot> slots(pool.size() + 1);
+
+  pool.parallel_for(0, file_count, 64, [&](size_t first, size_t last) {
+    Slot &slot = slots[pool.current_worker() + 1];
+    scan::MappedFile file;
+    for (size_t id = first; id < last; id++) {
+      FileEntry &entry = entries[id];
+      struct stat st;
+      if (stat(paths[id].c_str(), &st) != 0) {
+        entry.flags |= FILE_UNREAD; // Gone since the walk, never matches
+        continue;
+      }
+      entry.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                       st.st_mtim.tv_nsec;
+      entry.size = static_cast<uint64_t>(st.st_size);
+
+      if (have_previous) {
+        uint32_t old_id = previous.find_file(paths[id]);
+        if (old_id != NO_FILE &&
+            !(previous.file(old_id).flags & FILE_UNREAD) &&
+            previous.file(old_id).mtime_ns == entry.mtime_ns &&
+            previous.file(old_id).size == entry.size) {
+          previous_ids[id] = old_id;
+          entry.flags = previous.file(old_id).flags;
+          reused++;
+          if (entry.flags & FILE_BINARY)
+            binary++;
+          continue;
+        }
+      }
+
+      if (!file.open(paths[id])) {
+        perror(("Error: Could not open file " + paths[id]).c_str());
+        entry.flags |= FILE_UNREAD;
+        continue;
+      }
+      std::string_view data = file.view();
+      if (walk::looks_binary(data.data(), data.size())) {
+        entry.flags |= FILE_BINARY;
+        binary++;
+        continue;
+      }
+      slot.collector.collect(data, slot.trigrams);
+      for (uint32_t t : slot.trigrams)
+        slot.keys.push_back(static_cast<uint64_t>(t) << 32 | id);
+    }
+  });
+
+  // One (trigram << 32 | file id) key per posting; sorted, they are the
+  // posting lists back to back
+  std::vector<uint64_t> keys;
+  for (Slot &slot : slots) {
+    keys.insert(keys.end(), slot.keys.begin(), slot.keys.end());
+    std::vector<uint64_t>().swap(slot.keys);
+  }
+  if (have_previous) {
+    std::vector<uint32_t> renumbered(previous.file_count(), NO_FILE);
+    for (size_t id = 0; id < file_count; id++) {
+      if (previous_ids[id] != NO_FILE)
+        renumbered[previous_ids[id]] = static_cast<uint32_t>(id);
+    }
+    previous.for_each_posting([&](uint32_t trigram, uint32_t old_id) {
+      if (renumbered[old_id] != NO_FILE)
+        keys.push_back(static_cast<uint64_t>(trigram) << 32 |
+                       renumbered[old_id]);
+    });
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<TrigramEntry> trigram_table;
+  std::vector<uint32_t> posting_list(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint32_t trigram = static_cast<uint32_t>(keys[i] >> 32);
+    if (trigram_table.empty() || trigram_table.back().trigram != trigram)
+      trigram_table.push_back(TrigramEntry{trigram, 0, i});
+    trigram_table.back().count++;
+    posting_list[i] = static_cast<uint32_t>(keys[i]);
+  }
+  std::vector<uint64_t>().swap(keys);
+
+  std::string path_bytes;
+  for (size_t id = 0; id < file_count; id++) {
+    entries[id].path_offset = path_bytes.size();
+    entries[id].path_length = static_cast<uint32_t>(paths[id].size());
+    path_bytes += paths[id];
+  }
+  // Pad so the tables after the paths stay aligned
+  path_bytes.resize((path_bytes.size() + 7) & ~size_t(7), '\0');
+
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.file_count = file_count;
+  header.files_offset = sizeof(Header);
+  header.paths_offset = header.files_offset + file_count * sizeof(FileEntry);
+  header.trigram_count = trigram_table.size();
+  header.trigrams_offset = header.paths_offset + path_bytes.size();
+  header.postings_offset =
+      header.trigrams_offset + trigram_table.size() * sizeof(TrigramEntry);
+
+  // Written next to the old index and renamed over it, so a concurrent
+  // search sees either the old or the new one
+  std::string tmp_path = index_path + ".tmp";
+  FILE *out = fopen(tmp_path.c_str(), "wb");
+  if (out == nullptr) {
+    perror(("Error: Could not create " + tmp_path).c_str());
+    return false;
+  }
+  bool ok = write_all(out, &header, sizeof(header)) &&
+            write_all(out, entries.data(),
+                      entries.size() * sizeof(FileEntry)) &&
+            write_all(out, path_bytes.data(), path_bytes.size()) &&
+            write_all(out, trigram_table.data(),
+                      trigram_table.size() * sizeof(TrigramEntry)) &&
+            write_all(out, posting_list.data(),
+                      posting_list.size() * sizeof(uint32_t));
+  ok = (fflush(out) == 0) && ok && fsync(fileno(out)) == 0;
+  if (fclose(out) != 0)
+    ok = false;
+  if (!ok || rename(tmp_path.c_str(), index_path.c_str()) != 0) {
+    perror(("Error: Could not write " + index_path).c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  stats.files = file_count;
+  stats.reused = reused;
+  stats.binary = binary;
+  stats.trigrams = trigram_table.size();
+  return true;
+}
+
+} // namespace trigram
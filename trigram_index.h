@@ -0,0 +1,119 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include "dir_walker.h"
+#include "scan_engine.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// On-disk trigram index for file_searcher. For every indexed file it stores
+// the set of (ASCII case-folded) byte trigrams occurring within its lines, as
+// posting lists of file ids per trigram. A query only has to scan the files
+// that contain every trigram of one of the literals a match requires.
+//
+// The file is laid out to be used straight from an mmap:
+//   Header
+//   FileEntry[file_count]           sorted by path
+//   path bytes
+//   TrigramEntry[trigram_count]     sorted by trigram
+//   uint32_t postings[]             file ids, ascending per trigram
+namespace trigram {
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t file_count;
+  uint64_t files_offset;
+  uint64_t paths_offset;
+  uint64_t trigram_count;
+  uint64_t trigrams_offset;
+  uint64_t postings_offset;
+};
+
+struct FileEntry {
+  uint64_t path_offset; // Relative to Header::paths_offset
+  uint32_t path_length;
+  uint32_t flags;
+  int64_t mtime_ns;
+  uint64_t size;
+};
+
+struct TrigramEntry {
+  uint32_t trigram;
+  uint32_t count;
+  uint64_t first; // Index of the first posting
+};
+
+const uint32_t NO_FILE = UINT32_MAX;
+
+enum FileFlags : uint32_t {
+  // Not indexed; a query only includes it when binary files are searched
+  FILE_BINARY = 1u << 0,
+  // Could not be read, so it has no postings; the next build tries again
+  FILE_UNREAD = 1u << 1,
+};
+
+class Index {
+public:
+  // Returns false if the file can't be read or isn't a valid index.
+  bool open(const std::string &path);
+
+  size_t file_count() const { return m_files_count; }
+  std::string_view path(uint32_t id) const;
+  const FileEntry &file(uint32_t id) const { return m_files[id]; }
+  // Id of the file with this exact path, or NO_FILE.
+  uint32_t find_file(std::string_view path) const;
+
+  // Calls on_posting(trigram, file_id) for every posting in the index.
+  template <typename Callback>
+  void for_each_posting(Callback &&on_posting) const {
+    for (size_t i = 0; i < m_trigrams_count; i++) {
+      const TrigramEntry &entry = m_trigrams[i];
+      for (uint32_t p = 0; p < entry.count; p++)
+        on_posting(entry.trigram, m_postings[entry.first + p]);
+    }
+  }
+
+  // Ids of the files that may hold a line containing one of `literals`,
+  // ascending. With no literals, or one too short to have a trigram, every
+  // file is a candidate.
+  std::vector<uint32_t> candidates(
+      const std::vector<std::string> &literals) const;
+
+private:
+  // [begin, end) of the trigram's posting list, empty if it never occurs
+  std::pair<const uint32_t *, const uint32_t *> postings(
+      uint32_t trigram) const;
+
+  scan::MappedFile m_file;
+  const FileEntry *m_files = nullptr;
+  size_t m_files_count = 0;
+  const char *m_paths = nullptr;
+  const TrigramEntry *m_trigrams = nullptr;
+  size_t m_trigrams_count = 0;
+  const uint32_t *m_postings = nullptr;
+};
+
+struct BuildStats {
+  size_t files = 0;
+  size_t reused = 0; // Unchanged since the previous index, not reread
+  size_t binary = 0;
+  size_t trigrams = 0;
+};
+
+// Indexes every file under `roots` and writes the index to `index_path`,
+// replacing it atomically. Files whose mtime and size match the previous
+// index at that path keep their postings without being read again. Returns
+// false with a message on stderr if the index can't be written.
+bool build_index(const std::string &index_path,
+                 const std::vector<std::string> &roots,
+                 const walk::WalkOptions &options, size_t num_threads,
+                 BuildStats &stats);
+
+} // namespace trigram
+#endif // !TRIGRAM_INDEX_H
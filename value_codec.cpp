@@ -0,0 +1,132 @@
+#include "value_codec.h"
+#include "lz_codec.h"
+#include <chrono>
+#include <cstdio>
+#include <string_view>
+#include <utility>
+
+namespace value_codec {
+
+namespace {
+
+// For big values compress a prefix first, so an incompressible 500 KB blob
+// (already gzipped, encrypted, ...) costs a 4 KB attempt instead of a full one.
+const size_t SAMPLE_MIN_SIZE = 64 * 1024;
+const size_t SAMPLE_SIZE = 4096;
+
+uint64_t usec_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+StoredValue ValueCodec::encode(std::string raw) {
+  StoredValue value;
+  if (!m_config.enabled || raw.size() < m_config.threshold ||
+      raw.size() > UINT32_MAX) {
+    value.bytes = std::move(raw);
+    return value;
+  }
+
+  m_stats.compress_attempts.fetch_add(1, std::memory_order_relaxed);
+  auto start = std::chrono::steady_clock::now();
+
+  if (raw.size() >= SAMPLE_MIN_SIZE) {
+    std::string sample =
+        lz::compress(std::string_view(raw.data(), SAMPLE_SIZE));
+    if (SAMPLE_SIZE < m_config.min_ratio * sample.size()) {
+      m_stats.compress_usec.fetch_add(usec_since(start),
+                                      std::memory_order_relaxed);
+      m_stats.compress_rejected.fetch_add(1, std::memory_order_relaxed);
+      value.bytes = std::move(raw);
+      return value;
+    }
+  }
+
+  std::string packed = lz::compress(raw);
+  m_stats.compress_usec.fetch_add(usec_since(start),
+                                  std::memory_order_relaxed);
+
+  if (raw.size() < m_config.min_ratio * packed.size()) {
+    m_stats.compress_rejected.fetch_add(1, std::memory_order_relaxed);
+    value.bytes = std::move(raw);
+    return value;
+  }
+
+  // The codec reserves worst-case capacity; give the slack back, otherwise
+  // we'd keep paying for the raw size.
+  packed.shrink_to_fit();
+  value.raw_size = static_cast<uint32_t>(raw.size());
+  value.bytes = std::move(packed);
+  value.compressed = true;
+  return value;
+}
+
+bool ValueCodec::decode(const StoredValue &value, std::string &out) {
+  if (!value.compressed) {
+    out = value.bytes;
+    return true;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  bool ok = lz::decompress(value.bytes, value.raw_size, out);
+  m_stats.decompress_calls.fetch_add(1, std::memory_order_relaxed);
+  m_stats.decompress_usec.fetch_add(usec_since(start),
+                                    std::memory_order_relaxed);
+  if (!ok)
+    m_stats.decompress_errors.fetch_add(1, std::memory_order_relaxed);
+  return ok;
+}
+
+void ValueCodec::on_insert(const StoredValue &value) {
+  if (!value.compressed)
+    return;
+  m_stats.compressed_keys.fetch_add(1, std::memory_order_relaxed);
+  m_stats.compressed_raw_bytes.fetch_add(value.raw_size,
+                                         std::memory_order_relaxed);
+  m_stats.compressed_stored_bytes.fetch_add(value.bytes.size(),
+                                            std::memory_order_relaxed);
+}
+
+void ValueCodec::on_remove(const StoredValue &value) {
+  if (!value.compressed)
+    return;
+  m_stats.compressed_keys.fetch_sub(1, std::memory_order_relaxed);
+  m_stats.compressed_raw_bytes.fetch_sub(value.raw_size,
+                                         std::memory_order_relaxed);
+  m_stats.compressed_stored_bytes.fetch_sub(value.bytes.size(),
+                                            std::memory_order_relaxed);
+}
+
+std::string ValueCodec::info() const {
+  auto load = [](const std::atomic<uint64_t> &counter) {
+    return std::to_string(counter.load(std::memory_order_relaxed));
+  };
+  uint64_t raw_bytes =
+      m_stats.compressed_raw_bytes.load(std::memory_order_relaxed);
+  uint64_t stored_bytes =
+      m_stats.compressed_stored_bytes.load(std::memory_order_relaxed);
+  char ratio[32];
+  std::snprintf(ratio, sizeof(ratio), "%.2f",
+                stored_bytes ? double(raw_bytes) / stored_bytes : 0.0);
+
+  std::string info;
+  info += "compression_enabled:" + std::to_string(m_config.enabled) + "\r\n";
+  info += "compression_threshold:" + std::to_string(m_config.threshold) +
+          "\r\n";
+  info += "compressed_keys:" + load(m_stats.compressed_keys) + "\r\n";
+  info += "compressed_raw_bytes:" + std::to_string(raw_bytes) + "\r\n";
+  info += "compressed_stored_bytes:" + std::to_string(stored_bytes) + "\r\n";
+  info += "compression_ratio:" + std::string(ratio) + "\r\n";
+  info += "compress_attempts:" + load(m_stats.compress_attempts) + "\r\n";
+  info += "compress_rejected:" + load(m_stats.compress_rejected) + "\r\n";
+  info += "compress_usec:" + load(m_stats.compress_usec) + "\r\n";
+  info += "decompress_calls:" + load(m_stats.decompress_calls) + "\r\n";
+  info += "decompress_usec:" + load(m_stats.decompress_usec) + "\r\n";
+  info += "decompress_errors:" + load(m_stats.decompress_errors) + "\r\n";
+  return info;
+}
+
+} // namespace value_codec
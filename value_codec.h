@@ -0,0 +1,72 @@
+#ifndef VALUE_CODEC_H
+#define VALUE_CODEC_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace value_codec {
+
+struct Config {
+  bool enabled = true;
+  // Values shorter than this are always stored as-is.
+  size_t threshold = 4096;
+  // Keep the compressed form only if raw_size / compressed_size reaches this.
+  double min_ratio = 1.3;
+};
+
+// Stored representation of one value. `raw_size` is kept for compressed
+// values so GET can size the output buffer and STRLEN-like queries don't
+// have to decompress.
+struct StoredValue {
+  std::string bytes;
+  uint32_t raw_size = 0;
+  bool compressed = false;
+
+  size_t size() const { return compressed ? raw_size : bytes.size(); }
+};
+
+struct Stats {
+  // Counters
+  std::atomic<uint64_t> compress_attempts{0};
+  std::atomic<uint64_t> compress_rejected{0};
+  std::atomic<uint64_t> compress_usec{0};
+  std::atomic<uint64_t> decompress_calls{0};
+  std::atomic<uint64_t> decompress_usec{0};
+  std::atomic<uint64_t> decompress_errors{0};
+  // Gauges over the values currently in the store
+  std::atomic<uint64_t> compressed_keys{0};
+  std::atomic<uint64_t> compressed_raw_bytes{0};
+  std::atomic<uint64_t> compressed_stored_bytes{0};
+};
+
+class ValueCodec {
+public:
+  explicit ValueCodec(const Config &config = Config()) : m_config(config) {}
+
+  // Called without the store lock held, compression is the expensive part.
+  StoredValue encode(std::string raw);
+  // Returns false if the stored block is corrupted.
+  bool decode(const StoredValue &value, std::string &out);
+
+  // Keep the gauges in sync; called under the store lock whenever a stored
+  // value enters or leaves the map.
+  void on_insert(const StoredValue &value);
+  void on_remove(const StoredValue &value);
+
+  // Only safe before client threads are started.
+  void set_config(const Config &config) { m_config = config; }
+  const Config &config() const { return m_config; }
+  const Stats &stats() const { return m_stats; }
+
+  // Lines in the INFO "key:value" format.
+  std::string info() const;
+
+private:
+  Config m_config;
+  Stats m_stats;
+};
+
+} // namespace value_codec
+#endif // !VALUE_CODEC_H